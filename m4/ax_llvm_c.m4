@@ -65,9 +65,13 @@ AC_DEFUN([AX_LLVM_C],
                 LLVM_CONFIG_BINDIR="$($ac_llvm_config_path --bindir)"
                 LLVM_LIBDIR="$($ac_llvm_config_path --libdir)"
 
-                llvm_ver_num="$(echo $LLVM_VERSION | sed s/\\.// | sed s/svn//g)"
-                if test "$llvm_ver_num" -lt "30"; then
-                    AC_MSG_ERROR([LLVM version 3.0 or later required])
+                # Version as major * 10 + minor ignoring any patch
+                # level or suffix such as "svn"
+                llvm_ver_major="$(echo $LLVM_VERSION | cut -d. -f1 | tr -cd 0123456789)"
+                llvm_ver_minor="$(echo $LLVM_VERSION | cut -d. -f2 | tr -cd 0123456789)"
+                llvm_ver_num="$(expr $llvm_ver_major \* 10 + $llvm_ver_minor)"
+                if test "$llvm_ver_num" -lt "32"; then
+                    AC_MSG_ERROR([LLVM version 3.2 or later required])
                 fi
 
                 AC_REQUIRE([AC_PROG_CXX])
@@ -140,6 +144,7 @@ AC_DEFUN([AX_LLVM_C],
             AC_SUBST(LLVM_LIBS)
             AC_DEFINE(HAVE_LLVM,,[Defined if LLVM is available])
             AC_DEFINE_UNQUOTED(LLVM_VERSION,["$LLVM_VERSION"],[Version of LLVM installed])
+            AC_DEFINE_UNQUOTED(LLVM_VERSION_NUM,[$llvm_ver_num],[Version of LLVM installed as a number])
             AC_DEFINE_UNQUOTED(LLVM_CONFIG_BINDIR,["$LLVM_CONFIG_BINDIR"],[Location of LLVM binaries])
         fi
         ])
@@ -41,10 +41,10 @@ static LLVMModuleRef  module = NULL;
 static LLVMBuilderRef builder = NULL;
 static LLVMValueRef   mod_name = NULL;
 
-static ident_t var_offset_i = NULL;
-static ident_t local_var_i = NULL;
-static ident_t global_const_i = NULL;
-static ident_t sig_nets_i = NULL;
+static side_tab_t *var_offsets = NULL;
+static side_tab_t *local_vars = NULL;
+static side_tab_t *global_consts = NULL;
+static side_tab_t *sig_nets = NULL;
 static ident_t foreign_i = NULL;
 static ident_t never_waits_i = NULL;
 static ident_t stmt_tag_i = NULL;
@@ -897,11 +897,11 @@ static LLVMValueRef cgen_array_signal_ptr(tree_t decl, LLVMValueRef elem)
 
 static LLVMValueRef cgen_get_var(tree_t decl, cgen_ctx_t *ctx)
 {
-   void *local = tree_attr_ptr(decl, local_var_i);
+   void *local = side_tab_get(local_vars, decl);
    if (local != NULL)
       return (LLVMValueRef)local;
 
-   void *global = tree_attr_ptr(decl, global_const_i);
+   void *global = side_tab_get(global_consts, decl);
    if (global != NULL) {
       type_t type = tree_type(decl);
       if (type_is_array(type) && cgen_const_bounds(type))
@@ -917,7 +917,7 @@ static LLVMValueRef cgen_get_var(tree_t decl, cgen_ctx_t *ctx)
 
    type_t type = tree_type(decl);
 
-   int offset = tree_attr_int(decl, var_offset_i, -1);
+   int offset = side_tab_get_int(var_offsets, decl, -1);
    if (offset == -1) {
       const char *name = istr(tree_ident(decl));
 
@@ -930,7 +930,7 @@ static LLVMValueRef cgen_get_var(tree_t decl, cgen_ctx_t *ctx)
          LLVMSetLinkage(var, LLVMExternalLinkage);
       }
 
-      tree_add_attr_ptr(decl, local_var_i, var);
+      side_tab_put(local_vars, decl, var);
       return var;
    }
 
@@ -1272,7 +1272,7 @@ static LLVMValueRef cgen_vec_load(LLVMValueRef nets, type_t type,
 static LLVMValueRef cgen_signal_nets(tree_t decl)
 {
    // Return the array of nets associated with a signal
-   void *nets = tree_attr_ptr(decl, sig_nets_i);
+   void *nets = side_tab_get(sig_nets, decl);
    assert(nets != NULL);
    return nets;
 }
@@ -3797,7 +3797,7 @@ static void cgen_visit_proc_vars(tree_t t, void *context)
    struct cgen_proc_var_ctx *ctx = context;
 
    ctx->types[ctx->offset] = llvm_type(tree_type(t));
-   tree_add_attr_int(t, var_offset_i, ctx->offset);
+   side_tab_put_int(var_offsets, t, ctx->offset);
 
    ctx->offset++;
 }
@@ -3868,7 +3868,7 @@ static void cgen_proc_var_init(tree_t t, cgen_ctx_t *ctx)
 
                cgen_array_copy(ty, ty, val, new_meta, NULL, ctx);
 
-               int offset = tree_attr_int(v, var_offset_i, -1);
+               int offset = side_tab_get_int(var_offsets, v, -1);
                assert(offset != -1);
 
                LLVMValueRef meta_ptr =
@@ -3886,6 +3886,56 @@ static void cgen_proc_var_init(tree_t t, cgen_ctx_t *ctx)
    }
 }
 
+static bool cgen_type_has_pointer(LLVMTypeRef ty)
+{
+   switch (LLVMGetTypeKind(ty)) {
+   case LLVMPointerTypeKind:
+      return true;
+   case LLVMArrayTypeKind:
+      return cgen_type_has_pointer(LLVMGetElementType(ty));
+   case LLVMStructTypeKind:
+      {
+         const unsigned nfields = LLVMCountStructElementTypes(ty);
+         LLVMTypeRef fields[nfields];
+         LLVMGetStructElementTypes(ty, fields);
+         for (unsigned i = 0; i < nfields; i++) {
+            if (cgen_type_has_pointer(fields[i]))
+               return true;
+         }
+         return false;
+      }
+   default:
+      return false;
+   }
+}
+
+static void cgen_process_state_info(tree_t t, LLVMTypeRef state_ty)
+{
+   // Export the size of the process state and whether it can be saved
+   // as raw bytes for checkpointing: the procedure context field is
+   // checked by the runtime and any other pointer makes it unsafe
+
+   char name[128];
+   snprintf(name, sizeof(name), "%s__state_size", istr(tree_ident(t)));
+   LLVMValueRef size = LLVMAddGlobal(module, LLVMInt32Type(), name);
+   LLVMSetInitializer(size, LLVMConstTrunc(LLVMSizeOf(state_ty),
+                                           LLVMInt32Type()));
+   LLVMSetGlobalConstant(size, true);
+
+   const unsigned nfields = LLVMCountStructElementTypes(state_ty);
+   LLVMTypeRef fields[nfields];
+   LLVMGetStructElementTypes(state_ty, fields);
+
+   bool flat = true;
+   for (unsigned i = 2; i < nfields; i++)
+      flat = flat && !cgen_type_has_pointer(fields[i]);
+
+   snprintf(name, sizeof(name), "%s__state_flat", istr(tree_ident(t)));
+   LLVMValueRef flat_var = LLVMAddGlobal(module, LLVMInt8Type(), name);
+   LLVMSetInitializer(flat_var, llvm_int8(flat));
+   LLVMSetGlobalConstant(flat_var, true);
+}
+
 static void cgen_process(tree_t t)
 {
    assert(tree_kind(t) == T_PROCESS);
@@ -3901,7 +3951,9 @@ static void cgen_process(tree_t t)
             "%s__state", istr(tree_ident(t)));
    LLVMTypeRef state_ty = cgen_process_state_type(t);
    ctx.state = LLVMAddGlobal(module, state_ty, state_name);
-   LLVMSetLinkage(ctx.state, LLVMInternalLinkage);
+
+   // The state is visible to the runtime for checkpointing
+   cgen_process_state_info(t, state_ty);
 
    // Process state is initially undefined: call process function
    // with non-zero argument to initialise
@@ -3993,6 +4045,12 @@ static LLVMValueRef cgen_resolution_func(type_t type)
    if (fn != NULL)
       return fn;    // Already generated wrapper
 
+   // The IEEE std_logic resolution function is built into the runtime
+   // which can resolve whole vectors with a table lookup
+   tree_t fdecl = tree_ref(type_resolution(type));
+   if (tree_ident(fdecl) == ident_new("IEEE.STD_LOGIC_1164.RESOLVED"))
+      return llvm_void_cast(llvm_fn("_std_logic_resolved"));
+
    LLVMTypeRef args[] = {
       LLVMPointerType(LLVMInt64Type(), 0),
       LLVMInt32Type()
@@ -4052,7 +4110,6 @@ static LLVMValueRef cgen_resolution_func(type_t type)
 
    // Wrap array in meta data and call actual resolution function
 
-   tree_t fdecl = tree_ref(type_resolution(type));
    type_t ftype = tree_type(fdecl);
 
    // TODO: check what standard says about left/right and direction
@@ -4116,7 +4173,7 @@ static void cgen_signal(tree_t t)
       LLVMSetInitializer(map_var, LLVMGetUndef(map_type));
    }
 
-   tree_add_attr_ptr(t, sig_nets_i, map_var);
+   side_tab_put(sig_nets, t, map_var);
 }
 
 static void cgen_func_vars(tree_t d, void *context)
@@ -4125,7 +4182,7 @@ static void cgen_func_vars(tree_t d, void *context)
 
    LLVMValueRef var = cgen_local_var(d, ctx);
 
-   tree_add_attr_ptr(d, local_var_i, var);
+   side_tab_put(local_vars, d, var);
 }
 
 static void cgen_func_constants(tree_t d, void *context)
@@ -4146,7 +4203,7 @@ static void cgen_func_constants(tree_t d, void *context)
                                  cgen_array_data_ptr(value_type, var));
       }
 
-      tree_add_attr_ptr(d, local_var_i, var);
+      side_tab_put(local_vars, d, var);
    }
 }
 
@@ -4186,13 +4243,13 @@ static void cgen_func_body(tree_t t)
       tree_t p = tree_port(t, i);
       switch (tree_class(p)) {
       case C_SIGNAL:
-         tree_add_attr_ptr(p, sig_nets_i, LLVMGetParam(fn, i));
+         side_tab_put(sig_nets, p, LLVMGetParam(fn, i));
          break;
 
       case C_VARIABLE:
       case C_DEFAULT:
       case C_CONSTANT:
-         tree_add_attr_ptr(p, local_var_i, LLVMGetParam(fn, i));
+         side_tab_put(local_vars, p, LLVMGetParam(fn, i));
          break;
 
       default:
@@ -4237,14 +4294,14 @@ static void cgen_proc_body(tree_t t)
       tree_t p = tree_port(t, i);
       switch (tree_class(p)) {
       case C_SIGNAL:
-         tree_add_attr_ptr(p, sig_nets_i, LLVMGetParam(fn, i));
+         side_tab_put(sig_nets, p, LLVMGetParam(fn, i));
          break;
 
       case C_VARIABLE:
       case C_DEFAULT:
       case C_CONSTANT:
       case C_FILE:
-         tree_add_attr_ptr(p, local_var_i, LLVMGetParam(fn, i));
+         side_tab_put(local_vars, p, LLVMGetParam(fn, i));
          break;
 
       default:
@@ -4372,14 +4429,14 @@ static void cgen_global_const(tree_t t)
          LLVMValueRef llvalue = cgen_expr(value, NULL);
          LLVMSetValueName(llvalue, istr(tree_ident(t)));
          LLVMSetLinkage(llvalue, LLVMExternalLinkage);
-         tree_add_attr_ptr(t, local_var_i, llvalue);
+         side_tab_put(local_vars, t, llvalue);
       }
       else {
          // The value will be generated by the reset function
          LLVMTypeRef lltype = llvm_type(tree_type(t));
          LLVMValueRef v = LLVMAddGlobal(module, lltype, istr(tree_ident(t)));
          LLVMSetInitializer(v, LLVMGetUndef(lltype));
-         tree_add_attr_ptr(t, global_const_i, v);
+         side_tab_put(global_consts, t, v);
       }
    }
 }
@@ -4468,7 +4525,7 @@ static void cgen_reset_function(tree_t t)
                        args, ARRAY_LEN(args), "");
       }
 
-      void *global = tree_attr_ptr(d, global_const_i);
+      void *global = side_tab_get(global_consts, d);
       if (global != NULL) {
          // A global constant whose value cannot be determined at
          // compile time
@@ -4571,7 +4628,7 @@ static void cgen_file_decl(tree_t t)
    LLVMValueRef f = LLVMAddGlobal(module, file_type, istr(tree_ident(t)));
    LLVMSetInitializer(f, LLVMConstNull(file_type));
 
-   tree_add_attr_ptr(t, local_var_i, f);
+   side_tab_put(local_vars, t, f);
 }
 
 static void cgen_shared_var(tree_t t)
@@ -4584,7 +4641,7 @@ static void cgen_shared_var(tree_t t)
    LLVMValueRef init = cgen_expr(tree_value(t), &ctx);
    LLVMSetInitializer(var, init);
 
-   tree_add_attr_ptr(t, local_var_i, var);
+   side_tab_put(local_vars, t, var);
 }
 
 static void cgen_coverage_state(tree_t t)
@@ -4965,6 +5022,16 @@ static void cgen_support_fns(void)
                                     _last_event_args,
                                     ARRAY_LEN(_last_event_args),
                                     false));
+
+   LLVMTypeRef _std_logic_resolved_args[] = {
+      LLVMPointerType(LLVMInt64Type(), 0),
+      LLVMInt32Type()
+   };
+   LLVMAddFunction(module, "_std_logic_resolved",
+                   LLVMFunctionType(LLVMInt64Type(),
+                                    _std_logic_resolved_args,
+                                    ARRAY_LEN(_std_logic_resolved_args),
+                                    false));
 }
 
 static void cgen_module_name(tree_t top)
@@ -4985,10 +5052,6 @@ static void cgen_module_name(tree_t top)
 
 void cgen(tree_t top)
 {
-   var_offset_i   = ident_new("var_offset");
-   local_var_i    = ident_new("local_var");
-   global_const_i = ident_new("global_const");
-   sig_nets_i     = ident_new("sig_nets");
    foreign_i      = ident_new("FOREIGN");
    never_waits_i  = ident_new("never_waits");
    stmt_tag_i     = ident_new("stmt_tag");
@@ -5000,6 +5063,12 @@ void cgen(tree_t top)
    module = LLVMModuleCreateWithName(istr(tree_ident(top)));
    builder = LLVMCreateBuilder();
 
+   // Values cached in these tables refer to the current module
+   var_offsets   = side_tab_new();
+   local_vars    = side_tab_new();
+   global_consts = side_tab_new();
+   sig_nets      = side_tab_new();
+
    cgen_module_name(top);
    cgen_support_fns();
 
@@ -5021,6 +5090,11 @@ void cgen(tree_t top)
       fatal("error writing LLVM bitcode");
    fclose(f);
 
+   side_tab_free(var_offsets);
+   side_tab_free(local_vars);
+   side_tab_free(global_consts);
+   side_tab_free(sig_nets);
+
    LLVMDisposeBuilder(builder);
    LLVMDisposeModule(module);
 }
@@ -17,9 +17,11 @@
 
 #include "util.h"
 #include "common.h"
+#include "lib.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <string.h>
 
 int64_t assume_int(tree_t t)
 {
@@ -174,3 +176,87 @@ tree_t get_real_lit(tree_t t, double r)
 
    return f;
 }
+
+static ident_t unit_qualify(ident_t name)
+{
+   // Prefix a unit name with the work library unless it already names
+   // a library, in which case WORK is an alias for the work library
+   const char *str = istr(name);
+   const char *dot = strchr(str, '.');
+   ident_t work_name = lib_name(lib_work());
+
+   if (dot == NULL)
+      return ident_prefix(work_name, name, '.');
+   else if ((dot - str == 4) && (strncasecmp(str, "WORK", 4) == 0))
+      return ident_prefix(work_name, ident_new(dot + 1), '.');
+   else
+      return name;
+}
+
+static bool unit_analysed(tree_t unit)
+{
+   // The semantic checker qualifies the names of library units
+   return strchr(istr(tree_ident(unit)), '.') != NULL;
+}
+
+ident_t unit_qual_name(tree_t unit)
+{
+   if (unit_analysed(unit))
+      return tree_ident(unit);
+
+   switch (tree_kind(unit)) {
+   case T_ARCH:
+      return ident_prefix(unit_qualify(tree_ident2(unit)),
+                          tree_ident(unit), '-');
+   case T_PACK_BODY:
+      return ident_prefix(unit_qualify(tree_ident(unit)),
+                          ident_new("body"), '-');
+   default:
+      return unit_qualify(tree_ident(unit));
+   }
+}
+
+struct unit_deps_ctx {
+   unit_dep_fn_t  fn;
+   void          *context;
+};
+
+static void unit_deps_instance(tree_t t, void *context)
+{
+   struct unit_deps_ctx *ctx = context;
+
+   if (tree_class(t) == C_ENTITY) {
+      ident_t name = unit_qualify(ident_until(tree_ident2(t), '-'));
+      (*ctx->fn)(name, ctx->context);
+   }
+}
+
+void unit_deps(tree_t unit, unit_dep_fn_t fn, void *context)
+{
+   // Call fn with the qualified name of each library unit which must be
+   // analysed before this one
+
+   const int ncontexts = tree_contexts(unit);
+   for (int i = 0; i < ncontexts; i++) {
+      ident_t name = tree_ident(tree_context(unit, i));
+      if (strchr(istr(name), '.') != NULL)
+         (*fn)(unit_qualify(name), context);
+   }
+
+   switch (tree_kind(unit)) {
+   case T_ARCH:
+      (*fn)(unit_qualify(tree_ident2(unit)), context);
+      break;
+   case T_PACK_BODY:
+      if (unit_analysed(unit))
+         (*fn)(ident_runtil(tree_ident(unit), '-'), context);
+      else
+         (*fn)(unit_qualify(tree_ident(unit)), context);
+      break;
+   default:
+      break;
+   }
+
+   struct unit_deps_ctx ctx = { fn, context };
+   tree_visit_only(unit, unit_deps_instance, &ctx, T_INSTANCE);
+}
@@ -33,6 +33,11 @@ bool folded_bool(tree_t t, bool *b);
 tree_t get_int_lit(tree_t t, int64_t i);
 tree_t get_real_lit(tree_t t, double r);
 
+// Names library units will be stored under after analysis
+typedef void (*unit_dep_fn_t)(ident_t name, void *context);
+ident_t unit_qual_name(tree_t unit);
+void unit_deps(tree_t unit, unit_dep_fn_t fn, void *context);
+
 //
 // Utility typedefs
 //
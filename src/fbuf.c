@@ -28,26 +28,40 @@
 #include <unistd.h>
 #include <zlib.h>
 
-#define WBUF_SIZE     8192
+#define WBUF_SIZE     65536
 #define RBUF_SIZE     8192
 #define DEFLATE_LEVEL 4
+#define LZ_HASH_BITS  12
+#define LZ_MAX_OFFSET 65535
+#define ZLIB_MAGIC    0x78
+#define VARINT_MAX    10
+
+// Every file starts with a byte giving the codec used for the rest
+// of the data. Files written before this was added begin directly
+// with a zlib stream which is recognised by its header byte.
 
 struct fbuf {
-   fbuf_mode_t  mode;
-   char        *fname;
-   FILE        *file;
-   uint8_t     *wbuf;
-   size_t       wpend;
-   uint8_t     *rbuf;
-   size_t       rptr;
-   uint8_t     *rmap;
-   size_t       maplen;
-   z_stream     strm;
-   fbuf_t      *next;
-   fbuf_t      *prev;
+   fbuf_mode_t   mode;
+   fbuf_codec_t  codec;
+   char         *fname;
+   FILE         *file;
+   uint8_t      *wbuf;
+   size_t        wpend;
+   size_t        walloc;
+   uint8_t      *rbuf;
+   size_t        rptr;
+   size_t        rlen;
+   uint8_t      *rmap;
+   size_t        maplen;
+   size_t        mapoff;
+   bool          unmap;
+   z_stream      strm;
+   fbuf_t       *next;
+   fbuf_t       *prev;
 };
 
-static fbuf_t *open_list = NULL;
+static fbuf_t       *open_list = NULL;
+static fbuf_codec_t  default_codec = FBUF_CODEC_ZLIB;
 
 void fbuf_cleanup(void)
 {
@@ -59,6 +73,78 @@ void fbuf_cleanup(void)
    }
 }
 
+void fbuf_set_codec(fbuf_codec_t codec)
+{
+   default_codec = codec;
+}
+
+static void fbuf_open_out(fbuf_t *f)
+{
+   fputc(f->codec, f->file);
+
+   switch (f->codec) {
+   case FBUF_CODEC_ZLIB:
+      f->strm.zalloc = Z_NULL;
+      f->strm.zfree  = Z_NULL;
+      f->strm.opaque = Z_NULL;
+      if (deflateInit(&(f->strm), DEFLATE_LEVEL) != Z_OK)
+         fatal("deflateInit failed");
+      break;
+
+   case FBUF_CODEC_NONE:
+   case FBUF_CODEC_LZ:
+      break;
+   }
+}
+
+static void fbuf_open_in(fbuf_t *f)
+{
+   if (f->maplen == 0)
+      fatal("%s is empty", f->fname);
+
+   if (f->rmap[0] == ZLIB_MAGIC) {
+      f->codec  = FBUF_CODEC_ZLIB;
+      f->mapoff = 0;
+   }
+   else {
+      f->codec  = f->rmap[0];
+      f->mapoff = 1;
+   }
+
+   switch (f->codec) {
+   case FBUF_CODEC_NONE:
+      // Values are read straight from the mapped file
+      f->rbuf = f->rmap + f->mapoff;
+      f->rlen = f->maplen - f->mapoff;
+      f->rptr = 0;
+      break;
+
+   case FBUF_CODEC_ZLIB:
+      f->rbuf = xmalloc(RBUF_SIZE);
+      f->rlen = 0;
+      f->rptr = 0;
+
+      f->strm.zalloc   = Z_NULL;
+      f->strm.zfree    = Z_NULL;
+      f->strm.opaque   = Z_NULL;
+      f->strm.avail_in = f->maplen - f->mapoff;
+      f->strm.next_in  = f->rmap + f->mapoff;
+      if (inflateInit(&(f->strm)) != Z_OK)
+         fatal("inflateInit failed");
+      break;
+
+   case FBUF_CODEC_LZ:
+      // Room for one whole block after any unread bytes
+      f->rbuf = xmalloc(WBUF_SIZE + RBUF_SIZE);
+      f->rlen = 0;
+      f->rptr = 0;
+      break;
+
+   default:
+      fatal("%s uses unknown codec %d", f->fname, f->codec);
+   }
+}
+
 fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode)
 {
    fbuf_t *f = NULL;
@@ -73,16 +159,15 @@ fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode)
          f = xmalloc(sizeof(struct fbuf));
 
          f->file  = h;
+         f->fname = strdup(file);
+         f->codec = default_codec;
          f->rmap  = NULL;
          f->rbuf  = NULL;
-         f->wbuf  = xmalloc(WBUF_SIZE);
-         f->wpend = 0;
-
-         f->strm.zalloc = Z_NULL;
-         f->strm.zfree  = Z_NULL;
-         f->strm.opaque = Z_NULL;
-         if (deflateInit(&(f->strm), DEFLATE_LEVEL) != Z_OK)
-            fatal("deflateInit failed");
+         f->wbuf   = xmalloc(WBUF_SIZE);
+         f->wpend  = 0;
+         f->walloc = 0;
+
+         fbuf_open_out(f);
       }
       break;
 
@@ -96,33 +181,30 @@ fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode)
          if (fstat(fd, &buf) != 0)
             fatal_errno("fstat");
 
-         void *rmap = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-         if (rmap == MAP_FAILED)
-            fatal_errno("mmap");
+         void *rmap = NULL;
+         if (buf.st_size > 0) {
+            rmap = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (rmap == MAP_FAILED)
+               fatal_errno("mmap");
+         }
 
          close(fd);
 
          f = xmalloc(sizeof(struct fbuf));
 
          f->file   = NULL;
+         f->fname  = strdup(file);
          f->rmap   = rmap;
-         f->rbuf   = xmalloc(RBUF_SIZE);
-         f->rptr   = RBUF_SIZE;
          f->maplen = buf.st_size;
+         f->unmap  = true;
          f->wbuf   = NULL;
+         f->walloc = 0;
 
-         f->strm.zalloc   = Z_NULL;
-         f->strm.zfree    = Z_NULL;
-         f->strm.opaque   = Z_NULL;
-         f->strm.avail_in = buf.st_size;
-         f->strm.next_in  = rmap;
-         if (inflateInit(&(f->strm)) != Z_OK)
-            fatal("inflateInit failed");
+         fbuf_open_in(f);
       }
       break;
    }
 
-   f->fname = strdup(file);
    f->mode  = mode;
    f->next  = open_list;
    f->prev  = NULL;
@@ -133,27 +215,282 @@ fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode)
    return (open_list = f);
 }
 
+fbuf_t *fbuf_open_mem(const void *data, size_t len, const char *name)
+{
+   fbuf_t *f = xmalloc(sizeof(struct fbuf));
+
+   f->file   = NULL;
+   f->fname  = strdup(name);
+   f->rmap   = (uint8_t *)data;
+   f->maplen = len;
+   f->unmap  = false;
+   f->wbuf   = NULL;
+   f->walloc = 0;
+
+   fbuf_open_in(f);
+
+   f->mode  = FBUF_IN;
+   f->next  = open_list;
+   f->prev  = NULL;
+
+   if (open_list != NULL)
+      open_list->prev = f;
+
+   return (open_list = f);
+}
+
+fbuf_t *fbuf_open_buffer(void)
+{
+   // Uncompressed output which is kept in memory until closed
+   fbuf_t *f = xmalloc(sizeof(struct fbuf));
+
+   f->mode   = FBUF_OUT;
+   f->file   = NULL;
+   f->fname  = NULL;
+   f->codec  = FBUF_CODEC_NONE;
+   f->rmap   = NULL;
+   f->rbuf   = NULL;
+   f->walloc = 256;
+   f->wbuf   = xmalloc(f->walloc);
+   f->wpend  = 0;
+
+   // Same layout as a file so it can be read back with fbuf_open_mem
+   f->wbuf[f->wpend++] = FBUF_CODEC_NONE;
+
+   return f;
+}
+
+void *fbuf_close_buffer(fbuf_t *f, size_t *len)
+{
+   assert(f->walloc > 0);
+
+   void *data = f->wbuf;
+   *len = f->wpend;
+
+   free(f);
+   return data;
+}
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+   // Block headers are written little-endian regardless of the host
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+      | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t *lz_write_len(uint8_t *op, size_t len)
+{
+   for (; len >= 255; len -= 255)
+      *op++ = 255;
+   *op++ = len;
+   return op;
+}
+
+static uint8_t *lz_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+                            size_t offset, size_t mlen)
+{
+   // Each sequence is a token holding the literal and match lengths
+   // in its high and low nibbles followed by any extra length bytes,
+   // the literals, and a 16-bit match offset
+   uint8_t *token = op++;
+
+   *token = MIN(nlit, 15) << 4;
+   if (nlit >= 15)
+      op = lz_write_len(op, nlit - 15);
+
+   memcpy(op, lit, nlit);
+   op += nlit;
+
+   if (mlen > 0) {
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+
+      *token |= MIN(mlen - 4, 15);
+      if (mlen - 4 >= 15)
+         op = lz_write_len(op, mlen - 4 - 15);
+   }
+
+   return op;
+}
+
+static size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+   uint32_t table[1 << LZ_HASH_BITS];
+   memset(table, '\0', sizeof(table));
+
+   const uint8_t *ip = src;
+   const uint8_t *anchor = src;
+   const uint8_t *end = src + len;
+   uint8_t *op = dst;
+
+   while (ip + 4 <= end) {
+      const uint32_t h =
+         (lz_read32(ip) * 2654435761u) >> (32 - LZ_HASH_BITS);
+      const uint8_t *ref = src + table[h];
+      table[h] = ip - src;
+
+      if ((ref >= ip) || (ip - ref > LZ_MAX_OFFSET)
+          || (lz_read32(ref) != lz_read32(ip))) {
+         ip++;
+         continue;
+      }
+
+      size_t mlen = 4;
+      while ((ip + mlen < end) && (ref[mlen] == ip[mlen]))
+         mlen++;
+
+      op = lz_sequence(op, anchor, ip - anchor, ip - ref, mlen);
+
+      ip += mlen;
+      anchor = ip;
+   }
+
+   // The final sequence has only literals
+   op = lz_sequence(op, anchor, end - anchor, 0, 0);
+
+   return op - dst;
+}
+
+static void lz_decompress(fbuf_t *f, const uint8_t *src, size_t len,
+                          uint8_t *dst, size_t rawlen)
+{
+   const uint8_t *ip = src;
+   const uint8_t *iend = src + len;
+   uint8_t *op = dst;
+   uint8_t *oend = dst + rawlen;
+
+   while (ip < iend) {
+      const uint8_t token = *ip++;
+
+      size_t nlit = token >> 4;
+      if (nlit == 15) {
+         uint8_t b;
+         do {
+            if (ip == iend)
+               goto corrupt;
+            nlit += (b = *ip++);
+         } while (b == 255);
+      }
+
+      if ((nlit > (size_t)(iend - ip)) || (nlit > (size_t)(oend - op)))
+         goto corrupt;
+
+      memcpy(op, ip, nlit);
+      op += nlit;
+      ip += nlit;
+
+      if (ip == iend)
+         break;
+      else if (iend - ip < 2)
+         goto corrupt;
+
+      const size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+
+      size_t mlen = token & 0xf;
+      if (mlen == 15) {
+         uint8_t b;
+         do {
+            if (ip == iend)
+               goto corrupt;
+            mlen += (b = *ip++);
+         } while (b == 255);
+      }
+      mlen += 4;
+
+      if ((offset == 0) || (offset > (size_t)(op - dst))
+          || (mlen > (size_t)(oend - op)))
+         goto corrupt;
+
+      // The match may overlap the bytes being written
+      const uint8_t *ref = op - offset;
+      if (offset >= mlen)
+         memcpy(op, ref, mlen);
+      else {
+         for (size_t i = 0; i < mlen; i++)
+            op[i] = ref[i];
+      }
+      op += mlen;
+   }
+
+   if (op == oend)
+      return;
+
+ corrupt:
+   fatal("%s is corrupt", f->fname);
+}
+
+static void fbuf_write_block(fbuf_t *f, const uint8_t *raw, size_t len)
+{
+   uint8_t *out = xmalloc(len + (len / 255) + 16);
+   size_t clen = lz_compress(raw, len, out);
+
+   // Incompressible blocks are stored as they are
+   const uint8_t *data = out;
+   if (clen >= len) {
+      data = raw;
+      clen = len;
+   }
+
+   const uint8_t header[8] = {
+      len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff, len >> 24,
+      clen & 0xff, (clen >> 8) & 0xff, (clen >> 16) & 0xff, clen >> 24
+   };
+
+   if ((fwrite(header, sizeof(header), 1, f->file) != 1)
+       || (fwrite(data, clen, 1, f->file) != 1))
+      fatal("fwrite failed");
+
+   free(out);
+}
+
 static void fbuf_maybe_flush(fbuf_t *f, size_t more, bool finish)
 {
    assert(more <= WBUF_SIZE);
-   if (f->wpend + more > WBUF_SIZE) {
-      const int zflush = finish ? Z_FINISH : Z_NO_FLUSH;
-      f->strm.avail_in = f->wpend;
-      f->strm.next_in  = f->wbuf;
-
-      do {
-         uint8_t out[WBUF_SIZE];
-         f->strm.avail_out = sizeof(out);
-         f->strm.next_out  = out;
 
-         const int ret = deflate(&(f->strm), zflush);
-         assert(ret != Z_STREAM_ERROR);
+   if (f->walloc > 0) {
+      // Memory buffers grow instead
+      if (f->wpend + more > f->walloc) {
+         f->walloc = MAX(f->walloc * 2, f->wpend + more);
+         f->wbuf = xrealloc(f->wbuf, f->walloc);
+      }
+      return;
+   }
 
-         const int have = sizeof(out) - f->strm.avail_out;
-         if ((have > 0) && (fwrite(out, have, 1, f->file) != 1))
+   if (finish || (f->wpend + more > WBUF_SIZE)) {
+      switch (f->codec) {
+      case FBUF_CODEC_NONE:
+         if ((f->wpend > 0) && (fwrite(f->wbuf, f->wpend, 1, f->file) != 1))
             fatal("fwrite failed");
-
-      } while (f->strm.avail_out == 0);
+         break;
+
+      case FBUF_CODEC_ZLIB:
+         {
+            const int zflush = finish ? Z_FINISH : Z_NO_FLUSH;
+            f->strm.avail_in = f->wpend;
+            f->strm.next_in  = f->wbuf;
+
+            do {
+               uint8_t out[RBUF_SIZE];
+               f->strm.avail_out = sizeof(out);
+               f->strm.next_out  = out;
+
+               const int ret = deflate(&(f->strm), zflush);
+               assert(ret != Z_STREAM_ERROR);
+
+               const int have = sizeof(out) - f->strm.avail_out;
+               if ((have > 0) && (fwrite(out, have, 1, f->file) != 1))
+                  fatal("fwrite failed");
+
+            } while (f->strm.avail_out == 0);
+         }
+         break;
+
+      case FBUF_CODEC_LZ:
+         if (f->wpend > 0)
+            fbuf_write_block(f, f->wbuf, f->wpend);
+         break;
+      }
 
       f->wpend = 0;
    }
@@ -162,38 +499,86 @@ static void fbuf_maybe_flush(fbuf_t *f, size_t more, bool finish)
 static void fbuf_maybe_read(fbuf_t *f, size_t more)
 {
    assert(more <= RBUF_SIZE);
-   if (f->rptr + more > RBUF_SIZE) {
-      const size_t overlap = RBUF_SIZE - f->rptr;
-      memcpy(f->rbuf, f->rbuf + f->rptr, overlap);
-
-      f->strm.avail_out = RBUF_SIZE - overlap;
-      f->strm.next_out  = f->rbuf + overlap;
-
-      do {
-         const int ret = inflate(&(f->strm), Z_NO_FLUSH);
-         if (ret == Z_STREAM_END)
-            break;
-         else if (ret == Z_DATA_ERROR)
-            fatal("file is not compressed");
-         else if (ret != Z_OK)
-            fatal("inflate failed %d", ret);
-      } while (f->strm.avail_out != 0);
+   if (f->rptr + more <= f->rlen)
+      return;
 
-      f->rptr = 0;
+   // Keep any bytes not yet consumed at the start of the buffer
+   const size_t overlap = f->rlen - f->rptr;
+
+   switch (f->codec) {
+   case FBUF_CODEC_NONE:
+      fatal("unexpected end of file %s", f->fname);
+
+   case FBUF_CODEC_ZLIB:
+      {
+         memmove(f->rbuf, f->rbuf + f->rptr, overlap);
+
+         f->strm.avail_out = RBUF_SIZE - overlap;
+         f->strm.next_out  = f->rbuf + overlap;
+
+         do {
+            const int ret = inflate(&(f->strm), Z_NO_FLUSH);
+            if (ret == Z_STREAM_END)
+               break;
+            else if (ret == Z_DATA_ERROR)
+               fatal("file is not compressed");
+            else if (ret != Z_OK)
+               fatal("inflate failed %d", ret);
+         } while (f->strm.avail_out != 0);
+
+         f->rlen = RBUF_SIZE - f->strm.avail_out;
+      }
+      break;
+
+   case FBUF_CODEC_LZ:
+      {
+         memmove(f->rbuf, f->rbuf + f->rptr, overlap);
+         f->rlen = overlap;
+
+         if (f->maplen - f->mapoff < 8)
+            fatal("unexpected end of file %s", f->fname);
+
+         const uint8_t *hdr = f->rmap + f->mapoff;
+         const size_t len  = lz_read32(hdr);
+         const size_t clen = lz_read32(hdr + 4);
+         f->mapoff += 8;
+
+         if ((len > WBUF_SIZE) || (clen > f->maplen - f->mapoff))
+            fatal("%s is corrupt", f->fname);
+
+         const uint8_t *data = f->rmap + f->mapoff;
+         if (clen == len)
+            memcpy(f->rbuf + overlap, data, len);
+         else
+            lz_decompress(f, data, clen, f->rbuf + overlap, len);
+
+         f->mapoff += clen;
+         f->rlen   += len;
+      }
+      break;
    }
+
+   f->rptr = 0;
+
+   if (more > f->rlen)
+      fatal("unexpected end of file %s", f->fname);
 }
 
 void fbuf_close(fbuf_t *f)
 {
-   if (f->rmap != NULL) {
-      munmap((void *)f->rmap, f->maplen);
-      inflateEnd(&(f->strm));
-      free(f->rbuf);
+   if (f->mode == FBUF_IN) {
+      if (f->codec == FBUF_CODEC_ZLIB)
+         inflateEnd(&(f->strm));
+      if (f->codec != FBUF_CODEC_NONE)
+         free(f->rbuf);
+      if ((f->rmap != NULL) && f->unmap)
+         munmap((void *)f->rmap, f->maplen);
    }
 
    if (f->wbuf != NULL) {
       fbuf_maybe_flush(f, WBUF_SIZE, true);
-      deflateEnd(&(f->strm));
+      if (f->codec == FBUF_CODEC_ZLIB)
+         deflateEnd(&(f->strm));
       free(f->wbuf);
    }
 
@@ -253,9 +638,32 @@ void write_u8(uint8_t u, fbuf_t *f)
 
 void write_raw(const void *buf, size_t len, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, len, false);
-   memcpy(f->wbuf + f->wpend, buf, len);
-   f->wpend += len;
+   const uint8_t *p = buf;
+   while (len > 0) {
+      const size_t chunk = MIN(len, WBUF_SIZE);
+      fbuf_maybe_flush(f, chunk, false);
+      memcpy(f->wbuf + f->wpend, p, chunk);
+      f->wpend += chunk;
+      p   += chunk;
+      len -= chunk;
+   }
+}
+
+void write_uint(uint64_t u, fbuf_t *f)
+{
+   // Seven bits per byte with the top bit set on all but the last
+   fbuf_maybe_flush(f, VARINT_MAX, false);
+   while (u >= 0x80) {
+      *(f->wbuf + f->wpend++) = (u & 0x7f) | 0x80;
+      u >>= 7;
+   }
+   *(f->wbuf + f->wpend++) = u;
+}
+
+void write_int(int64_t i, fbuf_t *f)
+{
+   // Zigzag encoding keeps small negative numbers short
+   write_uint(((uint64_t)i << 1) ^ (uint64_t)(i >> 63), f);
 }
 
 uint32_t read_u32(fbuf_t *f)
@@ -304,7 +712,47 @@ uint64_t read_u64(fbuf_t *f)
 
 void read_raw(void *buf, size_t len, fbuf_t *f)
 {
-   fbuf_maybe_read(f, len);
-   memcpy(buf, f->rbuf + f->rptr, len);
-   f->rptr += len;
+   uint8_t *p = buf;
+   while (len > 0) {
+      const size_t chunk = MIN(len, RBUF_SIZE);
+      fbuf_maybe_read(f, chunk);
+      memcpy(p, f->rbuf + f->rptr, chunk);
+      f->rptr += chunk;
+      p   += chunk;
+      len -= chunk;
+   }
+}
+
+uint64_t read_uint(fbuf_t *f)
+{
+   uint64_t val = 0;
+
+   if (f->rptr + VARINT_MAX <= f->rlen) {
+      // Decode directly from the buffer when a whole value must fit
+      const uint8_t *p = f->rbuf + f->rptr;
+      for (int shift = 0; shift < 64; shift += 7) {
+         const uint8_t b = *p++;
+         val |= (uint64_t)(b & 0x7f) << shift;
+         if (!(b & 0x80)) {
+            f->rptr = p - f->rbuf;
+            return val;
+         }
+      }
+   }
+   else {
+      for (int shift = 0; shift < 64; shift += 7) {
+         const uint8_t b = read_u8(f);
+         val |= (uint64_t)(b & 0x7f) << shift;
+         if (!(b & 0x80))
+            return val;
+      }
+   }
+
+   fatal("%s is corrupt", f->fname);
+}
+
+int64_t read_int(fbuf_t *f)
+{
+   const uint64_t u = read_uint(f);
+   return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
 }
@@ -31,20 +31,35 @@ typedef enum {
    FBUF_OUT,
 } fbuf_mode_t;
 
+// Codec used for files opened for writing, recorded in the first byte
+typedef enum {
+   FBUF_CODEC_NONE = 1,   // Uncompressed and read directly from the map
+   FBUF_CODEC_ZLIB = 2,   // Smallest files
+   FBUF_CODEC_LZ   = 3    // Fast LZ77 block compression
+} fbuf_codec_t;
+
 fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode);
+fbuf_t *fbuf_open_mem(const void *data, size_t len, const char *name);
+fbuf_t *fbuf_open_buffer(void);
+void *fbuf_close_buffer(fbuf_t *f, size_t *len);
 void fbuf_close(fbuf_t *f);
 void fbuf_cleanup(void);
+void fbuf_set_codec(fbuf_codec_t codec);
 
 void write_u32(uint32_t u, fbuf_t *f);
 void write_u16(uint16_t s, fbuf_t *f);
 void write_u64(uint64_t i, fbuf_t *f);
 void write_u8(uint8_t u, fbuf_t *f);
 void write_raw(const void *buf, size_t len, fbuf_t *f);
+void write_uint(uint64_t u, fbuf_t *f);
+void write_int(int64_t i, fbuf_t *f);
 
 uint32_t read_u32(fbuf_t *f);
 uint16_t read_u16(fbuf_t *f);
 uint64_t read_u64(fbuf_t *f);
 uint8_t read_u8(fbuf_t *f);
 void read_raw(void *buf, size_t len, fbuf_t *f);
+uint64_t read_uint(fbuf_t *f);
+int64_t read_int(fbuf_t *f);
 
 #endif  // _FBUF_H
@@ -369,11 +369,11 @@ static void group_write_netdb(tree_t top, group_nets_ctx_t *ctx)
       fatal("failed to create net database file %s", name);
 
    for (group_t *it = ctx->groups; it != NULL; it = it->next) {
-      write_u32(it->gid, f);
-      write_u32(it->first, f);
-      write_u32(it->length, f);
+      write_uint(it->gid, f);
+      write_uint(it->first, f);
+      write_uint(it->length, f);
    }
-   write_u32(GROUPID_INVALID, f);
+   write_uint(GROUPID_INVALID, f);
 
    fbuf_close(f);
 }
@@ -25,116 +25,124 @@
 #include <string.h>
 #include <stdint.h>
 
-struct clist {
-   char         value;
-   struct trie  *down;
-   struct clist *left;
-   struct clist *right;
-};
-
-struct trie {
-   char         value;
-   uint8_t      write_gen;
-   uint16_t     write_index;
-   uint16_t     depth;
-   struct trie  *up;
-   struct clist *children;
+#define INITIAL_SIZE  1024
+#define ARENA_SIZE    (64 * 1024)
+
+// Identifiers are interned in an open addressing hash table and the
+// characters are stored inline so converting to a string is free
+
+struct ident {
+   uint32_t hash;
+   uint32_t length;
+   uint32_t write_index;
+   uint8_t  write_gen;
+   char     bytes[];
 };
 
 struct ident_rd_ctx {
    fbuf_t  *file;
+   bool     segment;
    size_t   cache_sz;
    size_t   cache_alloc;
    ident_t *cache;
+   size_t   buf_alloc;
+   char    *buf;
 };
 
 struct ident_wr_ctx {
    fbuf_t   *file;
-   uint16_t  next_index;
+   bool      segment;
+   uint32_t  next_index;
    uint8_t   generation;
 };
 
-static struct trie root = {
-   .value       = '\0',
-   .write_gen   = 0,
-   .write_index = 0,
-   .depth       = 1,
-   .up          = NULL,
-   .children    = NULL
-};
+static ident_t *table = NULL;
+static size_t   table_size = 0;
+static size_t   table_count = 0;
+static char    *arena = NULL;
+static size_t   arena_left = 0;
 
-static struct trie *alloc_node(char ch, struct trie *prev)
+static uint32_t ident_hash(const char *str, size_t len)
 {
-   struct trie *t = xmalloc(sizeof(struct trie));
-   t->value     = ch;
-   t->depth     = prev->depth + 1;
-   t->up        = prev;
-   t->children  = NULL;
-   t->write_gen = 0;
-
-   struct clist *c = xmalloc(sizeof(struct clist));
-   c->value    = ch;
-   c->down     = t;
-   c->left     = NULL;
-   c->right    = NULL;
-
-   struct clist *it, **where;
-   for (it = prev->children, where = &(prev->children);
-        it != NULL;
-        where = (ch < it->value ? &(it->left) : &(it->right)),
-           it = *where)
-      ;
-
-   *where = c;
-
-   return t;
+   // FNV-1a
+   uint32_t hash = 2166136261u;
+   for (size_t i = 0; i < len; i++) {
+      hash ^= (uint8_t)str[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
 }
 
-static void build_trie(const char *str, struct trie *prev, struct trie **end)
+static ident_t ident_alloc(const char *str, size_t len, uint32_t hash)
 {
-   assert(*str != '\0');
-   assert(prev != NULL);
+   const size_t size = (sizeof(struct ident) + len + 8) & ~7;
 
-   struct trie *t = alloc_node(*str, prev);
+   struct ident *i;
+   if (size > ARENA_SIZE / 4)
+      i = xmalloc(size);
+   else {
+      if (size > arena_left) {
+         arena      = xmalloc(ARENA_SIZE);
+         arena_left = ARENA_SIZE;
+      }
 
-   if (*(++str) == '\0')
-      *end = t;
-   else
-      build_trie(str, t, end);
+      i = (struct ident *)arena;
+      arena      += size;
+      arena_left -= size;
+   }
+
+   i->hash        = hash;
+   i->length      = len;
+   i->write_index = 0;
+   i->write_gen   = 0;
+   memcpy(i->bytes, str, len);
+   i->bytes[len] = '\0';
+
+   return i;
 }
 
-static struct clist *search_node(struct trie *t, char ch)
+static void ident_grow(void)
 {
-   struct clist *it;
-   for (it = t->children;
-        (it != NULL) && (it->value != ch);
-        it = (ch < it->value ? it->left : it->right))
-      ;
+   const size_t new_size = (table_size == 0) ? INITIAL_SIZE : table_size * 2;
+   ident_t *new_table = xmalloc(new_size * sizeof(ident_t));
+   memset(new_table, '\0', new_size * sizeof(ident_t));
+
+   for (size_t i = 0; i < table_size; i++) {
+      if (table[i] == NULL)
+         continue;
+
+      size_t slot = table[i]->hash & (new_size - 1);
+      while (new_table[slot] != NULL)
+         slot = (slot + 1) & (new_size - 1);
+      new_table[slot] = table[i];
+   }
 
-   return it;
+   free(table);
+   table      = new_table;
+   table_size = new_size;
 }
 
-static bool search_trie(const char **str, struct trie *t, struct trie **end)
+static ident_t ident_lookup(const char *str, size_t len, bool create)
 {
-   assert(**str != '\0');
-   assert(t != NULL);
+   if (table_count * 2 >= table_size)
+      ident_grow();
 
-   struct clist *it = search_node(t, **str);
+   const uint32_t hash = ident_hash(str, len);
 
-   if (it == NULL) {
-      *end = t;
-      return false;
+   size_t slot = hash & (table_size - 1);
+   for (; table[slot] != NULL; slot = (slot + 1) & (table_size - 1)) {
+      ident_t i = table[slot];
+      if ((i->hash == hash) && (i->length == len)
+          && (memcmp(i->bytes, str, len) == 0))
+         return i;
    }
-   else {
-      (*str)++;
 
-      if (**str == '\0') {
-         *end = it->down;
-         return true;
-      }
-      else
-         return search_trie(str, it->down, end);
-   }
+   if (!create)
+      return NULL;
+
+   table_count++;
+   return (table[slot] = ident_alloc(str, len, hash));
 }
 
 ident_t ident_new(const char *str)
@@ -142,27 +150,14 @@ ident_t ident_new(const char *str)
    assert(str != NULL);
    assert(*str != '\0');
 
-   struct trie *result;
-   if (!search_trie(&str, &root, &result))
-      build_trie(str, result, &result);
-
-   return result;
+   return ident_lookup(str, strlen(str), true);
 }
 
 const char *istr(ident_t ident)
 {
    assert(ident != NULL);
 
-   char *p = get_fmt_buf(ident->depth) + ident->depth - 1;
-   *p = '\0';
-
-   struct trie *it;
-   for (it = ident; it->value != '\0'; it = it->up) {
-      assert(it != NULL);
-      *(--p) = it->value;
-   }
-
-   return p;
+   return ident->bytes;
 }
 
 ident_wr_ctx_t ident_write_begin(fbuf_t *f)
@@ -172,6 +167,7 @@ ident_wr_ctx_t ident_write_begin(fbuf_t *f)
 
    struct ident_wr_ctx *ctx = xmalloc(sizeof(struct ident_wr_ctx));
    ctx->file       = f;
+   ctx->segment    = false;
    ctx->generation = ident_wr_gen++;
    ctx->next_index = 0;
 
@@ -185,30 +181,43 @@ void ident_write_end(ident_wr_ctx_t ctx)
 
 void ident_write(ident_t ident, ident_wr_ctx_t ctx)
 {
+   // Identifiers already written are referenced by index plus one
+   // and zero introduces a new string
    if (ident == NULL) {
-      write_u16(UINT16_MAX, ctx->file);
+      write_uint(0, ctx->file);
       write_u8(0, ctx->file);
    }
    else if (ident->write_gen == ctx->generation)
-      write_u16(ident->write_index, ctx->file);
+      write_uint(ident->write_index + 1, ctx->file);
    else {
-      write_u16(UINT16_MAX, ctx->file);
-      write_raw(istr(ident), ident->depth, ctx->file);
-
-      ident->write_gen   = ctx->generation;
-      ident->write_index = ctx->next_index++;
-
-      assert(ctx->next_index != UINT16_MAX);
+      write_uint(0, ctx->file);
+      write_raw(ident->bytes, ident->length + 1, ctx->file);
+
+      // Strings inside a segment are not given an index as the
+      // segment may be read after identifiers that follow it
+      if (!ctx->segment) {
+         ident->write_gen   = ctx->generation;
+         ident->write_index = ctx->next_index++;
+      }
    }
 }
 
+void ident_write_redirect(ident_wr_ctx_t ctx, fbuf_t *f, bool segment)
+{
+   ctx->file    = f;
+   ctx->segment = segment;
+}
+
 ident_rd_ctx_t ident_read_begin(fbuf_t *f)
 {
    struct ident_rd_ctx *ctx = xmalloc(sizeof(struct ident_rd_ctx));
    ctx->file        = f;
+   ctx->segment     = false;
    ctx->cache_alloc = 256;
    ctx->cache_sz    = 0;
    ctx->cache       = xmalloc(ctx->cache_alloc * sizeof(ident_t));
+   ctx->buf_alloc   = 128;
+   ctx->buf         = xmalloc(ctx->buf_alloc);
 
    return ctx;
 }
@@ -216,59 +225,65 @@ ident_rd_ctx_t ident_read_begin(fbuf_t *f)
 void ident_read_end(ident_rd_ctx_t ctx)
 {
    free(ctx->cache);
+   free(ctx->buf);
    free(ctx);
 }
 
 ident_t ident_read(ident_rd_ctx_t ctx)
 {
-   uint16_t index = read_u16(ctx->file);
-   if (index == UINT16_MAX) {
+   const uint64_t index = read_uint(ctx->file);
+   if (index == 0) {
       if (ctx->cache_sz == ctx->cache_alloc) {
          ctx->cache_alloc *= 2;
          ctx->cache = xrealloc(ctx->cache, ctx->cache_alloc * sizeof(ident_t));
       }
 
-      struct trie *p = &root;
+      size_t len = 0;
       char ch;
       while ((ch = read_u8(ctx->file)) != '\0') {
-         struct clist *it = search_node(p, ch);
-         if (it != NULL)
-            p = it->down;
-         else
-            p = alloc_node(ch, p);
+         if (len == ctx->buf_alloc) {
+            ctx->buf_alloc *= 2;
+            ctx->buf = xrealloc(ctx->buf, ctx->buf_alloc);
+         }
+         ctx->buf[len++] = ch;
       }
 
-      if (p == &root)
+      if (len == 0)
          return NULL;
       else {
-         ctx->cache[ctx->cache_sz++] = p;
-         return p;
+         ident_t i = ident_lookup(ctx->buf, len, true);
+         if (!ctx->segment)
+            ctx->cache[ctx->cache_sz++] = i;
+         return i;
       }
    }
    else {
-      assert(index < ctx->cache_sz);
-      return ctx->cache[index];
+      assert(index <= ctx->cache_sz);
+      return ctx->cache[index - 1];
    }
 }
 
+void ident_read_redirect(ident_rd_ctx_t ctx, fbuf_t *f, bool segment)
+{
+   ctx->file    = f;
+   ctx->segment = segment;
+}
+
 ident_t ident_uniq(const char *prefix)
 {
    static int counter = 0;
 
-   const char *start = prefix;
-   struct trie *end;
-   if (search_trie(&start, &root, &end)) {
-      const size_t len = strlen(prefix) + 16;
-      char buf[len];
+   const size_t plen = strlen(prefix);
+   if (ident_lookup(prefix, plen, false) == NULL)
+      return ident_lookup(prefix, plen, true);
+
+   const size_t len = plen + 16;
+   char buf[len];
+   do {
       snprintf(buf, len, "%s%d", prefix, counter++);
+   } while (ident_lookup(buf, strlen(buf), false) != NULL);
 
-      return ident_new(buf);
-   }
-   else {
-      struct trie *result;
-      build_trie(start, end, &result);
-      return result;
-   }
+   return ident_lookup(buf, strlen(buf), true);
 }
 
 ident_t ident_prefix(ident_t a, ident_t b, char sep)
@@ -278,24 +293,17 @@ ident_t ident_prefix(ident_t a, ident_t b, char sep)
    else if (b == NULL)
       return a;
 
-   struct trie *result;
-
-   if (sep != '\0') {
-      // Append separator
-      const char sep_str[] = { sep, '\0' };
-      const char *p_sep_str = sep_str;
-      if (!search_trie(&p_sep_str, a, &result))
-         build_trie(p_sep_str, result, &result);
-   }
-   else
-      result = a;
+   const size_t len = a->length + b->length + (sep != '\0');
+   char buf[len];
+   char *p = buf;
 
-   // Append b
-   const char *bstr = istr(b);
-   if (!search_trie(&bstr, result, &result))
-      build_trie(bstr, result, &result);
+   memcpy(p, a->bytes, a->length);
+   p += a->length;
+   if (sep != '\0')
+      *p++ = sep;
+   memcpy(p, b->bytes, b->length);
 
-   return result;
+   return ident_lookup(buf, len, true);
 }
 
 ident_t ident_strip(ident_t a, ident_t b)
@@ -303,61 +311,52 @@ ident_t ident_strip(ident_t a, ident_t b)
    assert(a != NULL);
    assert(b != NULL);
 
-   while (a->value == b->value && b->value != '\0') {
-      a = a->up;
-      b = b->up;
-   }
+   if (b->length > a->length)
+      return NULL;
+
+   const size_t len = a->length - b->length;
+   if (memcmp(a->bytes + len, b->bytes, b->length) != 0)
+      return NULL;
 
-   return (b->value == '\0' ? a : NULL);
+   return ident_lookup(a->bytes, len, true);
 }
 
 char ident_char(ident_t i, unsigned n)
 {
    assert(i != NULL);
+   assert(n <= i->length);
 
-   if (n == 0)
-      return i->value;
-   else
-      return ident_char(i->up, n - 1);
+   return (n == i->length) ? '\0' : i->bytes[i->length - n - 1];
 }
 
 ident_t ident_until(ident_t i, char c)
 {
    assert(i != NULL);
 
-   ident_t r = i;
-   while (i->value != '\0') {
-      if (i->value == c)
-         r = i->up;
-      i = i->up;
-   }
-
-   return r;
+   const char *p = memchr(i->bytes, c, i->length);
+   if (p == NULL)
+      return i;
+   else
+      return ident_lookup(i->bytes, p - i->bytes, true);
 }
 
 ident_t ident_runtil(ident_t i, char c)
 {
    assert(i != NULL);
 
-   ident_t r = i;
-   while (i->value != '\0') {
-      if (i->value == c)
-         return i->up;
-      i = i->up;
+   for (int n = i->length - 1; n >= 0; n--) {
+      if (i->bytes[n] == c)
+         return ident_lookup(i->bytes, n, true);
    }
 
-   return r;
+   return i;
 }
 
 bool icmp(ident_t i, const char *s)
 {
    assert(i != NULL);
 
-   struct trie *result;
-   if (!search_trie(&s, &root, &result))
-      return false;
-   else
-      return result == i;
+   return strcmp(i->bytes, s) == 0;
 }
 
 bool ident_glob(ident_t i, const char *glob, int length)
@@ -367,18 +366,19 @@ bool ident_glob(ident_t i, const char *glob, int length)
    if (length < 0)
       length = strlen(glob);
 
-   struct trie *it = i;
+   // Match backwards from the end of the identifier
+   const char *it = i->bytes + i->length - 1;
    const char *p = glob + length - 1;
    bool nom = false;
-   while ((it->value != '\0') && (p >= glob)) {
-      if ((it->value == *p) || (*p == '*')) {
-         it = it->up;
+   while ((it >= i->bytes) && (p >= glob)) {
+      if ((*it == *p) || (*p == '*')) {
+         it--;
          nom = (*p == '*');
          if (p > glob)
             p--;
       }
       else if (nom)
-         it = it->up;
+         it--;
       else
          return false;
    }
@@ -21,7 +21,7 @@
 #include "lib.h"
 #include "fbuf.h"
 
-typedef struct trie *ident_t;
+typedef struct ident *ident_t;
 typedef struct ident_wr_ctx *ident_wr_ctx_t;
 typedef struct ident_rd_ctx *ident_rd_ctx_t;
 
@@ -57,17 +57,21 @@ bool icmp(ident_t i, const char *s);
 bool ident_glob(ident_t i, const char *glob, int length);
 
 // Convert an identifier reference to a NULL-terminated string.
-// This function is quite slow so its use should be avoided except
-// for printing.
+// The string is valid for the lifetime of the program.
 const char *istr(ident_t ident);
 
 ident_wr_ctx_t ident_write_begin(fbuf_t *f);
 void ident_write(ident_t ident, ident_wr_ctx_t ctx);
 void ident_write_end(ident_wr_ctx_t ctx);
 
+// Switch to another file for a segment that may be read out of order:
+// identifiers first seen in a segment are always written in full
+void ident_write_redirect(ident_wr_ctx_t ctx, fbuf_t *f, bool segment);
+
 ident_rd_ctx_t ident_read_begin(fbuf_t *f);
 ident_t ident_read(ident_rd_ctx_t ctx);
 void ident_read_end(ident_rd_ctx_t ctx);
+void ident_read_redirect(ident_rd_ctx_t ctx, fbuf_t *f, bool segment);
 
 typedef struct ident_list ident_list_t;
 
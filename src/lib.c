@@ -18,6 +18,7 @@
 #include "util.h"
 #include "lib.h"
 #include "tree.h"
+#include "hash.h"
 
 #include <assert.h>
 #include <limits.h>
@@ -28,10 +29,17 @@
 #include <dirent.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #define MAX_SEARCH_PATHS 64
+#define ARCHIVE_NAME     "_archive"
+#define ARCHIVE_MAGIC    "NVCA"
+#define FOOTER_SIZE      16
+#define INDEX_MAGIC      0x4e564931   // "NVI1"
 
 struct lib_unit {
    tree_t        top;
@@ -44,16 +52,36 @@ struct lib_unit {
 struct lib_index {
    ident_t           name;
    tree_kind_t       kind;
+   lib_mtime_t       mtime;
+   ident_t           source;
+   uint64_t          hash;
+   ident_t          *deps;
+   unsigned          n_deps;
+   bool              dirty;
    struct lib_index *next;
 };
 
+// Units packed into a library archive
+struct lib_member {
+   uint64_t    offset;
+   uint64_t    length;
+   lib_mtime_t mtime;
+};
+
 struct lib {
-   char              path[PATH_MAX];
-   ident_t           name;
-   unsigned          n_units;
-   unsigned          units_alloc;
-   struct lib_unit  *units;
-   struct lib_index *index;
+   char               path[PATH_MAX];
+   ident_t            name;
+   unsigned           n_units;
+   unsigned           units_alloc;
+   struct lib_unit   *units;
+   hash_t            *lookup;
+   struct lib_index  *index;
+   hash_t            *index_hash;
+   const uint8_t     *archive;
+   size_t             archive_len;
+   ino_t              archive_ino;
+   struct lib_member *members;
+   hash_t            *member_hash;
 };
 
 struct lib_list {
@@ -77,6 +105,81 @@ static ident_t upcase_name(const char *name)
    return i;
 }
 
+static void lib_archive_open(lib_t lib);
+static void lib_archive_close(lib_t lib);
+
+static struct lib_index *lib_index_new(lib_t lib, ident_t name,
+                                       tree_kind_t kind)
+{
+   struct lib_index *in = xmalloc(sizeof(struct lib_index));
+   in->name     = name;
+   in->kind     = kind;
+   in->mtime    = 0;
+   in->source   = NULL;
+   in->hash     = 0;
+   in->deps     = NULL;
+   in->n_deps   = 0;
+   in->dirty    = false;
+   in->next     = lib->index;
+
+   lib->index = in;
+   hash_put(lib->index_hash, name, in);
+   return in;
+}
+
+static void lib_read_index(lib_t lib)
+{
+   // Units analysed by this process since it last saved keep their
+   // entries but everything else is refreshed as another process
+   // sharing the library may have analysed it since the index was read
+
+   fbuf_t *f = lib_fbuf_open(lib, "_index", FBUF_IN);
+   if (f == NULL)
+      return;
+
+   if (read_u32(f) != INDEX_MAGIC)
+      fatal("library %s index was written by an older version: "
+            "reanalyse all units", istr(lib->name));
+
+   ident_rd_ctx_t ictx = ident_read_begin(f);
+
+   const int entries = read_u32(f);
+   for (int i = 0; i < entries; i++) {
+      ident_t name = ident_read(ictx);
+      tree_kind_t kind = read_u16(f);
+      assert(kind < T_LAST_TREE_KIND);
+
+      const lib_mtime_t mtime = read_u64(f);
+      ident_t source = ident_read(ictx);
+      const uint64_t hash = read_u64(f);
+
+      const unsigned n_deps = read_uint(f);
+      ident_t deps[n_deps + 1];
+      for (unsigned j = 0; j < n_deps; j++)
+         deps[j] = ident_read(ictx);
+
+      struct lib_index *in = hash_get(lib->index_hash, name);
+      if (in == NULL)
+         in = lib_index_new(lib, name, kind);
+      else if (in->dirty)
+         continue;
+
+      in->kind   = kind;
+      in->mtime  = mtime;
+      in->source = source;
+      in->hash   = hash;
+      in->n_deps = n_deps;
+
+      if (n_deps > 0) {
+         in->deps = xrealloc(in->deps, n_deps * sizeof(ident_t));
+         memcpy(in->deps, deps, n_deps * sizeof(ident_t));
+      }
+   }
+
+   ident_read_end(ictx);
+   fbuf_close(f);
+}
+
 static lib_t lib_init(const char *name, const char *rpath)
 {
    struct lib *l = xmalloc(sizeof(struct lib));
@@ -84,6 +187,15 @@ static lib_t lib_init(const char *name, const char *rpath)
    l->units   = NULL;
    l->name    = upcase_name(name);
    l->index   = NULL;
+   l->archive = NULL;
+   l->members = NULL;
+
+   l->archive_len = 0;
+   l->archive_ino = 0;
+
+   l->lookup      = hash_new(64, false);
+   l->index_hash  = hash_new(64, true);
+   l->member_hash = NULL;
 
    if (realpath(rpath, l->path) == NULL)
       strncpy(l->path, rpath, PATH_MAX);
@@ -93,27 +205,10 @@ static lib_t lib_init(const char *name, const char *rpath)
    el->next = loaded;
    loaded = el;
 
-   fbuf_t *f = lib_fbuf_open(l, "_index", FBUF_IN);
-   if (f != NULL) {
-      ident_rd_ctx_t ictx = ident_read_begin(f);
-
-      const int entries = read_u32(f);
-      for (int i = 0; i < entries; i++) {
-         ident_t name = ident_read(ictx);
-         tree_kind_t kind = read_u16(f);
-         assert(kind < T_LAST_TREE_KIND);
-
-         struct lib_index *in = xmalloc(sizeof(struct lib_index));
-         in->name = name;
-         in->kind = kind;
-         in->next = l->index;
-
-         l->index = in;
-      }
+   if (*(l->path) != '\0')
+      lib_read_index(l);
 
-      ident_read_end(ictx);
-      fbuf_close(f);
-   }
+   lib_archive_open(l);
 
    return l;
 }
@@ -142,24 +237,29 @@ static struct lib_unit *lib_put_aux(lib_t lib, tree_t unit,
    lib->units[n].mtime    = mtime;
    lib->units[n].kind     = tree_kind(unit);
 
+   // Lookups find the first unit added with a given name
    ident_t name = tree_ident(unit);
-   struct lib_index *it;
-   for (it = lib->index;
-        (it != NULL) && (it->name != name);
-        it = it->next)
-      ;
+   if (hash_get(lib->lookup, name) == NULL)
+      hash_put(lib->lookup, name, (void *)(uintptr_t)(n + 1));
 
-   if (it == NULL) {
-      struct lib_index *new = xmalloc(sizeof(struct lib_index));
-      new->name = name;
-      new->kind = tree_kind(unit);
-      new->next = lib->index;
-
-      lib->index = new;
-   }
+   struct lib_index *it = hash_get(lib->index_hash, name);
+   if (it == NULL)
+      it = lib_index_new(lib, name, tree_kind(unit));
    else
       it->kind = tree_kind(unit);
 
+   if (dirty) {
+      // A newly analysed unit replaces the source and dependencies
+      // recorded for any earlier version
+      it->mtime    = mtime;
+      it->source   = NULL;
+      it->hash     = 0;
+      it->n_deps   = 0;
+      it->dirty    = true;
+   }
+   else if (it->mtime == 0)
+      it->mtime = mtime;
+
    return &(lib->units[n]);
 }
 
@@ -313,6 +413,13 @@ void lib_free(lib_t lib)
       }
    }
 
+   if (lib->archive != NULL)
+      munmap((void *)lib->archive, lib->archive_len);
+   lib_archive_close(lib);
+
+   hash_free(lib->lookup);
+   hash_free(lib->index_hash);
+
    if (lib->units != NULL)
       free(lib->units);
    free(lib);
@@ -363,57 +470,352 @@ static lib_mtime_t lib_time_to_usecs(time_t t)
    return (lib_mtime_t)t * 1000 * 1000;
 }
 
+static bool lib_stat_mtime(lib_t lib, const char *name, lib_mtime_t *mt)
+{
+   struct stat st;
+   if (stat(lib_file_path(lib, name), &st) < 0)
+      return false;
+
+   *mt = lib_time_to_usecs(st.st_mtime);
+#if defined HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+   *mt += st.st_mtimespec.tv_nsec / 1000;
+#elif defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+   *mt += st.st_mtim.tv_nsec / 1000;
+#endif
+
+   return true;
+}
+
+static uint64_t archive_read64(const uint8_t *p)
+{
+   uint64_t v = 0;
+   for (int i = 7; i >= 0; i--)
+      v = (v << 8) | p[i];
+   return v;
+}
+
+static void archive_write64(uint64_t v, FILE *f)
+{
+   for (int i = 0; i < 8; i++)
+      fputc((v >> (i * 8)) & 0xff, f);
+}
+
+static void lib_archive_close(lib_t lib)
+{
+   if (lib->member_hash != NULL) {
+      hash_free(lib->member_hash);
+      lib->member_hash = NULL;
+   }
+
+   if (lib->members != NULL) {
+      free(lib->members);
+      lib->members = NULL;
+   }
+
+   lib->archive     = NULL;
+   lib->archive_len = 0;
+   lib->archive_ino = 0;
+}
+
+static void lib_archive_open(lib_t lib)
+{
+   // The archive is the serialised units laid end to end followed by
+   // a table of members and a fixed size footer:
+   //
+   //   <u16 namelen> <name> <u64 offset> <u64 length> <u64 mtime> ...
+   //   <u64 table offset> <u32 count> "NVCA"
+
+   if (*(lib->path) == '\0')   // Temporary library
+      return;
+
+   const char *path = lib_file_path(lib, ARCHIVE_NAME);
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return;
+
+   struct stat st;
+   if (fstat(fd, &st) < 0)
+      fatal_errno("%s", path);
+
+   if (st.st_size < FOOTER_SIZE)
+      fatal("library archive %s is corrupt", path);
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      fatal_errno("%s", path);
+
+   close(fd);
+
+   const uint8_t *base = map;
+   const size_t len = st.st_size;
+   const uint8_t *footer = base + len - FOOTER_SIZE;
+
+   if (memcmp(footer + 12, ARCHIVE_MAGIC, 4) != 0)
+      fatal("%s is not a library archive", path);
+
+   const uint64_t table = archive_read64(footer);
+   const uint32_t count =
+      footer[8] | (footer[9] << 8) | (footer[10] << 16)
+      | ((uint32_t)footer[11] << 24);
+
+   if (table > len - FOOTER_SIZE)
+      fatal("library archive %s is corrupt", path);
+
+   lib->archive     = base;
+   lib->archive_len = len;
+   lib->archive_ino = st.st_ino;
+   lib->members     = xmalloc(MAX(count, 1) * sizeof(struct lib_member));
+   lib->member_hash = hash_new(MAX(count * 2, 16), true);
+
+   const uint8_t *p = base + table;
+   for (uint32_t i = 0; i < count; i++) {
+      if (footer - p < 2)
+         fatal("library archive %s is corrupt", path);
+
+      const unsigned namelen = p[0] | (p[1] << 8);
+      p += 2;
+
+      if (footer - p < namelen + 24)
+         fatal("library archive %s is corrupt", path);
+
+      char name[namelen + 1];
+      memcpy(name, p, namelen);
+      name[namelen] = '\0';
+      p += namelen;
+
+      struct lib_member *m = &(lib->members[i]);
+      m->offset = archive_read64(p);
+      m->length = archive_read64(p + 8);
+      m->mtime  = archive_read64(p + 16);
+      p += 24;
+
+      if ((m->offset > table) || (m->length > table - m->offset))
+         fatal("library archive %s is corrupt", path);
+
+      hash_put(lib->member_hash, ident_new(name), m);
+   }
+}
+
+static bool lib_archive_refresh(lib_t lib)
+{
+   // Map the archive again if another process has repacked it since
+   // it was opened: the old mapping is not released as units read from
+   // it may still hold a pointer into it
+
+   if (*(lib->path) == '\0')   // Temporary library
+      return false;
+
+   struct stat st;
+   if (stat(lib_file_path(lib, ARCHIVE_NAME), &st) < 0)
+      return false;
+
+   if ((lib->archive != NULL) && (st.st_ino == lib->archive_ino))
+      return false;
+
+   lib_archive_close(lib);
+   lib_archive_open(lib);
+   return true;
+}
+
+static int lib_lock(lib_t lib)
+{
+   // Several analysis processes may update the same library so the
+   // index and archive are only rewritten holding a lock on the marker
+
+   if (*(lib->path) == '\0')   // Temporary library
+      return -1;
+
+   const char *path = lib_file_path(lib, "_NVC_LIB");
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      fatal_errno("%s", path);
+
+   while (flock(fd, LOCK_EX) < 0) {
+      if (errno != EINTR)
+         fatal_errno("flock");
+   }
+
+   return fd;
+}
+
+static void lib_unlock(int fd)
+{
+   if (fd >= 0)
+      close(fd);
+}
+
+static void lib_pack_locked(lib_t lib)
+{
+   lib_read_index(lib);
+   lib_archive_refresh(lib);
+
+   char tmp[PATH_MAX];
+   lib_realpath(lib, ARCHIVE_NAME ".tmp", tmp, sizeof(tmp));
+
+   FILE *f = fopen(tmp, "w");
+   if (f == NULL)
+      fatal_errno("failed to create %s", tmp);
+
+   int count = 0;
+   struct lib_index *it;
+   for (it = lib->index; it != NULL; it = it->next, ++count)
+      ;
+
+   struct lib_member *members =
+      xmalloc(MAX(count, 1) * sizeof(struct lib_member));
+   bool *loose = xmalloc(MAX(count, 1) * sizeof(bool));
+
+   // Copy each unit from its own file if one exists as that is newer
+   // than any copy in the current archive
+   uint64_t offset = 0;
+   int n = 0;
+   for (it = lib->index; it != NULL; it = it->next, n++) {
+      const char *name = istr(it->name);
+      struct lib_member *m = &(members[n]);
+      m->offset = offset;
+      m->length = 0;
+
+      FILE *in = lib_fopen(lib, name, "r");
+      if ((loose[n] = (in != NULL))) {
+         if (!lib_stat_mtime(lib, name, &(m->mtime)))
+            fatal_errno("%s", name);
+
+         char buf[8192];
+         size_t nr;
+         while ((nr = fread(buf, 1, sizeof(buf), in)) > 0) {
+            if (fwrite(buf, nr, 1, f) != 1)
+               fatal_errno("fwrite");
+            m->length += nr;
+         }
+
+         if (ferror(in))
+            fatal_errno("%s", name);
+
+         fclose(in);
+      }
+      else if (lib->member_hash != NULL) {
+         struct lib_member *old = hash_get(lib->member_hash, it->name);
+         if (old == NULL)
+            fatal("unit %s missing from library %s", name, istr(lib->name));
+
+         if (fwrite(lib->archive + old->offset, old->length, 1, f) != 1)
+            fatal_errno("fwrite");
+
+         m->length = old->length;
+         m->mtime  = old->mtime;
+      }
+      else
+         fatal("unit %s missing from library %s", name, istr(lib->name));
+
+      offset += m->length;
+   }
+
+   n = 0;
+   for (it = lib->index; it != NULL; it = it->next, n++) {
+      const char *name = istr(it->name);
+      const size_t namelen = strlen(name);
+      fputc(namelen & 0xff, f);
+      fputc((namelen >> 8) & 0xff, f);
+      fwrite(name, namelen, 1, f);
+      archive_write64(members[n].offset, f);
+      archive_write64(members[n].length, f);
+      archive_write64(members[n].mtime, f);
+   }
+
+   archive_write64(offset, f);
+   for (int i = 0; i < 4; i++)
+      fputc((count >> (i * 8)) & 0xff, f);
+   fwrite(ARCHIVE_MAGIC, 4, 1, f);
+
+   if (fclose(f) != 0)
+      fatal_errno("%s", tmp);
+
+   if (rename(tmp, lib_file_path(lib, ARCHIVE_NAME)) < 0)
+      fatal_errno("rename");
+
+   n = 0;
+   for (it = lib->index; it != NULL; it = it->next, n++) {
+      if (loose[n] && (unlink(lib_file_path(lib, istr(it->name))) < 0))
+         fatal_errno("unlink");
+   }
+
+   free(members);
+   free(loose);
+
+   lib_archive_refresh(lib);
+}
+
+void lib_pack(lib_t lib)
+{
+   assert(lib != NULL);
+
+   if (*(lib->path) == '\0')   // Temporary library
+      return;
+
+   const int lock = lib_lock(lib);
+   lib_pack_locked(lib);
+   lib_unlock(lock);
+}
+
 void lib_put(lib_t lib, tree_t unit)
 {
    lib_mtime_t usecs = lib_time_to_usecs(time(NULL));
    lib_put_aux(lib, unit, NULL, true, usecs);
 }
 
+static struct lib_unit *lib_get_member(lib_t lib, ident_t ident)
+{
+   if (lib->member_hash == NULL)
+      return NULL;
+
+   struct lib_member *m = hash_get(lib->member_hash, ident);
+   if (m == NULL)
+      return NULL;
+
+   const char *path = lib_file_path(lib, istr(ident));
+   fbuf_t *f = fbuf_open_mem(lib->archive + m->offset, m->length, path);
+   tree_rd_ctx_t ctx = tree_read_begin(f, path);
+   tree_t top = tree_read(ctx);
+
+   return lib_put_aux(lib, top, ctx, false, m->mtime);
+}
+
 static struct lib_unit *lib_get_aux(lib_t lib, ident_t ident)
 {
    assert(lib != NULL);
 
-   // Search in the list of already loaded libraries
-   for (unsigned n = 0; n < lib->n_units; n++) {
-      if (tree_ident(lib->units[n].top) == ident)
-         return &(lib->units[n]);
-   }
+   // Search in the list of already loaded units
+   const uintptr_t n = (uintptr_t)hash_get(lib->lookup, ident);
+   if (n > 0)
+      return &(lib->units[n - 1]);
 
    if (*(lib->path) == '\0')   // Temporary library
       return NULL;
 
-   // Otherwise search in the filesystem
-   DIR *d = opendir(lib->path);
-   if (d == NULL)
-      fatal("%s: %s", lib->path, strerror(errno));
-
-   struct lib_unit *unit = NULL;
-   const char *search = istr(ident);
-   struct dirent *e;
-   while ((e = readdir(d))) {
-      if (strcmp(e->d_name, search) == 0) {
-         fbuf_t *f = lib_fbuf_open(lib, e->d_name, FBUF_IN);
-         tree_rd_ctx_t ctx = tree_read_begin(f, lib_file_path(lib, e->d_name));
-         tree_t top = tree_read(ctx);
+   // Then in the library archive
+   struct lib_unit *lu = lib_get_member(lib, ident);
+   if (lu != NULL)
+      return lu;
 
-         struct stat st;
-         if (stat(lib_file_path(lib, e->d_name), &st) < 0)
-            fatal_errno("%s", e->d_name);
+   // Otherwise search in the filesystem
+   const char *name = istr(ident);
+   fbuf_t *f = lib_fbuf_open(lib, name, FBUF_IN);
+   if (f == NULL) {
+      // The unit may have been packed by another process
+      if (lib_archive_refresh(lib))
+         return lib_get_member(lib, ident);
+      else
+         return NULL;
+   }
 
-         lib_mtime_t mt = lib_time_to_usecs(st.st_mtime);
-#if defined HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
-         mt += st.st_mtimespec.tv_nsec / 1000;
-#elif defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
-         mt += st.st_mtim.tv_nsec / 1000;
-#endif
+   tree_rd_ctx_t ctx = tree_read_begin(f, lib_file_path(lib, name));
+   tree_t top = tree_read(ctx);
 
-         unit = lib_put_aux(lib, top, ctx, false, mt);
-         break;
-      }
-   }
+   lib_mtime_t mt;
+   if (!lib_stat_mtime(lib, name, &mt))
+      fatal_errno("%s", name);
 
-   closedir(d);
-   return unit;
+   return lib_put_aux(lib, top, ctx, false, mt);
 }
 
 lib_mtime_t lib_mtime(lib_t lib, ident_t ident)
@@ -458,6 +860,8 @@ void lib_save(lib_t lib)
 {
    assert(lib != NULL);
 
+   const int lock = lib_lock(lib);
+
    for (unsigned n = 0; n < lib->n_units; n++) {
       if (lib->units[n].dirty) {
          const char *name = istr(tree_ident(lib->units[n].top));
@@ -473,6 +877,9 @@ void lib_save(lib_t lib)
       }
    }
 
+   // Keep units saved by other processes since this index was read
+   lib_read_index(lib);
+
    struct lib_index *it;
    int index_sz = 0;
    for (it = lib->index; it != NULL; it = it->next, ++index_sz)
@@ -482,16 +889,32 @@ void lib_save(lib_t lib)
    if (f == NULL)
       fatal("failed to create library %s index", istr(lib->name));
 
+   write_u32(INDEX_MAGIC, f);
+
    ident_wr_ctx_t ictx = ident_write_begin(f);
 
    write_u32(index_sz, f);
    for (it = lib->index; it != NULL; it = it->next) {
       ident_write(it->name, ictx);
       write_u16(it->kind, f);
+      write_u64(it->mtime, f);
+      ident_write(it->source, ictx);
+      write_u64(it->hash, f);
+      write_uint(it->n_deps, f);
+      for (unsigned i = 0; i < it->n_deps; i++)
+         ident_write(it->deps[i], ictx);
+
+      it->dirty = false;
    }
 
    ident_write_end(ictx);
    fbuf_close(f);
+
+   lib_archive_refresh(lib);
+   if (lib->archive != NULL)
+      lib_pack_locked(lib);
+
+   lib_unlock(lock);
 }
 
 void lib_walk_index(lib_t lib, lib_index_fn_t fn, void *context)
@@ -503,6 +926,65 @@ void lib_walk_index(lib_t lib, lib_index_fn_t fn, void *context)
       (*fn)(it->name, it->kind, context);
 }
 
+static struct lib_index *lib_index_get(lib_t lib, ident_t ident)
+{
+   assert(lib != NULL);
+
+   struct lib_index *it = hash_get(lib->index_hash, ident);
+   if (it == NULL)
+      fatal("unit %s not in library %s", istr(ident), istr(lib->name));
+
+   return it;
+}
+
+void lib_set_source(lib_t lib, ident_t ident, ident_t file, uint64_t hash)
+{
+   struct lib_index *it = lib_index_get(lib, ident);
+   it->source = file;
+   it->hash   = hash;
+}
+
+ident_t lib_source(lib_t lib, ident_t ident, uint64_t *hash)
+{
+   struct lib_index *it = hash_get(lib->index_hash, ident);
+   if (it == NULL)
+      return NULL;
+
+   if (hash != NULL)
+      *hash = it->hash;
+   return it->source;
+}
+
+void lib_add_dep(lib_t lib, ident_t ident, ident_t dep)
+{
+   struct lib_index *it = lib_index_get(lib, ident);
+
+   for (unsigned i = 0; i < it->n_deps; i++) {
+      if (it->deps[i] == dep)
+         return;
+   }
+
+   it->deps = xrealloc(it->deps, (it->n_deps + 1) * sizeof(ident_t));
+   it->deps[it->n_deps++] = dep;
+}
+
+void lib_walk_deps(lib_t lib, ident_t ident, lib_dep_fn_t fn, void *context)
+{
+   struct lib_index *it = hash_get(lib->index_hash, ident);
+   if (it == NULL)
+      return;
+
+   for (unsigned i = 0; i < it->n_deps; i++)
+      (*fn)(it->deps[i], context);
+}
+
+lib_mtime_t lib_index_mtime(lib_t lib, ident_t ident)
+{
+   // Unlike lib_mtime this does not need to read the unit
+   struct lib_index *it = hash_get(lib->index_hash, ident);
+   return (it == NULL) ? 0 : it->mtime;
+}
+
 void lib_realpath(lib_t lib, const char *name, char *buf, size_t buflen)
 {
    assert(lib != NULL);
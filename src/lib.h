@@ -24,7 +24,7 @@
 
 #include "fbuf.h"
 
-struct trie;
+struct ident;
 struct tree;
 struct tree_rd_ctx;
 
@@ -40,21 +40,32 @@ FILE *lib_fopen(lib_t lib, const char *name, const char *mode);
 fbuf_t *lib_fbuf_open(lib_t lib, const char *name, fbuf_mode_t mode);
 void lib_realpath(lib_t lib, const char *name, char *buf, size_t buflen);
 void lib_destroy(lib_t lib);
-struct trie *lib_name(lib_t lib);
+struct ident *lib_name(lib_t lib);
 void lib_save(lib_t lib);
+void lib_pack(lib_t lib);
 void lib_mkdir(lib_t lib, const char *name);
 
 lib_t lib_work(void);
 void lib_set_work(lib_t lib);
 
 void lib_put(lib_t lib, struct tree *unit);
-struct tree *lib_get(lib_t lib, struct trie *ident);
-struct tree *lib_get_ctx(lib_t lib, struct trie *ident,
+struct tree *lib_get(lib_t lib, struct ident *ident);
+struct tree *lib_get_ctx(lib_t lib, struct ident *ident,
                          struct tree_rd_ctx **ctx);
-lib_mtime_t lib_mtime(lib_t lib, struct trie *ident);
+lib_mtime_t lib_mtime(lib_t lib, struct ident *ident);
 
-typedef void (*lib_index_fn_t)(struct trie *ident, int kind, void *context);
+typedef void (*lib_index_fn_t)(struct ident *ident, int kind, void *context);
 void lib_walk_index(lib_t lib, lib_index_fn_t fn, void *context);
+lib_mtime_t lib_index_mtime(lib_t lib, struct ident *ident);
+
+void lib_set_source(lib_t lib, struct ident *ident, struct ident *file,
+                    uint64_t hash);
+struct ident *lib_source(lib_t lib, struct ident *ident, uint64_t *hash);
+
+typedef void (*lib_dep_fn_t)(struct ident *dep, void *context);
+void lib_add_dep(lib_t lib, struct ident *ident, struct ident *dep);
+void lib_walk_deps(lib_t lib, struct ident *ident, lib_dep_fn_t fn,
+                   void *context);
 
 
 #endif // _LIB_H
@@ -24,16 +24,30 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <llvm-c/Core.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
+#include <llvm-c/Linker.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassManagerBuilder.h>
+
+#if LLVM_VERSION_NUM >= 34
+#define LINK_EMIT_OBJECT
+#endif
+
 #define MAX_ARGS 64
 
-static char **args = NULL;
-static int    n_args = 0;
-static tree_t linked[MAX_ARGS];
-static int    n_linked = 0;
+static char          **args = NULL;
+static int             n_args = 0;
+static tree_t          linked[MAX_ARGS];
+static int             n_linked = 0;
+static LLVMModuleRef   module = NULL;
 
 static void link_all_context(tree_t unit);
 
@@ -49,17 +63,51 @@ static void link_arg_f(const char *fmt, ...)
    args[++n_args] = NULL;
 }
 
-static void link_product(lib_t lib, ident_t name, const char *ext)
+static void link_product_path(lib_t lib, ident_t name, const char *ext,
+                              char *buf, size_t len)
 {
-   char path[256];
+   char path[PATH_MAX];
    lib_realpath(lib, NULL, path, sizeof(path));
 
-   link_arg_f("%s/_%s.%s", path, istr(name), ext);
+   if (snprintf(buf, len, "%s/_%s.%s", path, istr(name), ext) >= len)
+      fatal("path to %s in library %s is too long",
+            istr(name), istr(lib_name(lib)));
+}
+
+static void link_product(lib_t lib, ident_t name, const char *ext)
+{
+   char path[PATH_MAX];
+   link_product_path(lib, name, ext, path, sizeof(path));
+
+   link_arg_f("%s", path);
 }
 
-static void link_arg_bc(lib_t lib, ident_t name)
+static void link_module(lib_t lib, ident_t name)
 {
-   link_product(lib, name, "bc");
+   // Read a bitcode file and merge it into the module being linked
+   // rather than passing it to llvm-link
+
+   char path[PATH_MAX];
+   link_product_path(lib, name, "bc", path, sizeof(path));
+
+   char *error;
+   LLVMMemoryBufferRef buf;
+   if (LLVMCreateMemoryBufferWithContentsOfFile(path, &buf, &error))
+      fatal("error reading bitcode from %s: %s", path, error);
+
+   LLVMModuleRef m;
+   if (LLVMParseBitcode(buf, &m, &error))
+      fatal("error parsing bitcode from %s: %s", path, error);
+
+   LLVMDisposeMemoryBuffer(buf);
+
+   if (module == NULL)
+      module = m;
+   else {
+      if (LLVMLinkModules(module, m, LLVMLinkerDestroySource, &error))
+         fatal("failed to link %s: %s", path, error);
+      LLVMDisposeModule(m);
+   }
 }
 
 static bool link_needs_body(tree_t pack)
@@ -93,7 +141,7 @@ static void link_context(tree_t ctx)
    assert(n_linked < MAX_ARGS - 1);
 
    if (pack_needs_cgen(unit) && !link_already_have(unit)) {
-      link_arg_bc(lib, name);
+      link_module(lib, name);
       linked[n_linked++] = unit;
    }
 
@@ -107,7 +155,7 @@ static void link_context(tree_t ctx)
    }
 
    if (!link_already_have(body)) {
-      link_arg_bc(lib, body_i);
+      link_module(lib, body_i);
       linked[n_linked++] = body;
    }
 
@@ -122,11 +170,21 @@ static void link_all_context(tree_t unit)
       link_context(tree_context(unit, i));
 }
 
-static void link_output(tree_t top, const char *ext)
+static ident_t link_final_name(tree_t top)
 {
    ident_t orig = ident_strip(tree_ident(top), ident_new(".elab"));
-   ident_t final = ident_prefix(orig, ident_new("final"), '.');
-   link_product(lib_work(), final, ext);
+   return ident_prefix(orig, ident_new("final"), '.');
+}
+
+static void link_output(tree_t top, const char *ext)
+{
+   link_product(lib_work(), link_final_name(top), ext);
+}
+
+static void link_output_path(tree_t top, const char *ext,
+                             char *buf, size_t len)
+{
+   link_product_path(lib_work(), link_final_name(top), ext, buf, len);
 }
 
 static void link_args_begin(void)
@@ -164,12 +222,76 @@ static void link_exec(void)
       fatal_errno("fork");
 }
 
-static void link_assembly(tree_t top)
+static void link_optimise(void)
 {
+   // Equivalent to opt -O2
+   LLVMPassManagerBuilderRef builder = LLVMPassManagerBuilderCreate();
+   LLVMPassManagerBuilderSetOptLevel(builder, 2);
+
+   LLVMPassManagerRef fn_pass_mgr =
+      LLVMCreateFunctionPassManagerForModule(module);
+   LLVMPassManagerBuilderPopulateFunctionPassManager(builder, fn_pass_mgr);
+
+   LLVMPassManagerRef pass_mgr = LLVMCreatePassManager();
+   LLVMPassManagerBuilderPopulateModulePassManager(builder, pass_mgr);
+
+   LLVMPassManagerBuilderDispose(builder);
+
+   LLVMInitializeFunctionPassManager(fn_pass_mgr);
+   for (LLVMValueRef fn = LLVMGetFirstFunction(module);
+        fn != NULL; fn = LLVMGetNextFunction(fn))
+      LLVMRunFunctionPassManager(fn_pass_mgr, fn);
+   LLVMFinalizeFunctionPassManager(fn_pass_mgr);
+   LLVMDisposePassManager(fn_pass_mgr);
+
+   LLVMRunPassManager(pass_mgr, module);
+   LLVMDisposePassManager(pass_mgr);
+}
+
+#ifdef LINK_EMIT_OBJECT
+
+static void link_object(tree_t top)
+{
+   LLVMInitializeNativeTarget();
+   LLVMInitializeNativeAsmPrinter();
+
+   char *triple = LLVMGetDefaultTargetTriple();
+
+   char *error;
+   LLVMTargetRef target;
+   if (LLVMGetTargetFromTriple(triple, &target, &error))
+      fatal("cannot generate code for %s: %s", triple, error);
+
+   LLVMTargetMachineRef machine =
+      LLVMCreateTargetMachine(target, triple, "", "",
+                              LLVMCodeGenLevelDefault, LLVMRelocPIC,
+                              LLVMCodeModelDefault);
+
+   char path[PATH_MAX];
+   link_output_path(top, "o", path, sizeof(path));
+
+   if (LLVMTargetMachineEmitToFile(machine, module, path,
+                                   LLVMObjectFile, &error))
+      fatal("failed to write %s: %s", path, error);
+
+   LLVMDisposeTargetMachine(machine);
+   LLVMDisposeMessage(triple);
+}
+
+#else  // LINK_EMIT_OBJECT
+
+static void link_object(tree_t top)
+{
+   // Older LLVM versions have no C interface to find the host target
+   // so the assembly is generated by llc
+
    link_args_begin();
 
    link_arg_f("%s/llc", LLVM_CONFIG_BINDIR);
    link_arg_f("-relocation-model=pic");
+   link_arg_f("-filetype=obj");
+   link_arg_f("-o");
+   link_output(top, "o");
    link_output(top, "bc");
 
    link_exec();
@@ -177,6 +299,8 @@ static void link_assembly(tree_t top)
    link_args_end();
 }
 
+#endif  // LINK_EMIT_OBJECT
+
 static void link_shared(tree_t top)
 {
    link_args_begin();
@@ -196,7 +320,7 @@ static void link_shared(tree_t top)
 #else
    link_output(top, "so");
 #endif
-   link_output(top, "s");
+   link_output(top, "o");
 
    link_exec();
 
@@ -205,59 +329,40 @@ static void link_shared(tree_t top)
 
 static void link_native(tree_t top)
 {
-   link_assembly(top);
+   link_object(top);
    link_shared(top);
+
+   char path[PATH_MAX];
+   link_output_path(top, "o", path, sizeof(path));
+   if (unlink(path) < 0)
+      fatal_errno("unlink");
 }
 
 void link_bc(tree_t top)
 {
-   link_args_begin();
-
-   link_arg_f("%s/llvm-link", LLVM_CONFIG_BINDIR);
-
-   bool opt_en = opt_get_int("optimise");
-
-   char tmp[128];
-   snprintf(tmp, sizeof(tmp), "%s/%sXXXXXX", P_tmpdir,
-            istr(ident_runtil(tree_ident(top), '.')));
+   // Link and optimise in this process so the bitcode for each unit
+   // is only parsed once and no temporary files are needed
 
-   link_arg_f("-o");
-   if (opt_en) {
-      int fd;
-      if ((fd = mkstemp(tmp)) < 0)
-         fatal_errno("mkstemp");
-      else
-         close(fd);
-      link_arg_f("%s", tmp);
-   }
-   else
-      link_output(top, "bc");
-
-   link_arg_bc(lib_work(), tree_ident(top));
+   n_linked = 0;
+   module = NULL;
 
+   link_module(lib_work(), tree_ident(top));
    link_all_context(top);
 
-   link_exec();
-   link_args_end();
-
-   if (opt_en) {
-      link_args_begin();
+   if (opt_get_int("optimise"))
+      link_optimise();
 
-      link_arg_f("%s/opt", LLVM_CONFIG_BINDIR);
-      link_arg_f("-O2");
-      link_arg_f("-o");
-      link_output(top, "bc");
-      link_arg_f("%s", tmp);
+   char path[PATH_MAX];
+   link_output_path(top, "bc", path, sizeof(path));
 
-      link_exec();
-      link_args_end();
-
-      if (unlink(tmp) < 0)
-         fatal_errno("unlink");
-   }
+   if (LLVMWriteBitcodeToFile(module, path) != 0)
+      fatal("failed to write %s", path);
 
    if (opt_get_int("native"))
       link_native(top);
+
+   LLVMDisposeModule(module);
+   module = NULL;
 }
 
 bool pack_needs_cgen(tree_t t)
@@ -18,6 +18,8 @@
 #include "util.h"
 #include "parse.h"
 #include "phase.h"
+#include "common.h"
+#include "hash.h"
 #include "rt/rt.h"
 #include "rt/slave.h"
 
@@ -27,6 +29,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #if defined HAVE_TCL_TCL_H
 #include <tcl/tcl.h>
 #elif defined HAVE_TCL_H
@@ -66,55 +71,83 @@ static ident_t to_unit_name(const char *str)
    return i;
 }
 
-static int analyse(int argc, char **argv)
+static void set_codec(const char *str)
 {
-   set_work_lib();
+   if (strcmp(str, "none") == 0)
+      fbuf_set_codec(FBUF_CODEC_NONE);
+   else if (strcmp(str, "zlib") == 0)
+      fbuf_set_codec(FBUF_CODEC_ZLIB);
+   else if (strcmp(str, "lz") == 0)
+      fbuf_set_codec(FBUF_CODEC_LZ);
+   else
+      fatal("invalid codec %s (expected none, zlib, or lz)", str);
+}
 
-   static struct option long_options[] = {
-      {"bootstrap", no_argument, 0, 'b'},
-      {"dump-llvm", no_argument, 0, 'd'},
-      {0, 0, 0, 0}
-   };
+// Source files analysed in a separate process
+struct analysis_job {
+   tree_t     *units;
+   int         n_units;
+   int        *deps;
+   int         n_deps;
+   pid_t       pid;
+   bool        done;
+};
 
-   int c, index = 0;
-   const char *spec = "";
-   optind = 1;
-   while ((c = getopt_long(argc, argv, spec, long_options, &index)) != -1) {
-      switch (c) {
-      case 0:
-         // Set a flag
-         break;
-      case '?':
-         // getopt_long already printed an error message
-         exit(EXIT_FAILURE);
-      case 'b':
-         opt_set_int("bootstrap", 1);
-         break;
-      case 'd':
-         opt_set_int("dump-llvm", 1);
-         break;
-      default:
-         abort();
+static uint64_t source_hash(const char *file)
+{
+   // FNV-1a hash of the file contents
+   FILE *f = fopen(file, "r");
+   if (f == NULL)
+      return 0;
+
+   uint64_t hash = UINT64_C(14695981039346656037);
+   uint8_t buf[8192];
+   size_t nr;
+   while ((nr = fread(buf, 1, sizeof(buf), f)) > 0) {
+      for (size_t i = 0; i < nr; i++) {
+         hash ^= buf[i];
+         hash *= UINT64_C(1099511628211);
       }
    }
 
-   size_t unit_list_sz = 32;
-   tree_t *units = xmalloc(sizeof(tree_t) * unit_list_sz);
-   int n_units = 0;
+   fclose(f);
+   return hash;
+}
 
-   for (int i = optind; i < argc; i++) {
-      input_from_file(argv[i]);
+static void record_dep(ident_t dep, void *context)
+{
+   lib_add_dep(lib_work(), context, dep);
+}
 
-      tree_t unit;
-      while ((unit = parse()) && sem_check(unit)) {
-         if (n_units == unit_list_sz) {
-            unit_list_sz *= 2;
-            units = xrealloc(units, sizeof(tree_t) * unit_list_sz);
-         }
-         units[n_units++] = unit;
+static void record_sources(tree_t *units, int n_units)
+{
+   // Remember where each unit came from so --make can tell when it
+   // needs to be analysed again: the absolute path is stored as --make
+   // may be run from a different directory
+   const char *last = NULL;
+   ident_t source = NULL;
+   uint64_t hash = 0;
+   for (int i = 0; i < n_units; i++) {
+      const char *file = tree_loc(units[i])->file;
+      if (file == NULL)
+         continue;
+      else if ((last == NULL) || (strcmp(file, last) != 0)) {
+         char *abs = realpath(file, NULL);
+         source = ident_new((abs != NULL) ? abs : file);
+         free(abs);
+
+         hash = source_hash(istr(source));
+         last = file;
       }
+
+      ident_t name = tree_ident(units[i]);
+      lib_set_source(lib_work(), name, source, hash);
+      unit_deps(units[i], record_dep, name);
    }
+}
 
+static int analyse_units(tree_t *units, int n_units, bool archive)
+{
    for (int i = 0; i < n_units; i++) {
       unalias(units[i]);
       simplify(units[i]);
@@ -123,8 +156,13 @@ static int analyse(int argc, char **argv)
    if (parse_errors() + sem_errors() + simplify_errors() > 0)
       return EXIT_FAILURE;
 
+   record_sources(units, n_units);
+
    lib_save(lib_work());
 
+   if (archive)
+      lib_pack(lib_work());
+
    for (int i = 0; i < n_units; i++) {
       tree_kind_t kind = tree_kind(units[i]);
       const bool need_cgen =
@@ -135,9 +173,226 @@ static int analyse(int argc, char **argv)
          cgen(units[i]);
    }
 
+   return EXIT_SUCCESS;
+}
+
+static int analyse_serial(int nfiles, char **files, bool archive)
+{
+   size_t unit_list_sz = 32;
+   tree_t *units = xmalloc(sizeof(tree_t) * unit_list_sz);
+   int n_units = 0;
+
+   for (int i = 0; i < nfiles; i++) {
+      input_from_file(files[i]);
+
+      tree_t unit;
+      while ((unit = parse()) && sem_check(unit)) {
+         if (n_units == unit_list_sz) {
+            unit_list_sz *= 2;
+            units = xrealloc(units, sizeof(tree_t) * unit_list_sz);
+         }
+         units[n_units++] = unit;
+      }
+   }
+
+   const int status = analyse_units(units, n_units, archive);
    free(units);
+   return status;
+}
 
-   return EXIT_SUCCESS;
+struct job_deps_ctx {
+   struct analysis_job *jobs;
+   int                  this;
+   hash_t              *defined;
+};
+
+static void job_add_dep(ident_t name, void *context)
+{
+   struct job_deps_ctx *ctx = context;
+   struct analysis_job *job = &(ctx->jobs[ctx->this]);
+
+   // Only the latest earlier file defining the unit matters as that
+   // file in turn waits for any earlier definition
+   const int dep = (uintptr_t)hash_get(ctx->defined, name) - 1;
+   if ((dep < 0) || (dep == ctx->this))
+      return;
+
+   for (int i = 0; i < job->n_deps; i++) {
+      if (job->deps[i] == dep)
+         return;
+   }
+
+   job->deps = xrealloc(job->deps, sizeof(int) * (job->n_deps + 1));
+   job->deps[job->n_deps++] = dep;
+}
+
+static bool job_ready(struct analysis_job *jobs, int n)
+{
+   for (int i = 0; i < jobs[n].n_deps; i++) {
+      if (!jobs[jobs[n].deps[i]].done)
+         return false;
+   }
+
+   return true;
+}
+
+static int analyse_parallel(int nfiles, char **files, bool archive,
+                            int max_jobs)
+{
+   // The parser and semantic checker are not reentrant so each file is
+   // checked in a child process once all the files that define units
+   // it depends on have been saved to the work library
+
+   struct analysis_job *jobs = xmalloc(sizeof(struct analysis_job) * nfiles);
+   hash_t *defined = hash_new(64, true);
+
+   for (int i = 0; i < nfiles; i++) {
+      struct analysis_job *job = &(jobs[i]);
+      job->units   = NULL;
+      job->n_units = 0;
+      job->deps    = NULL;
+      job->n_deps  = 0;
+      job->pid     = 0;
+      job->done    = false;
+
+      input_from_file(files[i]);
+
+      tree_t unit;
+      while ((unit = parse())) {
+         job->units = xrealloc(job->units,
+                               sizeof(tree_t) * (job->n_units + 1));
+         job->units[job->n_units++] = unit;
+      }
+
+      struct job_deps_ctx ctx = { jobs, i, defined };
+      for (int j = 0; j < job->n_units; j++) {
+         unit_deps(job->units[j], job_add_dep, &ctx);
+
+         // Redefining a unit must not race with the earlier definition
+         job_add_dep(unit_qual_name(job->units[j]), &ctx);
+      }
+
+      for (int j = 0; j < job->n_units; j++)
+         hash_put(defined, unit_qual_name(job->units[j]),
+                  (void *)(uintptr_t)(i + 1));
+   }
+
+   hash_free(defined);
+
+   if (parse_errors() > 0)
+      return EXIT_FAILURE;
+
+   int running = 0, next = 0;
+   bool failed = false;
+   for (;;) {
+      for (int i = next; !failed && (i < nfiles) && (running < max_jobs);
+           i++) {
+         if ((jobs[i].pid != 0) || !job_ready(jobs, i))
+            continue;
+
+         fflush(stdout);
+         fflush(stderr);
+
+         pid_t pid = fork();
+         if (pid < 0)
+            fatal_errno("fork");
+         else if (pid == 0) {
+            int n_checked = 0;
+            while ((n_checked < jobs[i].n_units)
+                   && sem_check(jobs[i].units[n_checked]))
+               n_checked++;
+
+            exit(analyse_units(jobs[i].units, n_checked, archive));
+         }
+
+         jobs[i].pid = pid;
+         running++;
+      }
+
+      if (running == 0)
+         break;
+
+      int status;
+      pid_t pid = waitpid(-1, &status, 0);
+      if (pid < 0)
+         fatal_errno("waitpid");
+
+      for (int i = 0; i < nfiles; i++) {
+         if (jobs[i].pid == pid) {
+            jobs[i].done = true;
+            running--;
+
+            if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+               failed = true;
+            break;
+         }
+      }
+
+      while ((next < nfiles) && jobs[next].done)
+         next++;
+   }
+
+   for (int i = 0; i < nfiles; i++) {
+      free(jobs[i].units);
+      free(jobs[i].deps);
+   }
+   free(jobs);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int analyse(int argc, char **argv)
+{
+   set_work_lib();
+
+   static struct option long_options[] = {
+      {"bootstrap", no_argument, 0, 'b'},
+      {"dump-llvm", no_argument, 0, 'd'},
+      {"codec", required_argument, 0, 'C'},
+      {"archive", no_argument, 0, 'A'},
+      {"jobs", required_argument, 0, 'j'},
+      {0, 0, 0, 0}
+   };
+
+   bool archive = false;
+   int jobs = 1;
+   int c, index = 0;
+   const char *spec = "j:";
+   optind = 1;
+   while ((c = getopt_long(argc, argv, spec, long_options, &index)) != -1) {
+      switch (c) {
+      case 0:
+         // Set a flag
+         break;
+      case '?':
+         // getopt_long already printed an error message
+         exit(EXIT_FAILURE);
+      case 'A':
+         archive = true;
+         break;
+      case 'b':
+         opt_set_int("bootstrap", 1);
+         break;
+      case 'd':
+         opt_set_int("dump-llvm", 1);
+         break;
+      case 'C':
+         set_codec(optarg);
+         break;
+      case 'j':
+         if ((jobs = atoi(optarg)) < 1)
+            fatal("invalid number of jobs %s", optarg);
+         break;
+      default:
+         abort();
+      }
+   }
+
+   const int nfiles = argc - optind;
+   if ((jobs > 1) && (nfiles > 1))
+      return analyse_parallel(nfiles, argv + optind, archive, jobs);
+   else
+      return analyse_serial(nfiles, argv + optind, archive);
 }
 
 static int elaborate(int argc, char **argv)
@@ -149,6 +404,7 @@ static int elaborate(int argc, char **argv)
       {"dump-llvm", no_argument, 0, 'd'},
       {"native", no_argument, 0, 'n'},
       {"cover", no_argument, 0, 'c'},
+      {"codec", required_argument, 0, 'C'},
       {0, 0, 0, 0}
    };
 
@@ -169,6 +425,9 @@ static int elaborate(int argc, char **argv)
       case 'c':
          opt_set_int("cover", 1);
          break;
+      case 'C':
+         set_codec(optarg);
+         break;
       case 0:
          // Set a flag
          break;
@@ -227,18 +486,173 @@ static uint64_t parse_time(const char *str)
    return base * mult;
 }
 
+struct make_ctx {
+   hash_t   *visited;
+   hash_t   *secondary;
+   hash_t   *stale;
+   ident_t  *order;
+   int       n_order;
+   bool      dep_stale;
+};
+
+static void make_add_secondary(ident_t name, int kind, void *context)
+{
+   struct make_ctx *ctx = context;
+
+   // Architectures and package bodies are not referenced by name but
+   // are needed whenever their primary unit is
+   if ((kind == T_ARCH) || (kind == T_PACK_BODY))
+      hash_put(ctx->secondary, ident_runtil(name, '-'), name);
+}
+
+static void make_visit(ident_t name, void *context)
+{
+   struct make_ctx *ctx = context;
+
+   if (hash_get(ctx->visited, name) != NULL)
+      return;
+   hash_put(ctx->visited, name, name);
+
+   // Units in other libraries are never rebuilt
+   if (lib_index_mtime(lib_work(), name) == 0)
+      return;
+
+   lib_walk_deps(lib_work(), name, make_visit, ctx);
+
+   ctx->order = xrealloc(ctx->order, sizeof(ident_t) * (ctx->n_order + 1));
+   ctx->order[ctx->n_order++] = name;
+
+   ident_t secondary;
+   for (int n = 0; ; n++) {
+      int nth = n;
+      if ((secondary = hash_get_nth(ctx->secondary, name, &nth)) == NULL)
+         break;
+      make_visit(secondary, ctx);
+   }
+}
+
+static void make_check_dep(ident_t dep, void *context)
+{
+   struct make_ctx *ctx = context;
+   if (hash_get(ctx->stale, dep) != NULL)
+      ctx->dep_stale = true;
+}
+
+static int make(int argc, char **argv)
+{
+   // Analyse again only the units under the top level whose source has
+   // changed or which depend on such a unit, then elaborate if anything
+   // the top level depends on is newer than the last elaboration
+
+   set_work_lib();
+
+   if (argc < 2)
+      fatal("missing top-level unit name");
+
+   lib_t work = lib_work();
+   ident_t top = to_unit_name(argv[argc - 1]);
+
+   if (lib_index_mtime(work, top) == 0)
+      fatal("cannot find unit %s in library %s",
+            istr(top), istr(lib_name(work)));
+
+   struct make_ctx ctx = {
+      .visited   = hash_new(256, true),
+      .secondary = hash_new(256, false),
+      .stale     = hash_new(256, true),
+      .order     = NULL,
+      .n_order   = 0
+   };
+
+   lib_walk_index(work, make_add_secondary, &ctx);
+   make_visit(top, &ctx);
+
+   // The visit order puts each unit after those it depends on so
+   // staleness propagates forward in a single pass
+   const char **files = NULL;
+   int n_files = 0;
+   lib_mtime_t newest = 0;
+   for (int i = 0; i < ctx.n_order; i++) {
+      ident_t name = ctx.order[i];
+      newest = MAX(newest, lib_index_mtime(work, name));
+
+      uint64_t hash;
+      ident_t source = lib_source(work, name, &hash);
+      if (source == NULL)
+         continue;
+
+      ctx.dep_stale = false;
+      lib_walk_deps(work, name, make_check_dep, &ctx);
+
+      if (!ctx.dep_stale && (source_hash(istr(source)) == hash))
+         continue;
+
+      hash_put(ctx.stale, name, name);
+
+      bool have_file = false;
+      for (int j = 0; j < n_files && !have_file; j++)
+         have_file = (strcmp(files[j], istr(source)) == 0);
+
+      if (!have_file) {
+         files = xrealloc(files, sizeof(char *) * (n_files + 1));
+         files[n_files++] = istr(source);
+      }
+   }
+
+   hash_free(ctx.visited);
+   hash_free(ctx.secondary);
+   hash_free(ctx.stale);
+   free(ctx.order);
+
+   if (n_files > 0) {
+      const int status = analyse_serial(n_files, (char **)files, false);
+      free(files);
+      if (status != EXIT_SUCCESS)
+         return status;
+   }
+   else {
+      char name[PATH_MAX], final[PATH_MAX];
+      snprintf(name, sizeof(name), "_%s.final.bc", istr(top));
+      lib_realpath(work, name, final, sizeof(final));
+
+      ident_t elab_i = ident_prefix(top, ident_new("elab"), '.');
+      const lib_mtime_t elab_mtime = lib_index_mtime(work, elab_i);
+
+      if ((elab_mtime >= newest) && (access(final, F_OK) == 0)) {
+         notef("%s is up to date", istr(top));
+         return EXIT_SUCCESS;
+      }
+   }
+
+   return elaborate(argc, argv);
+}
+
 static int run(int argc, char **argv)
 {
    set_work_lib();
 
    static struct option long_options[] = {
-      { "trace",     no_argument,       0, 't' },
-      { "batch",     no_argument,       0, 'b' },
-      { "command",   no_argument,       0, 'c' },
-      { "stop-time", required_argument, 0, 's' },
-      { "vcd",       required_argument, 0, 'v' },
-      { "stats",     no_argument,       0, 'S' },
-      { "wave",      optional_argument, 0, 'w' },
+      { "trace",           no_argument,       0, 't' },
+      { "batch",           no_argument,       0, 'b' },
+      { "command",         no_argument,       0, 'c' },
+      { "stop-time",       required_argument, 0, 's' },
+      { "vcd",             required_argument, 0, 'v' },
+      { "stats",           no_argument,       0, 'S' },
+      { "wave",            optional_argument, 0, 'w' },
+      { "eventq",          required_argument, 0, 'q' },
+      { "threads",         required_argument, 0, 'j' },
+      { "packed",          no_argument,       0, 'P' },
+      { "profile",         optional_argument, 0, 'p' },
+      { "progress",        required_argument, 0, 'g' },
+      { "checkpoint-at",   required_argument, 0, 'A' },
+      { "checkpoint-file", required_argument, 0, 'K' },
+      { "restore",         required_argument, 0, 'R' },
+      { "wave-sync",       no_argument,       0, 'W' },
+      { "wave-include",    required_argument, 0, 'I' },
+      { "wave-exclude",    required_argument, 0, 'X' },
+      { "wave-depth",      required_argument, 0, 'D' },
+      { "wave-start",      required_argument, 0, 'T' },
+      { "wave-stop",       required_argument, 0, 'E' },
       { 0, 0, 0, 0 }
    };
 
@@ -247,6 +661,12 @@ static int run(int argc, char **argv)
    uint64_t stop_time = UINT64_MAX;
    const char *vcd_fname = NULL;
    const char *lxt_fname = NULL;
+   const char *prof_fname = NULL;
+   const char *ckpt_fname = NULL;
+   uint64_t ckpt_time = UINT64_MAX;
+   uint64_t wave_start = 0;
+   uint64_t wave_stop = UINT64_MAX;
+   bool profile = false;
 
    int c, index = 0;
    const char *spec = "bcw::";
@@ -283,6 +703,54 @@ static int run(int argc, char **argv)
          else
             lxt_fname = optarg;
          break;
+      case 'j':
+         opt_set_int("rt-threads", atoi(optarg));
+         break;
+      case 'P':
+         opt_set_int("rt-packed", 1);
+         break;
+      case 'g':
+         opt_set_int("rt-progress", atoi(optarg));
+         break;
+      case 'A':
+         ckpt_time = parse_time(optarg);
+         break;
+      case 'K':
+         ckpt_fname = optarg;
+         break;
+      case 'R':
+         rt_restore_init(optarg);
+         break;
+      case 'W':
+         opt_set_int("rt-wave-async", 0);
+         break;
+      case 'I':
+         wave_include_glob(optarg);
+         break;
+      case 'X':
+         wave_exclude_glob(optarg);
+         break;
+      case 'D':
+         opt_set_int("wave-depth", atoi(optarg));
+         break;
+      case 'T':
+         wave_start = parse_time(optarg);
+         break;
+      case 'E':
+         wave_stop = parse_time(optarg);
+         break;
+      case 'p':
+         profile = true;
+         prof_fname = optarg;
+         break;
+      case 'q':
+         if (strcmp(optarg, "wheel") == 0)
+            opt_set_int("rt-wheel", 1);
+         else if (strcmp(optarg, "heap") == 0)
+            opt_set_int("rt-wheel", 0);
+         else
+            fatal("invalid event queue %s", optarg);
+         break;
       default:
          abort();
       }
@@ -291,6 +759,11 @@ static int run(int argc, char **argv)
    if (optind == argc)
       fatal("missing top-level unit name");
 
+   // Snapshots in the shell fork the simulation which would lose the
+   // waveform writer thread
+   if (mode == COMMAND)
+      opt_set_int("rt-wave-async", 0);
+
    ident_t top = to_unit_name(argv[optind]);
    ident_t ename = ident_prefix(top, ident_new("elab"), '.');
    tree_rd_ctx_t ctx;
@@ -300,6 +773,10 @@ static int run(int argc, char **argv)
    else if (tree_kind(e) != T_ELAB)
       fatal("%s not suitable top level", istr(top));
 
+   if (wave_stop <= wave_start)
+      fatal("--wave-stop must be later than --wave-start");
+   rt_wave_window(wave_start, wave_stop);
+
    if (vcd_fname != NULL)
       vcd_init(vcd_fname, e);
 
@@ -310,8 +787,27 @@ static int run(int argc, char **argv)
          lxt_fname = tmp;
          notef("writing LXT waveform data to %s", lxt_fname);
       }
-      lxt_init(lxt_fname, e);
+
+      const char *ext = strrchr(lxt_fname, '.');
+      if ((ext != NULL) && (strcmp(ext, ".fst") == 0))
+         fst_init(lxt_fname, e);
+      else
+         lxt_init(lxt_fname, e);
+   }
+
+   if (profile)
+      rt_profile_init(prof_fname);
+
+   if (ckpt_time != UINT64_MAX) {
+      static char tmp[128];
+      if (ckpt_fname == NULL) {
+         snprintf(tmp, sizeof(tmp), "%s.ckpt", argv[optind]);
+         ckpt_fname = tmp;
+      }
+      rt_checkpoint_init(ckpt_time, ckpt_fname);
    }
+   else if (ckpt_fname != NULL)
+      fatal("--checkpoint-file requires --checkpoint-at");
 
    if (mode == BATCH)
       rt_batch_exec(e, stop_time, ctx);
@@ -386,6 +882,12 @@ static int dump_cmd(int argc, char **argv)
 static void set_default_opts(void)
 {
    opt_set_int("rt-stats", 0);
+   opt_set_int("rt-wheel", 1);
+   opt_set_int("rt-threads", 1);
+   opt_set_int("rt-packed", 0);
+   opt_set_int("rt-progress", 0);
+   opt_set_int("rt-wave-async", 1);
+   opt_set_int("wave-depth", 0);
    opt_set_int("rt_trace_en", 0);
    opt_set_int("dump-llvm", 0);
    opt_set_int("optimise", 1);
@@ -402,6 +904,7 @@ static void usage(void)
           " -a [OPTION]... FILE...\tAnalyse FILEs into work library\n"
           " -e UNIT\t\tElaborate and generate code for UNIT\n"
           " -r UNIT\t\tExecute previously elaborated UNIT\n"
+          " --make [OPTION]... UNIT\tAnalyse changed files and elaborate UNIT\n"
           " --dump UNIT\t\tPrint out previously analysed UNIT\n"
           "\n"
           "Global options may be placed before COMMAND:\n"
@@ -410,9 +913,13 @@ static void usage(void)
           "     --work=NAME\tUse NAME as the work library\n"
           "\n"
           "Analyse options:\n"
+          "     --archive\t\tPack the work library into a single file\n"
           "     --bootstrap\tAllow compilation of STANDARD package\n"
+          "     --codec=C\t\tCompress library files with C (none, zlib, lz)\n"
+          " -j, --jobs=N\t\tAnalyse up to N files in parallel\n"
           "\n"
           "Elaborate options:\n"
+          "     --codec=C\t\tCompress library files with C (none, zlib, lz)\n"
           "     --cover\t\tEnable code coverage reporting\n"
           "     --disable-opt\tDisable LLVM optimisations\n"
           "     --dump-llvm\tPrint generated LLVM IR\n"
@@ -421,11 +928,25 @@ static void usage(void)
           "Run options:\n"
           " -b, --batch\t\tRun in batch mode (default)\n"
           " -c, --command\t\tRun in TCL command line mode\n"
+          "     --checkpoint-at=T\tSave simulation state at time T\n"
+          "     --checkpoint-file=FILE\tWrite checkpoint to FILE\n"
+          "     --eventq=Q\t\tUse event queue Q (wheel or heap)\n"
+          "     --packed\t\tStore BIT and STD_LOGIC signals packed\n"
+          "     --profile[=FILE]\tReport time spent in each process\n"
+          "     --progress=SECS\tPrint progress every SECS seconds\n"
+          "     --restore=FILE\tStart from checkpoint in FILE\n"
           "     --stats\t\tPrint statistics at end of run\n"
           "     --stop-time=T\tStop after simulation time T (e.g. 5ns)\n"
+          "     --threads=N\tRun processes on N threads\n"
           "     --trace\t\tTrace simulation events\n"
           "     --vcd=FILE\t\tWrite VCD data to FILE\n"
-          " -w, --wave=FILE\tWrite waveform data in LXT format\n"
+          " -w, --wave=FILE\tWrite waveform data in LXT or FST format\n"
+          "     --wave-depth=N\tOnly dump signals N levels below the top\n"
+          "     --wave-exclude=GLOB\tDo not dump signals matching GLOB\n"
+          "     --wave-include=GLOB\tOnly dump signals matching GLOB\n"
+          "     --wave-start=T\tStart dumping at time T\n"
+          "     --wave-stop=T\tStop dumping at time T\n"
+          "     --wave-sync\tWrite waveform data on the simulation thread\n"
           "\n"
           "Dump options:\n"
           " -e, --elab\t\tDump an elaborated unit\n"
@@ -453,6 +974,7 @@ int main(int argc, char **argv)
       {"version", no_argument,       0, 'v'},
       {"work",    required_argument, 0, 'w'},
       {"dump",    no_argument,       0, 'd'},
+      {"make",    no_argument,       0, 'm'},
       {0, 0, 0, 0}
    };
 
@@ -475,6 +997,7 @@ int main(int argc, char **argv)
       case 'a':
       case 'e':
       case 'd':
+      case 'm':
       case 'r':
          // Subcommand options are parsed later
          argc -= (optind - 1);
@@ -496,6 +1019,8 @@ int main(int argc, char **argv)
       return elaborate(argc, argv);
    case 'r':
       return run(argc, argv);
+   case 'm':
+      return make(argc, argv);
    case 'd':
       return dump_cmd(argc, argv);
    default:
@@ -32,6 +32,7 @@ typedef struct {
 
 typedef struct {
    tree_t            *cache;
+   uint32_t          cache_sz;
    uint32_t          index;
    uint32_t          generation;
    tree_rewrite_fn_t fn;
@@ -47,6 +48,15 @@ typedef struct {
    bool             deep;
 } object_visit_ctx_t;
 
+// Serialised objects start with one of these markers or the object
+// kind plus MARKER_KIND
+#define MARKER_NULL    0
+#define MARKER_BACKREF 1
+#define MARKER_KIND    2
+
+// Increment when the encoding changes but the object layout does not
+#define FORMAT_VERSION 3
+
 typedef struct type_wr_ctx *type_wr_ctx_t;
 typedef struct type_rd_ctx *type_rd_ctx_t;
 
@@ -65,10 +75,13 @@ type_wr_ctx_t type_write_begin(struct tree_wr_ctx *tree_ctx,
                                ident_wr_ctx_t ident_ctx);
 void type_write(type_t t, type_wr_ctx_t ctx);
 void type_write_end(type_wr_ctx_t ctx);
+unsigned type_write_segment(type_wr_ctx_t ctx, unsigned generation);
 
 type_rd_ctx_t type_read_begin(struct tree_rd_ctx *tree_ctx,
                               ident_rd_ctx_t ident_ctx);
 type_t type_read(type_rd_ctx_t ctx);
+unsigned type_read_skip(type_rd_ctx_t ctx, unsigned count);
+unsigned type_read_seek(type_rd_ctx_t ctx, unsigned index);
 void type_read_end(type_rd_ctx_t ctx);
 
 tree_t tree_rewrite_aux(tree_t t, object_rewrite_ctx_t *ctx);
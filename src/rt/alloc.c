@@ -19,23 +19,93 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Profiling shows a large proportion of simulation time is spent in
 // malloc and free. These routines provide a stack-based fixed-size
-// allocator that is faster and has better cache locality.
+// allocator that is faster and has better cache locality. Items are
+// carved out of contiguous chunks so objects allocated together are
+// adjacent in memory.
 
 #define INIT_ITEMS 128
+#define CACHE_LINE 64
+
+#define SLAB_CHUNK_SZ   (64 * 1024)
+#define SLAB_MIN_ITEMS  16
+#define SLAB_ALIGN      8
+#define SLAB_HASH_SZ    64
+
+struct rt_alloc_chunk {
+   struct rt_alloc_chunk *next;
+   void                  *mem;
+};
+
+struct rt_slab_chunk {
+   struct rt_slab_chunk *next;
+   uint64_t              data[0];
+};
+
+static rt_slab_t       slab_hash[SLAB_HASH_SZ];
+static rt_slab_stats_t slab_stats;
+
+static size_t rt_alloc_item_size(size_t size)
+{
+   // Small items are padded to a power of two so that none of them
+   // straddle a cache line and larger items are padded to a whole
+   // number of cache lines
+
+   if (size > CACHE_LINE)
+      return (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+
+   size_t item_sz = sizeof(void *);
+   while (item_sz < size)
+      item_sz *= 2;
+   return item_sz;
+}
+
+static void rt_alloc_refill(rt_alloc_stack_t s, size_t nitems)
+{
+   // Allocate nitems contiguous items in a single cache line aligned
+   // chunk and push them so that the lowest address is popped first
+
+   assert(s->stack_top == 0);
+
+   void *mem;
+   if (posix_memalign(&mem, CACHE_LINE, nitems * s->item_sz) != 0)
+      fatal("memory exhausted (posix_memalign %zu)", nitems * s->item_sz);
+
+   struct rt_alloc_chunk *c = xmalloc(sizeof(struct rt_alloc_chunk));
+   c->next = s->chunks;
+   c->mem  = mem;
+   s->chunks = c;
+
+   s->stack_sz += nitems;
+   s->stack = xrealloc(s->stack, sizeof(void *) * s->stack_sz);
+
+   for (size_t i = 0; i < nitems; i++)
+      s->stack[i] = (char *)mem + ((nitems - i - 1) * s->item_sz);
+   s->stack_top = nitems;
+
+   s->chunk_items = nitems;
+   ++(s->refills);
+}
 
 rt_alloc_stack_t rt_alloc_stack_new(size_t size)
 {
    struct rt_alloc_stack *s = xmalloc(sizeof(struct rt_alloc_stack));
-   s->stack     = xmalloc(sizeof(void *) * INIT_ITEMS);
-   s->stack_sz  = INIT_ITEMS;
-   s->stack_top = 0;
-   s->item_sz   = size;
+   s->stack       = NULL;
+   s->stack_sz    = 0;
+   s->stack_top   = 0;
+   s->item_sz     = rt_alloc_item_size(size);
+   s->chunk_items = 0;
+   s->high_water  = 0;
+   s->refills     = 0;
+   s->chunks      = NULL;
 
-   for (int i = 0; i < INIT_ITEMS; i++)
-      rt_free(s, xmalloc(size));
+   if (pthread_mutex_init(&(s->lock), NULL) != 0)
+      fatal_errno("pthread_mutex_init");
+
+   rt_alloc_refill(s, INIT_ITEMS);
 
    return s;
 }
@@ -46,8 +116,14 @@ void rt_alloc_stack_destroy(rt_alloc_stack_t s)
       fatal("memory leak of %zu items from %zu byte stack",
             s->stack_sz - s->stack_top, s->item_sz);
 
-   for (size_t i = 0; i < s->stack_sz; i++)
-      free(s->stack[i]);
+   while (s->chunks != NULL) {
+      struct rt_alloc_chunk *next = s->chunks->next;
+      free(s->chunks->mem);
+      free(s->chunks);
+      s->chunks = next;
+   }
+
+   pthread_mutex_destroy(&(s->lock));
 
    free(s->stack);
    free(s);
@@ -55,14 +131,151 @@ void rt_alloc_stack_destroy(rt_alloc_stack_t s)
 
 void *rt_alloc_slow(rt_alloc_stack_t s)
 {
-   if (s->stack_top == 0) {
-      s->stack_sz *= 2;
-      s->stack = xrealloc(s->stack, sizeof(void *) * s->stack_sz);
+   // Each chunk doubles the total number of items
+   if (s->stack_top == 0)
+      rt_alloc_refill(s, s->stack_sz);
+
+   return rt_alloc(s);
+}
+
+void rt_alloc_stats(rt_alloc_stack_t s, rt_alloc_stats_t *stats)
+{
+   stats->item_sz    = s->item_sz;
+   stats->high_water = s->high_water;
+   stats->refills    = s->refills;
+   stats->bytes      = s->stack_sz * s->item_sz;
+}
+
+// A magazine caches a small number of items from a shared stack for the
+// exclusive use of one thread. Items are exchanged with the stack half a
+// magazine at a time with the stack lock held.
+
+void rt_magazine_init(rt_magazine_t *m, rt_alloc_stack_t depot)
+{
+   m->depot = depot;
+   m->count = 0;
+}
+
+void rt_magazine_flush(rt_magazine_t *m, size_t keep)
+{
+   rt_alloc_stack_t s = m->depot;
+
+   pthread_mutex_lock(&(s->lock));
+
+   while (m->count > keep)
+      rt_free(s, m->items[--m->count]);
+
+   pthread_mutex_unlock(&(s->lock));
+}
+
+void *rt_magazine_refill(rt_magazine_t *m)
+{
+   rt_alloc_stack_t s = m->depot;
+
+   pthread_mutex_lock(&(s->lock));
+
+   assert(m->count == 0);
+   while (m->count < RT_MAGAZINE_SZ / 2)
+      m->items[m->count++] = rt_alloc(s);
+
+   pthread_mutex_unlock(&(s->lock));
+
+   return m->items[--m->count];
+}
+
+// Variable sized objects such as signal values are allocated from slabs
+// shared by every user of the same size class. Each slab carves fixed
+// size items out of large chunks and keeps freed items on an intrusive
+// list so memory is only returned when the simulation is torn down.
+
+rt_slab_t rt_slab_get(size_t size)
+{
+   const size_t rounded = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+   const size_t item_sz = MAX(rounded, sizeof(struct rt_slab_item));
+
+   const int bucket = (item_sz / SLAB_ALIGN) % SLAB_HASH_SZ;
+   for (rt_slab_t it = slab_hash[bucket]; it != NULL; it = it->next) {
+      if (it->item_sz == item_sz)
+         return it;
+   }
+
+   struct rt_slab *s = xmalloc(sizeof(struct rt_slab));
+   s->free_list   = NULL;
+   s->chunks      = NULL;
+   s->item_sz     = item_sz;
+   s->chunk_items = MAX(SLAB_CHUNK_SZ / item_sz, SLAB_MIN_ITEMS);
+   s->live        = 0;
+   s->peak        = 0;
+   s->next        = slab_hash[bucket];
+
+   slab_hash[bucket] = s;
+   ++(slab_stats.classes);
+
+   return s;
+}
+
+void *rt_slab_alloc_slow(rt_slab_t s)
+{
+   const size_t bytes = s->chunk_items * s->item_sz;
+
+   struct rt_slab_chunk *c = xmalloc(sizeof(struct rt_slab_chunk) + bytes);
+   c->next = s->chunks;
+   s->chunks = c;
 
-      for (size_t i = 0; i < s->stack_sz / 2; i++)
-         rt_free(s, xmalloc(s->item_sz));
+   // Thread the new items onto the free list in address order
+   char *base = (char *)c->data;
+   for (size_t i = 0; i < s->chunk_items; i++) {
+      struct rt_slab_item *item = (struct rt_slab_item *)(base + i * s->item_sz);
+      item->next = (i + 1 < s->chunk_items)
+         ? (struct rt_slab_item *)(base + (i + 1) * s->item_sz)
+         : s->free_list;
    }
+   s->free_list = (struct rt_slab_item *)base;
+
+   ++(slab_stats.chunks);
+   slab_stats.reserved_bytes += bytes;
+
+   return rt_slab_alloc(s);
+}
+
+static size_t rt_slab_peak_bytes(void)
+{
+   // Sum of the high-water mark of each size class
+   size_t sum = 0;
+   for (int i = 0; i < SLAB_HASH_SZ; i++) {
+      for (rt_slab_t it = slab_hash[i]; it != NULL; it = it->next)
+         sum += it->peak * it->item_sz;
+   }
+
+   return MAX(sum, slab_stats.peak_bytes);
+}
+
+void rt_slab_destroy_all(void)
+{
+   slab_stats.peak_bytes = rt_slab_peak_bytes();
+
+   for (int i = 0; i < SLAB_HASH_SZ; i++) {
+      while (slab_hash[i] != NULL) {
+         rt_slab_t s = slab_hash[i];
+
+         if (s->live != 0)
+            fatal("memory leak of %zu items from %zu byte slab",
+                  s->live, s->item_sz);
 
-   return s->stack[--s->stack_top];
+         while (s->chunks != NULL) {
+            struct rt_slab_chunk *next = s->chunks->next;
+            free(s->chunks);
+            s->chunks = next;
+         }
+
+         slab_hash[i] = s->next;
+         free(s);
+      }
+   }
 }
 
+void rt_slab_stats(rt_slab_stats_t *stats)
+{
+   *stats = slab_stats;
+   stats->peak_bytes = rt_slab_peak_bytes();
+}
@@ -21,26 +21,90 @@
 #include "util.h"
 
 #include <assert.h>
+#include <pthread.h>
+
+#define RT_MAGAZINE_SZ 32
+
+struct rt_alloc_chunk;
 
 struct rt_alloc_stack {
-   void   **stack;
-   size_t stack_sz;
-   size_t stack_top;
-   size_t item_sz;
+   void                 **stack;
+   size_t                 stack_sz;
+   size_t                 stack_top;
+   size_t                 item_sz;
+   size_t                 chunk_items;
+   size_t                 high_water;
+   size_t                 refills;
+   struct rt_alloc_chunk *chunks;
+   pthread_mutex_t        lock;
 };
 
 typedef struct rt_alloc_stack *rt_alloc_stack_t;
 
+typedef struct {
+   rt_alloc_stack_t depot;
+   size_t           count;
+   void            *items[RT_MAGAZINE_SZ];
+} rt_magazine_t;
+
+typedef struct {
+   size_t item_sz;
+   size_t high_water;
+   size_t refills;
+   size_t bytes;
+} rt_alloc_stats_t;
+
+struct rt_slab_item {
+   struct rt_slab_item *next;
+};
+
+struct rt_slab_chunk;
+
+struct rt_slab {
+   struct rt_slab_item  *free_list;
+   struct rt_slab_chunk *chunks;
+   size_t                item_sz;
+   size_t                chunk_items;
+   size_t                live;
+   size_t                peak;
+   struct rt_slab       *next;
+};
+
+typedef struct rt_slab *rt_slab_t;
+
+typedef struct {
+   size_t classes;
+   size_t chunks;
+   size_t reserved_bytes;
+   size_t peak_bytes;
+} rt_slab_stats_t;
+
 rt_alloc_stack_t rt_alloc_stack_new(size_t size);
 void rt_alloc_stack_destroy(rt_alloc_stack_t stack);
 void *rt_alloc_slow(rt_alloc_stack_t stack);
+void rt_alloc_stats(rt_alloc_stack_t stack, rt_alloc_stats_t *stats);
+
+void rt_magazine_init(rt_magazine_t *m, rt_alloc_stack_t depot);
+void rt_magazine_flush(rt_magazine_t *m, size_t keep);
+void *rt_magazine_refill(rt_magazine_t *m);
+
+rt_slab_t rt_slab_get(size_t size);
+void rt_slab_destroy_all(void);
+void *rt_slab_alloc_slow(rt_slab_t slab);
+void rt_slab_stats(rt_slab_stats_t *stats);
 
 static inline void *rt_alloc(rt_alloc_stack_t s)
 {
    if (unlikely(s->stack_top == 0))
       return rt_alloc_slow(s);
-   else
-      return s->stack[--s->stack_top];
+
+   void *ptr = s->stack[--s->stack_top];
+
+   const size_t used = s->stack_sz - s->stack_top;
+   if (unlikely(used > s->high_water))
+      s->high_water = used;
+
+   return ptr;
 }
 
 static inline void rt_free(rt_alloc_stack_t s, void *ptr)
@@ -50,4 +114,45 @@ static inline void rt_free(rt_alloc_stack_t s, void *ptr)
    s->stack[s->stack_top++] = ptr;
 }
 
+static inline void *rt_magazine_alloc(rt_magazine_t *m)
+{
+   if (unlikely(m->count == 0))
+      return rt_magazine_refill(m);
+   else
+      return m->items[--m->count];
+}
+
+static inline void rt_magazine_free(rt_magazine_t *m, void *ptr)
+{
+   if (unlikely(m->count == RT_MAGAZINE_SZ))
+      rt_magazine_flush(m, RT_MAGAZINE_SZ / 2);
+
+   m->items[m->count++] = ptr;
+}
+
+static inline void *rt_slab_alloc(rt_slab_t slab)
+{
+   if (unlikely(slab->free_list == NULL))
+      return rt_slab_alloc_slow(slab);
+
+   struct rt_slab_item *item = slab->free_list;
+   slab->free_list = item->next;
+
+   if (++(slab->live) > slab->peak)
+      slab->peak = slab->live;
+
+   return item;
+}
+
+static inline void rt_slab_free(rt_slab_t slab, void *ptr)
+{
+   assert(slab->live > 0);
+
+   struct rt_slab_item *item = ptr;
+   item->next = slab->free_list;
+   slab->free_list = item;
+
+   --(slab->live);
+}
+
 #endif  // _RT_ALLOC_H
@@ -0,0 +1,349 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "rt.h"
+#include "tree.h"
+#include "common.h"
+#include "fst_write.h"
+#include "ring.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_VALS     256
+#define MAX_SCOPES   64
+#define INT_WIDTH    32
+#define MAX_THREADS  4
+#define RING_SIZE    (4 * 1024 * 1024)
+
+typedef struct fst_data fst_data_t;
+
+typedef void (*fst_fmt_fn_t)(fst_data_t *, const uint64_t *, int, char *);
+
+struct fst_data {
+   fst_data_t   *next;
+   tree_t        decl;
+   fst_handle_t  handle;
+   fst_fmt_fn_t  fmt;
+   range_kind_t  dir;
+   const char   *map;
+};
+
+// Signal events are copied into a ring buffer so the formatting and
+// compression can happen on a background thread
+typedef struct {
+   uint64_t    when;
+   fst_data_t *data;
+   uint32_t    nvals;
+   uint32_t    pad;
+   uint64_t    vals[];
+} fst_event_t;
+
+static fst_writer_t  writer = NULL;
+static tree_t        fst_top;
+static ring_t        ring = NULL;
+static char         *scopes[MAX_SCOPES];
+static int           n_scopes = 0;
+static fst_data_t   *all_data = NULL;
+static fst_data_t  **data_tail = &all_data;
+static bool          dumping = true;
+
+static const char std_logic_map[] = "UX01ZWLH-";
+static const char bit_map[]       = "01";
+
+static void fst_close_trace(void)
+{
+   if (ring != NULL) {
+      ring_free(ring);
+      ring = NULL;
+   }
+
+   if (writer != NULL) {
+      fst_time(writer, rt_now());
+      fst_close(writer);
+      writer = NULL;
+   }
+}
+
+static void fst_fmt_int(fst_data_t *data, const uint64_t *vals, int nvals,
+                        char *buf)
+{
+   for (int i = 0; i < INT_WIDTH; i++)
+      buf[i] = ((vals[0] >> (INT_WIDTH - 1 - i)) & 1) ? '1' : '0';
+}
+
+static void fst_fmt_chars(fst_data_t *data, const uint64_t *vals, int nvals,
+                          char *buf)
+{
+   for (int i = 0; i < nvals; i++)
+      buf[i] = data->map[vals[(data->dir == RANGE_TO) ? i : nvals - i - 1]];
+}
+
+static void fst_emit(uint64_t now, fst_data_t *data,
+                     const uint64_t *vals, int nvals)
+{
+   char buf[MAX(MAX_VALS, INT_WIDTH) + 1];
+   (*data->fmt)(data, vals, nvals, buf);
+
+   fst_time(writer, now);
+   fst_value(writer, data->handle, buf);
+}
+
+static void fst_toggle(uint64_t now, bool on)
+{
+   fst_time(writer, now);
+   fst_blackout(writer, on);
+}
+
+static void fst_consume(const void *rec, size_t len, void *context)
+{
+   // A record without signal data changes the dump state
+   const fst_event_t *e = rec;
+   if (e->data == NULL)
+      fst_toggle(e->when, e->nvals);
+   else
+      fst_emit(e->when, e->data, e->vals, e->nvals);
+}
+
+static void fst_event_cb(uint64_t now, tree_t decl, void *context)
+{
+   fst_data_t *data = context;
+
+   if (!dumping)
+      return;
+   else if (ring != NULL) {
+      const size_t max = sizeof(fst_event_t) + MAX_VALS * sizeof(uint64_t);
+      fst_event_t *e = ring_reserve(ring, max);
+      e->when  = now;
+      e->data  = data;
+      e->nvals = rt_signal_value(decl, e->vals, MAX_VALS, false);
+      ring_commit(ring, sizeof(fst_event_t) + e->nvals * sizeof(uint64_t));
+   }
+   else {
+      uint64_t vals[MAX_VALS];
+      const int nvals = rt_signal_value(decl, vals, MAX_VALS, false);
+      fst_emit(now, data, vals, nvals);
+   }
+}
+
+static const char *fst_enter_scope(tree_t decl)
+{
+   // Signal names are the full path separated by colons: open a scope
+   // for each component that differs from the previous signal and
+   // return the base name
+
+   const char *name = istr(tree_ident(decl)) + 1;
+   const char *base = strrchr(name, ':');
+   base = (base == NULL) ? name : base + 1;
+
+   char *str = strndup(name, base - name);
+
+   int n = 0;
+   for (char *p = strtok(str, ":"); p != NULL; p = strtok(NULL, ":"), n++) {
+      if ((n < n_scopes) && (strcmp(p, scopes[n]) == 0))
+         continue;
+
+      while (n < n_scopes) {
+         fst_upscope(writer);
+         free(scopes[--n_scopes]);
+      }
+
+      if (n_scopes == MAX_SCOPES)
+         fatal("signal %s is nested too deeply for FST output", name);
+
+      fst_scope(writer, p);
+      scopes[n_scopes++] = strdup(p);
+   }
+
+   while (n_scopes > n) {
+      fst_upscope(writer);
+      free(scopes[--n_scopes]);
+   }
+
+   free(str);
+   return base;
+}
+
+static bool fst_can_fmt_chars(type_t type, fst_data_t *data)
+{
+   ident_t name = type_ident(type);
+   if (icmp(name, "IEEE.STD_LOGIC_1164.STD_ULOGIC")) {
+      data->fmt = fst_fmt_chars;
+      data->map = std_logic_map;
+      return true;
+   }
+   else if (icmp(name, "STD.STANDARD.BIT")) {
+      data->fmt = fst_fmt_chars;
+      data->map = bit_map;
+      return true;
+   }
+   else
+      return false;
+}
+
+void fst_restart(void)
+{
+   if (writer == NULL)
+      return;
+
+   // The writer thread must be idle while signals are added
+   if (ring != NULL)
+      ring_flush(ring);
+
+   const int ndecls = tree_decls(fst_top);
+   for (int i = 0; i < ndecls; i++) {
+      tree_t d = tree_decl(fst_top, i);
+      if ((tree_kind(d) != T_SIGNAL_DECL) || !wave_should_dump(d))
+         continue;
+
+      type_t type = tree_type(d);
+
+      fst_data_t *data = xmalloc(sizeof(fst_data_t));
+      memset(data, '\0', sizeof(fst_data_t));
+
+      fst_var_type_t vt;
+      int width;
+
+      if (type_is_array(type)) {
+         if ((type_dims(type) > 1) || type_is_array(type_elem(type))) {
+            warn_at(tree_loc(d), "cannot emit arrays of greater than one "
+                    "dimension or arrays of arrays in FST yet");
+            free(data);
+            continue;
+         }
+
+         // Only arrays of BIT and STD_ULOGIC are supported
+         type_t elem = type_base_recur(type_elem(type));
+         if ((type_kind(elem) != T_ENUM) || !fst_can_fmt_chars(elem, data)) {
+            warn_at(tree_loc(d), "cannot represent arrays of type %s "
+                    "in FST format", type_pp(elem));
+            free(data);
+            continue;
+         }
+
+         int64_t low, high;
+         range_bounds(type_dim(type, 0), &low, &high);
+
+         if ((high < low) || (high - low + 1 > MAX_VALS)) {
+            warn_at(tree_loc(d), "cannot represent arrays of length %"PRIi64
+                    " in FST format", high - low + 1);
+            free(data);
+            continue;
+         }
+
+         data->dir = type_dim(type, 0).kind;
+         vt        = FST_VT_WIRE;
+         width     = high - low + 1;
+      }
+      else {
+         type_t base = type_base_recur(type);
+         switch (type_kind(base)) {
+         case T_INTEGER:
+            data->fmt = fst_fmt_int;
+            vt        = FST_VT_INTEGER;
+            width     = INT_WIDTH;
+            break;
+
+         case T_ENUM:
+            if (fst_can_fmt_chars(base, data)) {
+               data->dir = RANGE_TO;
+               vt        = FST_VT_WIRE;
+               width     = 1;
+            }
+            else {
+               // Other enumerations are written as their position
+               data->fmt = fst_fmt_int;
+               vt        = FST_VT_INTEGER;
+               width     = INT_WIDTH;
+            }
+            break;
+
+         default:
+            warn_at(tree_loc(d), "cannot represent type %s in FST format",
+                    type_pp(type));
+            free(data);
+            continue;
+         }
+      }
+
+      const char *name = fst_enter_scope(d);
+      data->handle = fst_var(writer, vt, width, name);
+
+      data->decl = d;
+      *data_tail = data;
+      data_tail = &(data->next);
+
+      rt_set_event_cb(d, fst_event_cb, data);
+   }
+
+   while (n_scopes > 0) {
+      fst_upscope(writer);
+      free(scopes[--n_scopes]);
+   }
+
+   for (fst_data_t *it = all_data; it != NULL; it = it->next) {
+      uint64_t vals[MAX_VALS];
+      const int nvals = rt_signal_value(it->decl, vals, MAX_VALS, false);
+      fst_emit(rt_now(), it, vals, nvals);
+   }
+}
+
+void fst_dump(uint64_t now, bool on)
+{
+   if ((writer == NULL) || (on == dumping))
+      return;
+
+   if (ring != NULL) {
+      fst_event_t *e = ring_reserve(ring, sizeof(fst_event_t));
+      e->when  = now;
+      e->data  = NULL;
+      e->nvals = on;
+      ring_commit(ring, sizeof(fst_event_t));
+   }
+   else
+      fst_toggle(now, on);
+
+   dumping = on;
+
+   // Write the current value of every signal when dumping resumes
+   if (on) {
+      for (fst_data_t *it = all_data; it != NULL; it = it->next)
+         fst_event_cb(now, it->decl, it);
+   }
+}
+
+void fst_init(const char *filename, tree_t top)
+{
+   // Blocks are compressed on a pool of threads unless the simulation
+   // may be forked by the shell
+   const bool async = opt_get_int("rt-wave-async");
+   const int nthreads =
+      async ? MAX(MIN(sysconf(_SC_NPROCESSORS_ONLN), MAX_THREADS), 1) : 1;
+
+   writer = fst_open(filename, -15, nthreads);
+
+   if (async)
+      ring = ring_new(RING_SIZE, fst_consume, NULL);
+
+   atexit(fst_close_trace);
+
+   fst_top = top;
+}
@@ -0,0 +1,622 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "fst_write.h"
+#include "pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+// Writer for the FST waveform format read by GtkWave. The file is a
+// header block followed by value change blocks and finally the signal
+// geometry and hierarchy. Each value change block starts with a frame
+// holding every signal value at the start of the block then a separate
+// zlib compressed chain of changes for each signal and an index of
+// chain offsets so a reader can seek directly to a signal. The chains
+// in a block are independent and are compressed in parallel.
+
+#define FST_BL_HDR       0
+#define FST_BL_BLACKOUT  2
+#define FST_BL_GEOM      3
+#define FST_BL_HIER      4
+#define FST_BL_VCDATA    8     // Dynamic alias value change block
+
+#define FST_ST_SCOPE     254
+#define FST_ST_UPSCOPE   255
+#define FST_SCOPE_MODULE 0
+#define FST_VD_IMPLICIT  0
+#define FST_FT_VHDL      1
+
+#define FST_HDR_LEN      329
+#define FST_HDR_START    9
+#define FST_HDR_COUNTS   41
+#define FST_VERSION_SZ   128
+#define FST_DATE_SZ      119
+#define FST_ENDIAN_TEST  2.7182818284590452354
+
+#define FST_BLOCK_SZ     (32 * 1024 * 1024)
+#define FST_PACK_MIN     32
+#define FST_ZLEVEL       4
+
+typedef struct {
+   uint8_t *data;
+   size_t   len;
+   size_t   alloc;
+} fst_buf_t;
+
+struct fst_sig {
+   uint32_t  len;
+   uint32_t  offset;
+   uint32_t  last;
+   fst_buf_t chain;
+   uint8_t  *packed;
+   size_t    packed_len;
+};
+
+struct fst_writer {
+   FILE           *file;
+   pool_t          pool;
+   struct fst_sig *sigs;
+   size_t          n_sigs;
+   size_t          sigs_alloc;
+   fst_buf_t       hier;
+   fst_buf_t       geom;
+   fst_buf_t       curval;
+   fst_buf_t       frame;
+   fst_buf_t       times;
+   fst_buf_t       blackouts;
+   uint64_t        n_blackouts;
+   uint64_t        last_blackout;
+   uint32_t        n_times;
+   uint64_t        start;
+   uint64_t        block_start;
+   uint64_t        now;
+   bool            started;
+   size_t          block_bytes;
+   uint64_t        n_scopes;
+   uint64_t        n_blocks;
+};
+
+static void fst_buf_reserve(fst_buf_t *b, size_t n)
+{
+   if (b->len + n > b->alloc) {
+      b->alloc = MAX(b->alloc * 2, MAX(b->len + n, 64));
+      b->data  = xrealloc(b->data, b->alloc);
+   }
+}
+
+static void fst_buf_append(fst_buf_t *b, const void *data, size_t n)
+{
+   fst_buf_reserve(b, n);
+   memcpy(b->data + b->len, data, n);
+   b->len += n;
+}
+
+static void fst_buf_byte(fst_buf_t *b, uint8_t byte)
+{
+   fst_buf_reserve(b, 1);
+   b->data[b->len++] = byte;
+}
+
+static void fst_buf_string(fst_buf_t *b, const char *str)
+{
+   fst_buf_append(b, str, strlen(str) + 1);
+}
+
+static void fst_buf_varint(fst_buf_t *b, uint64_t value)
+{
+   fst_buf_reserve(b, 10);
+   do {
+      const uint8_t byte = value & 0x7f;
+      value >>= 7;
+      b->data[b->len++] = byte | (value ? 0x80 : 0);
+   } while (value);
+}
+
+static void fst_buf_svarint(fst_buf_t *b, int64_t value)
+{
+   fst_buf_reserve(b, 10);
+   for (;;) {
+      const uint8_t byte = value & 0x7f;
+      value >>= 7;
+      const bool sign = (byte & 0x40) != 0;
+      if (((value == 0) && !sign) || ((value == -1) && sign)) {
+         b->data[b->len++] = byte;
+         break;
+      }
+      b->data[b->len++] = byte | 0x80;
+   }
+}
+
+static void fst_buf_free(fst_buf_t *b)
+{
+   free(b->data);
+   b->data  = NULL;
+   b->len   = 0;
+   b->alloc = 0;
+}
+
+static void fst_write_u64(fst_writer_t w, uint64_t value)
+{
+   // All fixed width integers are big endian
+   uint8_t buf[8];
+   for (int i = 7; i >= 0; i--, value >>= 8)
+      buf[i] = value & 0xff;
+   fwrite(buf, 8, 1, w->file);
+}
+
+static void fst_write_varint(fst_writer_t w, uint64_t value)
+{
+   uint8_t buf[10];
+   fst_buf_t b = { buf, 0, sizeof(buf) };
+   fst_buf_varint(&b, value);
+   fwrite(buf, b.len, 1, w->file);
+}
+
+static void fst_write_buf(fst_writer_t w, const fst_buf_t *b)
+{
+   fwrite(b->data, b->len, 1, w->file);
+}
+
+static void fst_seek(fst_writer_t w, off_t pos)
+{
+   if (fseeko(w->file, pos, SEEK_SET) != 0)
+      fatal_errno("fseeko");
+}
+
+static uint8_t *fst_compress(const fst_buf_t *b, size_t *len)
+{
+   // Returns NULL if compression would not make the data smaller
+   uLongf clen = compressBound(b->len);
+   uint8_t *out = xmalloc(clen);
+   if ((compress2(out, &clen, b->data, b->len, FST_ZLEVEL) != Z_OK)
+       || (clen >= b->len)) {
+      free(out);
+      return NULL;
+   }
+
+   *len = clen;
+   return out;
+}
+
+static uint8_t *fst_gzip(const fst_buf_t *b, size_t *len)
+{
+   // The hierarchy block uses the gzip container rather than plain zlib
+   z_stream z;
+   memset(&z, '\0', sizeof(z_stream));
+   if (deflateInit2(&z, FST_ZLEVEL, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+      fatal("deflateInit2 failed");
+
+   const size_t max = deflateBound(&z, b->len);
+   uint8_t *out = xmalloc(max);
+
+   z.next_in   = b->data;
+   z.avail_in  = b->len;
+   z.next_out  = out;
+   z.avail_out = max;
+
+   if (deflate(&z, Z_FINISH) != Z_STREAM_END)
+      fatal("deflate failed");
+
+   *len = max - z.avail_out;
+   deflateEnd(&z);
+   return out;
+}
+
+static void fst_write_frame(fst_writer_t w)
+{
+   size_t clen;
+   uint8_t *packed = fst_compress(&(w->frame), &clen);
+
+   fst_write_varint(w, w->frame.len);
+   if (packed != NULL) {
+      fst_write_varint(w, clen);
+      fst_write_varint(w, w->n_sigs);
+      fwrite(packed, clen, 1, w->file);
+      free(packed);
+   }
+   else {
+      fst_write_varint(w, w->frame.len);
+      fst_write_varint(w, w->n_sigs);
+      fst_write_buf(w, &(w->frame));
+   }
+}
+
+static void fst_pack_chain(void *item, int thread, void *context)
+{
+   struct fst_sig *s = item;
+   if (s->chain.len >= FST_PACK_MIN)
+      s->packed = fst_compress(&(s->chain), &(s->packed_len));
+}
+
+static void fst_flush_block(fst_writer_t w)
+{
+   const off_t start = ftello(w->file);
+
+   fputc(FST_BL_VCDATA, w->file);
+   fst_write_u64(w, 0);   // Section length
+   fst_write_u64(w, w->block_start);
+   fst_write_u64(w, w->now);
+   fst_write_u64(w, 0);   // Memory required for traversal
+
+   fst_write_frame(w);
+
+   void **items = xmalloc(w->n_sigs * sizeof(void *));
+   size_t n_items = 0;
+   for (size_t i = 0; i < w->n_sigs; i++) {
+      if (w->sigs[i].chain.len > 0)
+         items[n_items++] = &(w->sigs[i]);
+   }
+
+   pool_run(w->pool, items, n_items, fst_pack_chain, NULL);
+   free(items);
+
+   fst_write_varint(w, w->n_sigs);
+   const off_t vc_start = ftello(w->file);
+   fputc('Z', w->file);
+
+   // Chain offsets are stored as differences from the previous signal
+   // with data and runs of signals without changes are collapsed
+   fst_buf_t index = { NULL, 0, 0 };
+   uint64_t prev = 0, zeros = 0, traversal = 0;
+
+   for (size_t i = 0; i < w->n_sigs; i++) {
+      struct fst_sig *s = &(w->sigs[i]);
+      if (s->chain.len == 0) {
+         zeros++;
+         continue;
+      }
+
+      const uint64_t pos = ftello(w->file) - vc_start;
+
+      if (s->packed != NULL) {
+         fst_write_varint(w, s->chain.len);
+         fwrite(s->packed, s->packed_len, 1, w->file);
+         free(s->packed);
+         s->packed = NULL;
+      }
+      else {
+         fst_write_varint(w, 0);
+         fst_write_buf(w, &(s->chain));
+      }
+
+      if (zeros > 0) {
+         fst_buf_varint(&index, zeros << 1);
+         zeros = 0;
+      }
+
+      fst_buf_svarint(&index, ((pos - prev) << 1) | 1);
+      prev = pos;
+
+      traversal += s->chain.len;
+
+      s->chain.len = 0;
+      s->last      = 0;
+   }
+
+   if (zeros > 0)
+      fst_buf_varint(&index, zeros << 1);
+
+   fst_write_buf(w, &index);
+   fst_write_u64(w, index.len);
+   fst_buf_free(&index);
+
+   size_t tlen;
+   uint8_t *packed = fst_compress(&(w->times), &tlen);
+   if (packed != NULL) {
+      fwrite(packed, tlen, 1, w->file);
+      free(packed);
+   }
+   else {
+      fst_write_buf(w, &(w->times));
+      tlen = w->times.len;
+   }
+
+   fst_write_u64(w, w->times.len);
+   fst_write_u64(w, tlen);
+   fst_write_u64(w, w->n_times);
+
+   const off_t end = ftello(w->file);
+
+   fst_seek(w, start + 1);
+   fst_write_u64(w, end - start - 1);
+   fst_seek(w, start + 1 + 24);
+   fst_write_u64(w, traversal);
+   fst_seek(w, end);
+
+   w->block_bytes = 0;
+   w->n_blocks++;
+}
+
+static void fst_start_block(fst_writer_t w, uint64_t now)
+{
+   // The time table holds the absolute time of the first entry
+   // followed by deltas
+   w->times.len = 0;
+   fst_buf_varint(&(w->times), now);
+   w->n_times = 1;
+
+   w->frame.len = 0;
+   fst_buf_append(&(w->frame), w->curval.data, w->curval.len);
+
+   w->block_start = now;
+}
+
+static void fst_write_header(fst_writer_t w, int timescale)
+{
+   fputc(FST_BL_HDR, w->file);
+   fst_write_u64(w, FST_HDR_LEN);
+   fst_write_u64(w, 0);   // Start time
+   fst_write_u64(w, 0);   // End time
+
+   const double endian = FST_ENDIAN_TEST;
+   fwrite(&endian, sizeof(double), 1, w->file);
+
+   fst_write_u64(w, FST_BLOCK_SZ);
+   fst_write_u64(w, 0);   // Number of scopes
+   fst_write_u64(w, 0);   // Number of variables
+   fst_write_u64(w, 0);   // Maximum handle
+   fst_write_u64(w, 0);   // Number of value change blocks
+
+   fputc(timescale & 0xff, w->file);   // Timescale exponent
+
+   char version[FST_VERSION_SZ];
+   memset(version, '\0', sizeof(version));
+   strncpy(version, PACKAGE_STRING, sizeof(version) - 1);
+   fwrite(version, sizeof(version), 1, w->file);
+
+   char date[FST_DATE_SZ];
+   memset(date, '\0', sizeof(date));
+   time_t t = time(NULL);
+   strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y\n", localtime(&t));
+   fwrite(date, sizeof(date), 1, w->file);
+
+   fputc(FST_FT_VHDL, w->file);
+   fst_write_u64(w, 0);   // Time zero
+}
+
+fst_writer_t fst_open(const char *file, int timescale, int nthreads)
+{
+   struct fst_writer *w = xmalloc(sizeof(struct fst_writer));
+   memset(w, '\0', sizeof(struct fst_writer));
+
+   if ((w->file = fopen(file, "w+b")) == NULL)
+      fatal_errno("failed to open FST output %s", file);
+
+   w->pool = pool_new(nthreads);
+
+   // The header is rewritten with the final counts when closed
+   fst_write_header(w, timescale);
+
+   return w;
+}
+
+void fst_close(fst_writer_t w)
+{
+   if (w->started)
+      fst_flush_block(w);
+
+   if (w->n_blackouts > 0) {
+      fst_buf_t count = { NULL, 0, 0 };
+      fst_buf_varint(&count, w->n_blackouts);
+
+      fputc(FST_BL_BLACKOUT, w->file);
+      fst_write_u64(w, 8 + count.len + w->blackouts.len);
+      fst_write_buf(w, &count);
+      fst_write_buf(w, &(w->blackouts));
+
+      fst_buf_free(&count);
+   }
+
+   size_t clen;
+   uint8_t *packed = fst_compress(&(w->geom), &clen);
+
+   fputc(FST_BL_GEOM, w->file);
+   fst_write_u64(w, (packed ? clen : w->geom.len) + 24);
+   fst_write_u64(w, w->geom.len);
+   fst_write_u64(w, w->n_sigs);
+   if (packed != NULL) {
+      fwrite(packed, clen, 1, w->file);
+      free(packed);
+   }
+   else
+      fst_write_buf(w, &(w->geom));
+
+   packed = fst_gzip(&(w->hier), &clen);
+
+   fputc(FST_BL_HIER, w->file);
+   fst_write_u64(w, clen + 16);
+   fst_write_u64(w, w->hier.len);
+   fwrite(packed, clen, 1, w->file);
+   free(packed);
+
+   fst_seek(w, FST_HDR_START);
+   fst_write_u64(w, w->start);
+   fst_write_u64(w, w->now);
+
+   fst_seek(w, FST_HDR_COUNTS);
+   fst_write_u64(w, w->n_scopes);
+   fst_write_u64(w, w->n_sigs);
+   fst_write_u64(w, w->n_sigs);
+   fst_write_u64(w, w->n_blocks);
+
+   if (fclose(w->file) != 0)
+      fatal_errno("fclose");
+
+   for (size_t i = 0; i < w->n_sigs; i++)
+      fst_buf_free(&(w->sigs[i].chain));
+   free(w->sigs);
+
+   fst_buf_free(&(w->hier));
+   fst_buf_free(&(w->geom));
+   fst_buf_free(&(w->curval));
+   fst_buf_free(&(w->frame));
+   fst_buf_free(&(w->times));
+   fst_buf_free(&(w->blackouts));
+
+   pool_free(w->pool);
+   free(w);
+}
+
+void fst_scope(fst_writer_t w, const char *name)
+{
+   fst_buf_byte(&(w->hier), FST_ST_SCOPE);
+   fst_buf_byte(&(w->hier), FST_SCOPE_MODULE);
+   fst_buf_string(&(w->hier), name);
+   fst_buf_string(&(w->hier), "");
+
+   w->n_scopes++;
+}
+
+void fst_upscope(fst_writer_t w)
+{
+   fst_buf_byte(&(w->hier), FST_ST_UPSCOPE);
+}
+
+fst_handle_t fst_var(fst_writer_t w, fst_var_type_t type, uint32_t len,
+                     const char *name)
+{
+   assert(!w->started);
+   assert(len > 0);
+
+   fst_buf_byte(&(w->hier), type);
+   fst_buf_byte(&(w->hier), FST_VD_IMPLICIT);
+   fst_buf_string(&(w->hier), name);
+   fst_buf_varint(&(w->hier), len);
+   fst_buf_varint(&(w->hier), 0);   // Not an alias
+
+   fst_buf_varint(&(w->geom), len);
+
+   if (w->n_sigs == w->sigs_alloc) {
+      w->sigs_alloc = MAX(w->sigs_alloc * 2, 64);
+      w->sigs = xrealloc(w->sigs, w->sigs_alloc * sizeof(struct fst_sig));
+   }
+
+   struct fst_sig *s = &(w->sigs[w->n_sigs++]);
+   memset(s, '\0', sizeof(struct fst_sig));
+   s->len    = len;
+   s->offset = w->curval.len;
+
+   fst_buf_reserve(&(w->curval), len);
+   memset(w->curval.data + w->curval.len, 'x', len);
+   w->curval.len += len;
+
+   return w->n_sigs;
+}
+
+void fst_time(fst_writer_t w, uint64_t now)
+{
+   if (!w->started) {
+      fst_start_block(w, now);
+      w->start   = now;
+      w->started = true;
+   }
+   else if (now == w->now)
+      return;
+   else if (w->block_bytes >= FST_BLOCK_SZ) {
+      fst_flush_block(w);
+      fst_start_block(w, now);
+   }
+   else {
+      assert(now > w->now);
+      fst_buf_varint(&(w->times), now - w->now);
+      w->n_times++;
+   }
+
+   w->now = now;
+}
+
+static uint32_t fst_logic_code(char ch)
+{
+   // Position in the reader's table of non-binary values
+   switch (ch) {
+   case 'z': case 'Z': return 1;
+   case 'h': case 'H': return 2;
+   case 'u': case 'U': return 3;
+   case 'w': case 'W': return 4;
+   case 'l': case 'L': return 5;
+   case '-':           return 6;
+   default:            return 0;
+   }
+}
+
+void fst_value(fst_writer_t w, fst_handle_t h, const char *value)
+{
+   assert(w->started);
+   assert((h > 0) && (h <= w->n_sigs));
+
+   struct fst_sig *s = &(w->sigs[h - 1]);
+
+   // Each change records the number of time table entries since the
+   // previous change to this signal in the block
+   const uint32_t tidx  = w->n_times - 1;
+   const uint64_t delta = tidx - s->last;
+   s->last = tidx;
+
+   const size_t before = s->chain.len;
+
+   if (s->len == 1) {
+      if ((value[0] == '0') || (value[0] == '1'))
+         fst_buf_varint(&(s->chain), ((value[0] & 1) << 1) | (delta << 2));
+      else
+         fst_buf_varint(&(s->chain),
+                        1 | (fst_logic_code(value[0]) << 1) | (delta << 4));
+   }
+   else {
+      bool binary = true;
+      for (uint32_t i = 0; binary && (i < s->len); i++)
+         binary = (value[i] == '0') || (value[i] == '1');
+
+      if (binary) {
+         fst_buf_varint(&(s->chain), delta << 1);
+
+         const size_t nbytes = (s->len + 7) / 8;
+         fst_buf_reserve(&(s->chain), nbytes);
+         uint8_t *p = s->chain.data + s->chain.len;
+         memset(p, '\0', nbytes);
+         for (uint32_t i = 0; i < s->len; i++)
+            p[i / 8] |= (value[i] & 1) << (7 - (i % 8));
+         s->chain.len += nbytes;
+      }
+      else {
+         fst_buf_varint(&(s->chain), (delta << 1) | 1);
+         fst_buf_append(&(s->chain), value, s->len);
+      }
+   }
+
+   memcpy(w->curval.data + s->offset, value, s->len);
+
+   w->block_bytes += s->chain.len - before;
+}
+
+void fst_blackout(fst_writer_t w, bool active)
+{
+   // Record the start or end of a period where dumping was disabled
+   assert(w->started);
+
+   fst_buf_byte(&(w->blackouts), active);
+   fst_buf_varint(&(w->blackouts), w->now - w->last_blackout);
+
+   w->last_blackout = w->now;
+   w->n_blackouts++;
+}
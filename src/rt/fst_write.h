@@ -0,0 +1,44 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _FST_WRITE_H
+#define _FST_WRITE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct fst_writer *fst_writer_t;
+typedef uint32_t fst_handle_t;
+
+// Variable types as numbered in the FST format
+typedef enum {
+   FST_VT_INTEGER = 1,
+   FST_VT_REG     = 5,
+   FST_VT_WIRE    = 16
+} fst_var_type_t;
+
+fst_writer_t fst_open(const char *file, int timescale, int nthreads);
+void fst_close(fst_writer_t w);
+void fst_scope(fst_writer_t w, const char *name);
+void fst_upscope(fst_writer_t w);
+fst_handle_t fst_var(fst_writer_t w, fst_var_type_t type, uint32_t len,
+                     const char *name);
+void fst_time(fst_writer_t w, uint64_t now);
+void fst_value(fst_writer_t w, fst_handle_t h, const char *value);
+void fst_blackout(fst_writer_t w, bool active);
+
+#endif  // _FST_WRITE_H
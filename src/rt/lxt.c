@@ -20,6 +20,7 @@
 #include "tree.h"
 #include "common.h"
 #include "lxt_write.h"
+#include "ring.h"
 
 #include <time.h>
 #include <inttypes.h>
@@ -27,29 +28,50 @@
 #include <assert.h>
 #include <stdlib.h>
 
-#define MAX_VALS 256
+#define MAX_VALS  256
+#define RING_SIZE (4 * 1024 * 1024)
 
 typedef struct lxt_data lxt_data_t;
 
-typedef void (*lxt_fmt_fn_t)(tree_t, lxt_data_t *);
+typedef void (*lxt_fmt_fn_t)(lxt_data_t *, const uint64_t *, int);
 
 struct lxt_data {
+   lxt_data_t       *next;
+   tree_t            decl;
    struct lt_symbol *sym;
    lxt_fmt_fn_t      fmt;
    range_kind_t      dir;
    const char       *map;
+   char            **literals;
 };
 
+// Signal events are copied into a ring buffer so the formatting and
+// compression can happen on a background thread
+typedef struct {
+   uint64_t    when;
+   lxt_data_t *data;
+   uint32_t    nvals;
+   uint32_t    pad;
+   uint64_t    vals[];
+} lxt_event_t;
+
 static struct lt_trace *trace = NULL;
 static tree_t           lxt_top;
-static ident_t          lxt_data_i;
 static lxttime_t        last_time;
+static ring_t           ring = NULL;
+static lxt_data_t      *all_data = NULL;
+static bool             dumping = true;
 
 static const char std_logic_map[] = "UX01ZWLH-";
 static const char bit_map[]       = "01";
 
 static void lxt_close_trace(void)
 {
+   if (ring != NULL) {
+      ring_free(ring);
+      ring = NULL;
+   }
+
    if (trace != NULL) {
       lt_set_time64(trace, rt_now());
       lt_close(trace);
@@ -57,28 +79,18 @@ static void lxt_close_trace(void)
    }
 }
 
-static void lxt_fmt_int(tree_t decl, lxt_data_t *data)
+static void lxt_fmt_int(lxt_data_t *data, const uint64_t *vals, int nvals)
 {
-   uint64_t val;
-   rt_signal_value(decl, &val, 1, false);
-
-   lt_emit_value_int(trace, data->sym, 0, val);
+   lt_emit_value_int(trace, data->sym, 0, vals[0]);
 }
 
-static void lxt_fmt_enum(tree_t decl, lxt_data_t *data)
+static void lxt_fmt_enum(lxt_data_t *data, const uint64_t *vals, int nvals)
 {
-   uint64_t val;
-   rt_signal_value(decl, &val, 1, false);
-
-   tree_t lit = type_enum_literal(tree_type(decl), val);
-   lt_emit_value_string(trace, data->sym, 0, (char *)istr(tree_ident(lit)));
+   lt_emit_value_string(trace, data->sym, 0, data->literals[vals[0]]);
 }
 
-static void lxt_fmt_chars(tree_t decl, lxt_data_t *data)
+static void lxt_fmt_chars(lxt_data_t *data, const uint64_t *vals, int nvals)
 {
-   uint64_t vals[MAX_VALS];
-   const int nvals = rt_signal_value(decl, vals, MAX_VALS, false);
-
    char bits[MAX_VALS + 1];
    bits[nvals] = '\0';
    if (data->map != NULL) {
@@ -93,15 +105,69 @@ static void lxt_fmt_chars(tree_t decl, lxt_data_t *data)
    }
 }
 
-static void lxt_event_cb(uint64_t now, tree_t decl)
+static void lxt_emit(uint64_t now, lxt_data_t *data,
+                     const uint64_t *vals, int nvals)
+{
+   if (now != last_time) {
+      lt_set_time64(trace, now);
+      last_time = now;
+   }
+
+   (*data->fmt)(data, vals, nvals);
+}
+
+static void lxt_toggle(uint64_t now, bool on)
 {
    if (now != last_time) {
       lt_set_time64(trace, now);
       last_time = now;
    }
 
-   lxt_data_t *data = tree_attr_ptr(decl, lxt_data_i);
-   (*data->fmt)(decl, data);
+   if (on)
+      lt_set_dumpon(trace);
+   else
+      lt_set_dumpoff(trace);
+}
+
+static void lxt_consume(const void *rec, size_t len, void *context)
+{
+   // A record without signal data changes the dump state
+   const lxt_event_t *e = rec;
+   if (e->data == NULL)
+      lxt_toggle(e->when, e->nvals);
+   else
+      lxt_emit(e->when, e->data, e->vals, e->nvals);
+}
+
+static void lxt_event_cb(uint64_t now, tree_t decl, void *context)
+{
+   lxt_data_t *data = context;
+
+   if (!dumping)
+      return;
+   else if (ring != NULL) {
+      const size_t max = sizeof(lxt_event_t) + MAX_VALS * sizeof(uint64_t);
+      lxt_event_t *e = ring_reserve(ring, max);
+      e->when  = now;
+      e->data  = data;
+      e->nvals = rt_signal_value(decl, e->vals, MAX_VALS, false);
+      ring_commit(ring, sizeof(lxt_event_t) + e->nvals * sizeof(uint64_t));
+   }
+   else {
+      uint64_t vals[MAX_VALS];
+      const int nvals = rt_signal_value(decl, vals, MAX_VALS, false);
+      lxt_emit(now, data, vals, nvals);
+   }
+}
+
+static char **lxt_enum_literals(type_t type)
+{
+   // Copy the literal names as the writer thread cannot use istr
+   const int nlits = type_enum_literals(type);
+   char **literals = xmalloc(nlits * sizeof(char *));
+   for (int i = 0; i < nlits; i++)
+      literals[i] = strdup(istr(tree_ident(type_enum_literal(type, i))));
+   return literals;
 }
 
 static char *lxt_fmt_name(tree_t decl)
@@ -144,6 +210,10 @@ void lxt_restart(void)
    if (trace == NULL)
       return;
 
+   // The writer thread must be idle while symbols are added
+   if (ring != NULL)
+      ring_flush(ring);
+
    lt_set_timescale(trace, -15);
    lt_symbol_bracket_stripping(trace, 0);
    lt_set_clock_compress(trace);
@@ -151,7 +221,7 @@ void lxt_restart(void)
    const int ndecls = tree_decls(lxt_top);
    for (int i = 0; i < ndecls; i++) {
       tree_t d = tree_decl(lxt_top, i);
-      if (tree_kind(d) != T_SIGNAL_DECL)
+      if ((tree_kind(d) != T_SIGNAL_DECL) || !wave_should_dump(d))
          continue;
 
       type_t type = tree_type(d);
@@ -203,6 +273,7 @@ void lxt_restart(void)
          case T_ENUM:
             if (!lxt_can_fmt_enum_chars(base, data, &flags)) {
                data->fmt = lxt_fmt_enum;
+               data->literals = lxt_enum_literals(base);
                flags = LT_SYM_F_STRING;
             }
             break;
@@ -219,23 +290,52 @@ void lxt_restart(void)
       data->sym = lt_symbol_add(trace, name, rows, msb, lsb, flags);
       free(name);
 
-      tree_add_attr_ptr(d, lxt_data_i, data);
+      data->decl = d;
+      data->next = all_data;
+      all_data = data;
 
-      rt_set_event_cb(d, lxt_event_cb);
+      rt_set_event_cb(d, lxt_event_cb, data);
 
-      (*data->fmt)(d, data);
+      uint64_t vals[MAX_VALS];
+      const int nvals = rt_signal_value(d, vals, MAX_VALS, false);
+      (*data->fmt)(data, vals, nvals);
    }
 
    last_time = (lxttime_t)-1;
 }
 
-void lxt_init(const char *filename, tree_t top)
+void lxt_dump(uint64_t now, bool on)
 {
-   lxt_data_i = ident_new("lxt_data");
+   if ((trace == NULL) || (on == dumping))
+      return;
 
+   if (ring != NULL) {
+      lxt_event_t *e = ring_reserve(ring, sizeof(lxt_event_t));
+      e->when  = now;
+      e->data  = NULL;
+      e->nvals = on;
+      ring_commit(ring, sizeof(lxt_event_t));
+   }
+   else
+      lxt_toggle(now, on);
+
+   dumping = on;
+
+   // Write the current value of every signal when dumping resumes
+   if (on) {
+      for (lxt_data_t *it = all_data; it != NULL; it = it->next)
+         lxt_event_cb(now, it->decl, it);
+   }
+}
+
+void lxt_init(const char *filename, tree_t top)
+{
    if ((trace = lt_init(filename)) == NULL)
       fatal("lt_init failed");
 
+   if (opt_get_int("rt-wave-async"))
+      ring = ring_new(RING_SIZE, lxt_consume, NULL);
+
    atexit(lxt_close_trace);
 
    lxt_top = top;
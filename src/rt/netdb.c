@@ -52,12 +52,12 @@ netdb_t *netdb_open(tree_t top)
    db->nnets  = 0;
 
    groupid_t gid;
-   while ((gid = read_u32(f)) != GROUPID_INVALID) {
+   while ((gid = read_uint(f)) != GROUPID_INVALID) {
       group_t *g = xmalloc(sizeof(struct group));
       g->next   = db->groups;
       g->gid    = gid;
-      g->first  = read_u32(f);
-      g->length = read_u32(f);
+      g->first  = read_uint(f);
+      g->length = read_uint(f);
 
       db->groups = g;
       db->max    = MAX(db->max, gid);
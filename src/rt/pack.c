@@ -0,0 +1,88 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "pack.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Conversion between one byte per element signal values and a packed
+// form with 1, 2 or 4 bits per element. Element i is stored in bits
+// (i * bits) % 8 upwards of byte (i * bits) / 8 and any unused bits
+// in the final byte are zero so packed values can be compared with
+// memcmp.
+
+size_t pack_size(size_t count, unsigned bits)
+{
+   assert((bits == 1) || (bits == 2) || (bits == 4));
+   return ((count * bits) + 7) / 8;
+}
+
+void pack_values(uint8_t *dst, const uint8_t *src, size_t count,
+                 unsigned bits)
+{
+   const unsigned per_byte = 8 / bits;
+   const uint8_t  mask = (1 << bits) - 1;
+
+   size_t i = 0;
+
+   if (bits == 1) {
+      // Gather the low bit of eight bytes with a single multiply
+      for (; i + 8 <= count; i += 8) {
+         uint64_t word;
+         memcpy(&word, src + i, sizeof(word));
+         word &= UINT64_C(0x0101010101010101);
+         *dst++ = (word * UINT64_C(0x0102040810204080)) >> 56;
+      }
+   }
+
+   while (i < count) {
+      uint8_t byte = 0;
+      for (unsigned k = 0; (k < per_byte) && (i < count); k++, i++)
+         byte |= (src[i] & mask) << (k * bits);
+      *dst++ = byte;
+   }
+}
+
+void unpack_values(uint8_t *dst, const uint8_t *src, size_t skip,
+                   size_t count, unsigned bits)
+{
+   const unsigned per_byte = 8 / bits;
+   const uint8_t  mask = (1 << bits) - 1;
+
+   size_t i = skip;
+   const size_t end = skip + count;
+
+   if ((bits == 1) && (i % 8 == 0)) {
+      // Spread eight bits into the low bit of eight bytes
+      for (; i + 8 <= end; i += 8, dst += 8) {
+         // Replicate the byte, keep bit k in byte k, then turn each
+         // non-zero byte into one
+         uint64_t word = src[i / 8] * UINT64_C(0x0101010101010101);
+         word &= UINT64_C(0x8040201008040201);
+         word = ((word + UINT64_C(0x7f7f7f7f7f7f7f7f)) >> 7)
+            & UINT64_C(0x0101010101010101);
+         memcpy(dst, &word, sizeof(word));
+      }
+   }
+
+   for (; i < end; i++) {
+      const uint8_t byte = src[i / per_byte];
+      *dst++ = (byte >> ((i % per_byte) * bits)) & mask;
+   }
+}
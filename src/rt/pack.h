@@ -0,0 +1,30 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _PACK_H
+#define _PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t pack_size(size_t count, unsigned bits);
+void pack_values(uint8_t *dst, const uint8_t *src, size_t count,
+                 unsigned bits);
+void unpack_values(uint8_t *dst, const uint8_t *src, size_t skip,
+                   size_t count, unsigned bits);
+
+#endif  // _PACK_H
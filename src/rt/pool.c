@@ -0,0 +1,169 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Fixed set of worker threads that execute batches of independent
+// tasks. Idle threads take the next unclaimed task from a shared
+// atomic cursor so a thread that finishes early steals work that
+// would otherwise wait behind a slow task. The calling thread takes
+// part in each batch as thread zero.
+
+struct worker {
+   pool_t    pool;
+   int       id;
+   pthread_t thread;
+};
+
+struct pool {
+   struct worker  *workers;
+   int             nthreads;
+   pthread_mutex_t lock;
+   pthread_cond_t  start_cv;
+   pthread_cond_t  done_cv;
+   unsigned        generation;
+   int             running;
+   bool            shutdown;
+   void          **items;
+   size_t          n_items;
+   size_t          next;
+   pool_task_fn_t  fn;
+   void           *context;
+};
+
+static void pool_drain(pool_t p, int id)
+{
+   size_t i;
+   while ((i = __sync_fetch_and_add(&(p->next), 1)) < p->n_items)
+      (*p->fn)(p->items[i], id, p->context);
+}
+
+static void *pool_worker(void *arg)
+{
+   struct worker *w = arg;
+   pool_t p = w->pool;
+   unsigned seen = 0;
+
+   pthread_mutex_lock(&(p->lock));
+   for (;;) {
+      while ((p->generation == seen) && !p->shutdown)
+         pthread_cond_wait(&(p->start_cv), &(p->lock));
+
+      if (p->shutdown)
+         break;
+
+      seen = p->generation;
+      pthread_mutex_unlock(&(p->lock));
+
+      pool_drain(p, w->id);
+
+      pthread_mutex_lock(&(p->lock));
+      if (--(p->running) == 0)
+         pthread_cond_signal(&(p->done_cv));
+   }
+   pthread_mutex_unlock(&(p->lock));
+
+   return NULL;
+}
+
+pool_t pool_new(int nthreads)
+{
+   assert(nthreads > 0);
+
+   struct pool *p = xmalloc(sizeof(struct pool));
+   p->workers    = xmalloc(sizeof(struct worker) * nthreads);
+   p->nthreads   = nthreads;
+   p->generation = 0;
+   p->running    = 0;
+   p->shutdown   = false;
+   p->items      = NULL;
+   p->n_items    = 0;
+   p->next       = 0;
+   p->fn         = NULL;
+   p->context    = NULL;
+
+   pthread_mutex_init(&(p->lock), NULL);
+   pthread_cond_init(&(p->start_cv), NULL);
+   pthread_cond_init(&(p->done_cv), NULL);
+
+   for (int i = 1; i < nthreads; i++) {
+      p->workers[i].pool = p;
+      p->workers[i].id   = i;
+      if (pthread_create(&(p->workers[i].thread), NULL,
+                         pool_worker, &(p->workers[i])) != 0)
+         fatal_errno("pthread_create");
+   }
+
+   return p;
+}
+
+void pool_free(pool_t p)
+{
+   pthread_mutex_lock(&(p->lock));
+   p->shutdown = true;
+   pthread_cond_broadcast(&(p->start_cv));
+   pthread_mutex_unlock(&(p->lock));
+
+   for (int i = 1; i < p->nthreads; i++)
+      pthread_join(p->workers[i].thread, NULL);
+
+   pthread_cond_destroy(&(p->done_cv));
+   pthread_cond_destroy(&(p->start_cv));
+   pthread_mutex_destroy(&(p->lock));
+
+   free(p->workers);
+   free(p);
+}
+
+int pool_threads(pool_t p)
+{
+   return p->nthreads;
+}
+
+void pool_run(pool_t p, void **items, size_t n, pool_task_fn_t fn,
+              void *context)
+{
+   if ((p->nthreads == 1) || (n < 2)) {
+      for (size_t i = 0; i < n; i++)
+         (*fn)(items[i], 0, context);
+      return;
+   }
+
+   pthread_mutex_lock(&(p->lock));
+   p->items   = items;
+   p->n_items = n;
+   p->next    = 0;
+   p->fn      = fn;
+   p->context = context;
+   p->running = p->nthreads - 1;
+   ++(p->generation);
+   pthread_cond_broadcast(&(p->start_cv));
+   pthread_mutex_unlock(&(p->lock));
+
+   pool_drain(p, 0);
+
+   pthread_mutex_lock(&(p->lock));
+   while (p->running > 0)
+      pthread_cond_wait(&(p->done_cv), &(p->lock));
+   pthread_mutex_unlock(&(p->lock));
+}
@@ -0,0 +1,33 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>
+
+typedef struct pool *pool_t;
+
+typedef void (*pool_task_fn_t)(void *item, int thread, void *context);
+
+pool_t pool_new(int nthreads);
+void pool_free(pool_t p);
+int pool_threads(pool_t p);
+void pool_run(pool_t p, void **items, size_t n, pool_task_fn_t fn,
+              void *context);
+
+#endif  // _POOL_H
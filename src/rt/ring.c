@@ -0,0 +1,227 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "ring.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+// Bounded single producer, single consumer queue of variable length
+// records with a background thread passing each record to a callback
+// in order. The producer and consumer only synchronise through the
+// head and tail counters: the mutex and condition variable are used
+// to sleep when the ring is empty or full.
+
+#define RING_ALIGN   8
+#define RING_WRAP    UINT32_MAX
+#define RING_WAIT_NS 1000000
+
+struct ring_hdr {
+   uint32_t len;
+   uint32_t pad;
+};
+
+struct ring {
+   uint8_t          *buf;
+   size_t            size;
+   size_t            head __attribute__((aligned(64)));
+   size_t            tail __attribute__((aligned(64)));
+   size_t            reserved;
+   bool              closed;
+   bool              waiting;
+   pthread_t         thread;
+   pthread_mutex_t   lock;
+   pthread_cond_t    cv;
+   ring_consume_fn_t fn;
+   void             *context;
+};
+
+static inline size_t ring_align(size_t len)
+{
+   return (len + RING_ALIGN - 1) & ~(RING_ALIGN - 1);
+}
+
+static void ring_wait(ring_t r)
+{
+   // Sleep until the other side signals progress: the timeout covers
+   // a wakeup sent between checking the counters and waiting
+
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_nsec += RING_WAIT_NS;
+   if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec  += 1;
+      ts.tv_nsec -= 1000000000;
+   }
+
+   pthread_mutex_lock(&(r->lock));
+   __atomic_store_n(&(r->waiting), true, __ATOMIC_SEQ_CST);
+   const int rc = pthread_cond_timedwait(&(r->cv), &(r->lock), &ts);
+   if ((rc != 0) && (rc != ETIMEDOUT))
+      fatal("pthread_cond_timedwait failed");
+   pthread_mutex_unlock(&(r->lock));
+}
+
+static void ring_wake(ring_t r)
+{
+   if (__atomic_load_n(&(r->waiting), __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&(r->lock));
+      r->waiting = false;
+      pthread_cond_broadcast(&(r->cv));
+      pthread_mutex_unlock(&(r->lock));
+   }
+}
+
+static void *ring_consumer(void *arg)
+{
+   ring_t r = arg;
+   size_t tail = r->tail;
+
+   for (;;) {
+      const size_t head = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+
+      if (head == tail) {
+         if (__atomic_load_n(&(r->closed), __ATOMIC_ACQUIRE))
+            break;
+
+         ring_wait(r);
+         continue;
+      }
+
+      while (tail != head) {
+         const size_t off = tail & (r->size - 1);
+         const struct ring_hdr *hdr = (struct ring_hdr *)(r->buf + off);
+
+         if (hdr->len == RING_WRAP)
+            tail += r->size - off;
+         else {
+            (*r->fn)(hdr + 1, hdr->len, r->context);
+            tail += sizeof(struct ring_hdr) + ring_align(hdr->len);
+         }
+      }
+
+      __atomic_store_n(&(r->tail), tail, __ATOMIC_RELEASE);
+      ring_wake(r);
+   }
+
+   return NULL;
+}
+
+ring_t ring_new(size_t size, ring_consume_fn_t fn, void *context)
+{
+   assert((size & (size - 1)) == 0);
+
+   struct ring *r = xmalloc(sizeof(struct ring));
+   memset(r, '\0', sizeof(struct ring));
+
+   r->buf     = xmalloc(size);
+   r->size    = size;
+   r->fn      = fn;
+   r->context = context;
+
+   if (pthread_mutex_init(&(r->lock), NULL) != 0)
+      fatal_errno("pthread_mutex_init");
+   if (pthread_cond_init(&(r->cv), NULL) != 0)
+      fatal_errno("pthread_cond_init");
+
+   if (pthread_create(&(r->thread), NULL, ring_consumer, r) != 0)
+      fatal_errno("pthread_create");
+
+   return r;
+}
+
+void ring_free(ring_t r)
+{
+   __atomic_store_n(&(r->closed), true, __ATOMIC_RELEASE);
+
+   pthread_mutex_lock(&(r->lock));
+   pthread_cond_broadcast(&(r->cv));
+   pthread_mutex_unlock(&(r->lock));
+
+   if (pthread_join(r->thread, NULL) != 0)
+      fatal_errno("pthread_join");
+
+   pthread_cond_destroy(&(r->cv));
+   pthread_mutex_destroy(&(r->lock));
+
+   free(r->buf);
+   free(r);
+}
+
+static void ring_wait_space(ring_t r, size_t need)
+{
+   // Block the producer until the consumer has freed enough space
+   while (r->head + need
+          - __atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE) > r->size)
+      ring_wait(r);
+}
+
+void *ring_reserve(ring_t r, size_t len)
+{
+   // Return space for a record of at most len bytes which is published
+   // by the following call to ring_commit
+
+   const size_t need = sizeof(struct ring_hdr) + ring_align(len);
+   assert(need <= r->size / 2);
+
+   const size_t off = r->head & (r->size - 1);
+   if (off + need > r->size) {
+      // Records are contiguous so skip the space at the end
+      const size_t skip = r->size - off;
+      ring_wait_space(r, skip);
+
+      struct ring_hdr *hdr = (struct ring_hdr *)(r->buf + off);
+      hdr->len = RING_WRAP;
+
+      __atomic_store_n(&(r->head), r->head + skip, __ATOMIC_RELEASE);
+   }
+
+   ring_wait_space(r, need);
+
+   r->reserved = len;
+   return r->buf + (r->head & (r->size - 1)) + sizeof(struct ring_hdr);
+}
+
+void ring_commit(ring_t r, size_t len)
+{
+   assert(len <= r->reserved);
+
+   struct ring_hdr *hdr =
+      (struct ring_hdr *)(r->buf + (r->head & (r->size - 1)));
+   hdr->len = len;
+
+   const size_t next = r->head + sizeof(struct ring_hdr) + ring_align(len);
+   __atomic_store_n(&(r->head), next, __ATOMIC_RELEASE);
+
+   ring_wake(r);
+}
+
+void ring_flush(ring_t r)
+{
+   // Wait for the consumer to process every published record
+   while (__atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE) != r->head) {
+      ring_wake(r);
+      ring_wait(r);
+   }
+}
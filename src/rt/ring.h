@@ -0,0 +1,33 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <stddef.h>
+
+typedef struct ring *ring_t;
+
+typedef void (*ring_consume_fn_t)(const void *rec, size_t len, void *context);
+
+ring_t ring_new(size_t size, ring_consume_fn_t fn, void *context);
+void ring_free(ring_t r);
+void *ring_reserve(ring_t r, size_t len);
+void ring_commit(ring_t r, size_t len);
+void ring_flush(ring_t r);
+
+#endif  // _RING_H
@@ -21,11 +21,12 @@
 #include "ident.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
 struct tree;
 struct tree_rd_ctx;
 
-typedef void (*sig_event_fn_t)(uint64_t, struct tree *);
+typedef void (*sig_event_fn_t)(uint64_t, struct tree *, void *);
 
 typedef enum {
    BOUNDS_ARRAY_TO,
@@ -55,9 +56,13 @@ typedef enum {
 void rt_batch_exec(struct tree *e, uint64_t stop_time,
                    struct tree_rd_ctx *ctx);
 void rt_slave_exec(struct tree *e, struct tree_rd_ctx *ctx);
-void rt_set_event_cb(struct tree *s, sig_event_fn_t fn);
+void rt_set_event_cb(struct tree *s, sig_event_fn_t fn, void *context);
 size_t rt_signal_value(struct tree *s, uint64_t *buf, size_t max, bool last);
 uint64_t rt_now(void);
+void rt_profile_init(const char *file);
+void rt_checkpoint_init(uint64_t when, const char *file);
+void rt_restore_init(const char *file);
+void rt_wave_window(uint64_t start, uint64_t stop);
 
 void jit_init(ident_t top);
 void jit_shutdown(void);
@@ -71,8 +76,19 @@ const char *pprint(struct tree *t, const uint64_t *values, size_t len);
 
 void vcd_init(const char *file, struct tree *top);
 void vcd_restart(void);
+void vcd_dump(uint64_t now, bool on);
 
 void lxt_init(const char *file, struct tree *top);
 void lxt_restart(void);
+void lxt_dump(uint64_t now, bool on);
+
+void fst_init(const char *file, struct tree *top);
+void fst_restart(void);
+void fst_dump(uint64_t now, bool on);
+
+void wave_include_glob(const char *glob);
+void wave_exclude_glob(const char *glob);
+void wave_clear_globs(void);
+bool wave_should_dump(struct tree *decl);
 
 #endif  // _RT_H
@@ -23,9 +23,14 @@
 #include "slave.h"
 #include "alloc.h"
 #include "heap.h"
+#include "wheel.h"
+#include "pool.h"
 #include "common.h"
 #include "netdb.h"
 #include "cover.h"
+#include "hash.h"
+#include "fbuf.h"
+#include "pack.h"
 
 #include <assert.h>
 #include <stdint.h>
@@ -37,12 +42,22 @@
 #include <math.h>
 #include <errno.h>
 #include <alloca.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
 #define TRACE_DELTAQ  1
 #define TRACE_PENDING 0
 #define EXIT_SEVERITY 2
+#define PENDING_SHIFT 6
+#define DRIVER_SCAN   4
+#define DRIVER_CACHE  8
+#define PROFILE_TOP   20
+#define PROGRESS_TICK 1024
+
+#define CHECKPOINT_MAGIC 0x4e56434b   // NVCK
 
 typedef void (*proc_fn_t)(int32_t reset);
 typedef uint64_t (*resolution_fn_t)(uint64_t *vals, int32_t n);
@@ -55,6 +70,7 @@ typedef struct waveform  waveform_t;
 typedef struct sens_list sens_list_t;
 typedef struct watch     watch_t;
 typedef struct value     value_t;
+typedef struct staged    staged_t;
 
 struct tmp_chunk_hdr {
    struct tmp_chunk *next;
@@ -69,11 +85,24 @@ struct tmp_chunk {
    char buf[TMP_BUF_SZ];
 };
 
+struct driver_cache {
+   netgroup_t *group;
+   int         driver;
+};
+
 struct rt_proc {
-   tree_t            source;
-   proc_fn_t         proc_fn;
-   struct tmp_chunk *tmp_chunks;
-   uint32_t          wakeup_gen;
+   tree_t              source;
+   proc_fn_t           proc_fn;
+   struct tmp_chunk   *tmp_chunks;
+   uint32_t            wakeup_gen;
+   staged_t           *staged;
+   staged_t          **staged_tail;
+   bool                batched;
+   bool                serial;
+   uint64_t            activations;
+   uint64_t            run_ticks;
+   uint64_t            update_ticks;
+   struct driver_cache drivers[DRIVER_CACHE];
 };
 
 typedef enum { E_DRIVER, E_PROCESS } event_kind_t;
@@ -82,6 +111,7 @@ struct event {
    uint64_t      when;
    int           iteration;
    event_kind_t  kind;
+   int           driver;
    rt_proc_t    *proc;
    netgroup_t   *group;
 };
@@ -121,12 +151,15 @@ struct netgroup {
    value_t        *resolved;
    value_t        *last_value;
    uint16_t        size;
+   uint8_t         packed;
    uint16_t        n_drivers;
+   unsigned        drivers_alloc;
    driver_t       *drivers;
+   hash_t         *driver_map;
    resolution_fn_t resolution;
    uint64_t        last_event;
    tree_t          sig_decl;
-   value_t        *free_values;
+   rt_slab_t       value_slab;
    sens_list_t    *pending;
 };
 
@@ -154,35 +187,117 @@ struct run_queue {
 struct watch {
    tree_t         signal;
    sig_event_fn_t fn;
+   void          *context;
    uint32_t       wakeup_gen;
    watch_t       *next;
 };
 
+typedef enum { STAGE_PROCESS, STAGE_WAVEFORM, STAGE_EVENT } stage_kind_t;
+
+struct staged {
+   staged_t     *next;
+   stage_kind_t  kind;
+   int32_t       n;
+   int32_t       size;
+   int32_t       flag;
+   int64_t       after;
+   int64_t       reject;
+   int32_t      *nids;
+   void         *values;
+};
+
+struct stage_chunk {
+   struct stage_chunk *next;
+   size_t              alloced;
+   size_t              size;
+   char                buf[0];
+};
+
+#define STAGE_CHUNK_SZ 16384
+
+struct rt_worker {
+   rt_magazine_t       tmp_chunk_mag;
+   struct stage_chunk *stage_chunks;
+   uint64_t            tmp_spills;
+};
+
+struct batch_entry {
+   rt_proc_t *proc;
+   watch_t   *callback;
+};
+
+struct batch {
+   struct batch_entry *entries;
+   void              **procs;
+   void              **serial;
+   size_t              n_entries;
+   size_t              n_procs;
+   size_t              n_serial;
+   size_t              alloc;
+};
+
 static struct rt_proc   *procs = NULL;
-static struct rt_proc   *active_proc = NULL;
+static __thread struct rt_proc   *active_proc = NULL;
+static __thread struct rt_worker *active_worker = NULL;
 static struct loaded    *loaded = NULL;
 static struct run_queue  run_queue;
+static struct run_queue  delta_queue[2];
 
 static heap_t        eventq_heap = NULL;
+static wheel_t       eventq_wheel = NULL;
 static size_t        n_procs = 0;
 static uint64_t      now = 0;
 static int           iteration = -1;
 static bool          trace_on = false;
 static tree_rd_ctx_t tree_rd_ctx = NULL;
 static struct rusage ready_rusage;
+static rt_alloc_stats_t stack_stats[5];
+static bool             profiling = false;
+static const char      *profile_file = NULL;
+static uint64_t         profile_start_ticks;
+static uint64_t         profile_start_ns;
+static const char      *checkpoint_file = NULL;
+static uint64_t         checkpoint_at;
+static const char      *restore_file = NULL;
 static jmp_buf       fatal_jmp;
 static bool          aborted = false;
 static netdb_t      *netdb = NULL;
 static netgroup_t   *groups = NULL;
-static sens_list_t  *pending = NULL;
+static sens_list_t **pending = NULL;
+static unsigned      n_pending = 0;
+static netid_t       n_nets = 0;
+static uint64_t      n_events = 0;
+static uint64_t      n_pending_visits = 0;
+static uint64_t      n_cycles = 0;
+static uint64_t      n_deltas = 0;
+static int           max_deltas = 0;
+static uint64_t      n_transactions = 0;
+static uint64_t      n_rejected = 0;
+static uint64_t      n_sens_alloc = 0;
+static uint64_t      n_sens_reuse = 0;
+static size_t        peak_deltaq = 0;
+static uint64_t      progress_interval = 0;
+static uint64_t      progress_start = 0;
+static uint64_t      progress_next = 0;
+static uint64_t      wave_start = 0;
+static uint64_t      wave_stop = UINT64_MAX;
+static uint64_t      wave_next = UINT64_MAX;
+static bool          wave_on = true;
 static sens_list_t  *resume = NULL;
 static watch_t      *watches = NULL;
 
 static rt_alloc_stack_t event_stack = NULL;
 static rt_alloc_stack_t waveform_stack = NULL;
 static rt_alloc_stack_t sens_list_stack = NULL;
-static rt_alloc_stack_t tmp_chunk_stack = NULL;
 static rt_alloc_stack_t watch_stack = NULL;
+static rt_alloc_stack_t tmp_chunk_stack = NULL;
+
+static pool_t            pool = NULL;
+static struct rt_worker *workers = NULL;
+static int               n_workers = 0;
+static bool              staging = false;
+static struct batch      batch;
+static pthread_mutex_t   serial_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static netgroup_t **active_groups;
 static unsigned     n_active_groups = 0;
@@ -190,17 +305,45 @@ static unsigned     n_active_alloc = 0;
 
 static void deltaq_insert_proc(uint64_t delta, rt_proc_t *wake);
 static void deltaq_insert_driver(uint64_t delta, netgroup_t *group,
-                                 rt_proc_t *driver);
-static void rt_alloc_driver(netgroup_t *group, uint64_t after,
-                            uint64_t reject, value_t *values);
+                                 int driver);
+static void rt_push_queue(struct run_queue *rq, event_t *e);
+static event_t *rt_pop_queue(struct run_queue *rq);
+static staged_t *rt_stage(stage_kind_t kind, size_t nids_sz,
+                          size_t values_sz);
+static void rt_lock(void);
+static void rt_unlock(void);
+static int rt_alloc_driver(netgroup_t *group, uint64_t after,
+                           uint64_t reject, value_t *values);
 static void rt_sched_event(sens_kind_t kind, sens_list_t **list,
                            netid_t first, netid_t last, rt_proc_t *proc,
                            watch_t *callback);
+static void rt_sched_pending(netid_t first, netid_t last, rt_proc_t *proc);
 static void *rt_tmp_alloc(size_t sz);
 static value_t *rt_alloc_value(netgroup_t *g);
 static tree_t rt_recall_tree(const char *unit, int32_t where);
 static void _tracef(const char *fmt, ...);
 
+static inline size_t rt_value_size(netgroup_t *g)
+{
+   if (g->packed)
+      return pack_size(g->length, g->packed);
+   else
+      return g->size * g->length;
+}
+
+static inline uint64_t rt_ticks(void)
+{
+   // Cheap timestamp for profiling converted to nanoseconds when the
+   // report is printed
+#if defined __x86_64__ || defined __i386__
+   return __builtin_ia32_rdtsc();
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec * UINT64_C(1000000000)) + ts.tv_nsec;
+#endif
+}
+
 #define TRACE(...) if (unlikely(trace_on)) _tracef(__VA_ARGS__)
 
 #define FOR_ALL_SIZES(size, macro) do {                 \
@@ -305,6 +448,21 @@ static const char *fmt_values(const void *values, int length)
    return buf;
 }
 
+// Resolution table from the IEEE std_logic_1164 package body
+#define STD_LOGIC_Z 4
+static const uint8_t std_logic_table[9][9] = {
+   //  U  X  0  1  Z  W  L  H  -
+   {   0, 0, 0, 0, 0, 0, 0, 0, 0 },   // U
+   {   0, 1, 1, 1, 1, 1, 1, 1, 1 },   // X
+   {   0, 1, 2, 1, 2, 2, 2, 2, 1 },   // 0
+   {   0, 1, 1, 3, 3, 3, 3, 3, 1 },   // 1
+   {   0, 1, 2, 3, 4, 5, 6, 7, 1 },   // Z
+   {   0, 1, 2, 3, 5, 5, 5, 5, 1 },   // W
+   {   0, 1, 2, 3, 6, 5, 6, 5, 1 },   // L
+   {   0, 1, 2, 3, 7, 5, 5, 7, 1 },   // H
+   {   0, 1, 1, 1, 1, 1, 1, 1, 1 }    // -
+};
+
 static inline uint64_t heap_key(uint64_t when, event_kind_t kind)
 {
    // Use the bottom bit of the key to indicate the kind
@@ -317,6 +475,12 @@ static inline uint64_t heap_key(uint64_t when, event_kind_t kind)
 
 void _sched_process(int64_t delay)
 {
+   if (unlikely(staging)) {
+      staged_t *s = rt_stage(STAGE_PROCESS, 0, 0);
+      s->after = delay;
+      return;
+   }
+
    TRACE("_sched_process delay=%s", fmt_time(delay));
    deltaq_insert_proc(delay, active_proc);
 }
@@ -326,18 +490,45 @@ void _sched_waveform(void *_nids, void *values, int32_t n, int32_t size,
 {
    const int32_t *nids = _nids;
 
+   if (unlikely(staging)) {
+      staged_t *s = rt_stage(STAGE_WAVEFORM, n * sizeof(int32_t), n * size);
+      memcpy(s->nids, nids, n * sizeof(int32_t));
+      memcpy(s->values, values, n * size);
+      s->n      = n;
+      s->size   = size;
+      s->after  = after;
+      s->reject = reject;
+      s->flag   = reverse;
+      return;
+   }
+
    TRACE("_sched_waveform %s values=%s n=%d size=%d after=%s "
          "reject=%s reverse=%d", fmt_net(nids[0]),
          fmt_values(values, n * size), n, size, fmt_time(after),
          fmt_time(reject), reverse);
 
+   // Packed groups have one byte values and never extend past the end
+   // of the assignment so a single buffer of n bytes is enough for any
+   // of them to be reversed into
+   uint8_t *scratch = unlikely(reverse) ? alloca(n) : NULL;
+
    int offset = 0;
    while (offset < n) {
       netgroup_t *g = &(groups[netdb_lookup(netdb, nids[offset])]);
 
       value_t *values_copy = rt_alloc_value(g);
 
-      if (unlikely(reverse)) {
+      if (g->packed) {
+         const uint8_t *src = (uint8_t *)values + offset;
+         if (unlikely(reverse)) {
+            for (int i = 0; i < g->length; i++)
+               scratch[i] = *((uint8_t *)values + (n - offset - 1 - i));
+            src = scratch;
+         }
+
+         pack_values((uint8_t *)values_copy->data, src, g->length, g->packed);
+      }
+      else if (unlikely(reverse)) {
 #define COPY_VALUES(type) do {                                  \
             const type *vp = (type *)values + (n - offset - 1); \
             type *vc = (type *)values_copy->data;               \
@@ -351,8 +542,8 @@ void _sched_waveform(void *_nids, void *values, int32_t n, int32_t size,
          memcpy(values_copy->data, (uint8_t *)values + (offset * size),
                 size * g->length);
 
-      rt_alloc_driver(g, after, reject, values_copy);
-      deltaq_insert_driver(after, g, active_proc);
+      const int driver = rt_alloc_driver(g, after, reject, values_copy);
+      deltaq_insert_driver(after, g, driver);
 
       offset += g->length;
    }
@@ -362,6 +553,14 @@ void _sched_event(void *_nids, int32_t n, int32_t seq)
 {
    const int32_t *nids = _nids;
 
+   if (unlikely(staging)) {
+      staged_t *s = rt_stage(STAGE_EVENT, n * sizeof(int32_t), 0);
+      memcpy(s->nids, nids, n * sizeof(int32_t));
+      s->n    = n;
+      s->flag = seq;
+      return;
+   }
+
    TRACE("_sched_event %s n=%d seq=%d proc %s", fmt_net(nids[0]), n,
          seq, istr(tree_ident(active_proc->source)));
 
@@ -377,9 +576,9 @@ void _sched_event(void *_nids, int32_t n, int32_t seq)
          offset += g->length;
 
          if (seq && (offset < n)) {
-            // Place on the global pending list
-            rt_sched_event(S_PROCESS, &pending, nids[0], nids[n - 1],
-                           active_proc, NULL);
+            // Place on the global pending index
+            rt_sched_pending(MIN(nids[0], nids[n - 1]),
+                             MAX(nids[0], nids[n - 1]), active_proc);
             break;
          }
          else {
@@ -391,6 +590,46 @@ void _sched_event(void *_nids, int32_t n, int32_t seq)
    }
 }
 
+uint64_t _std_logic_resolved(const uint64_t *vals, int32_t n)
+{
+   // LRM 93 section 2.4 requires a single driver be returned unchanged
+   if (n == 1)
+      return vals[0];
+
+   uint8_t result = STD_LOGIC_Z;
+   for (int i = 0; i < n; i++)
+      result = std_logic_table[result][vals[i]];
+
+   return result;
+}
+
+static unsigned rt_packed_bits(tree_t decl, int32_t size)
+{
+   // Number of bits per element if signals of this type are stored
+   // packed or zero to use one element per byte
+
+   if ((size != 1) || !opt_get_int("rt-packed"))
+      return 0;
+
+   type_t type = tree_type(decl);
+   if (!type_is_array(type))
+      return 0;
+
+   type_t elem = type_base_recur(type_elem(type));
+   if (type_kind(elem) != T_ENUM)
+      return 0;
+
+   const unsigned nlits = type_enum_literals(elem);
+   if (nlits <= 2)
+      return 1;
+   else if (nlits <= 4)
+      return 2;
+   else if (nlits <= 16)
+      return 4;
+   else
+      return 0;
+}
+
 void _set_initial(int32_t nid, void *values, int32_t n, int32_t size,
                   void *resolution, int32_t index, const char *module)
 {
@@ -400,6 +639,8 @@ void _set_initial(int32_t nid, void *values, int32_t n, int32_t size,
    tree_t decl = rt_recall_tree(module, index);
    assert(tree_kind(decl) == T_SIGNAL_DECL);
 
+   const unsigned bits = rt_packed_bits(decl, size);
+
    int offset = 0;
    while (offset < n) {
       groupid_t gid = netdb_lookup(netdb, nid + offset);
@@ -408,12 +649,16 @@ void _set_initial(int32_t nid, void *values, int32_t n, int32_t size,
       g->sig_decl   = decl;
       g->resolution = resolution;
       g->size       = size;
+      g->packed     = (g->length > 1) ? bits : 0;
       g->resolved   = rt_alloc_value(g);
       g->last_value = rt_alloc_value(g);
 
       const void *src = (uint8_t *)values + (offset * size);
-      memcpy(g->resolved->data, src, g->length * size);
-      memcpy(g->last_value->data, src, g->length * size);
+      if (g->packed)
+         pack_values((uint8_t *)g->resolved->data, src, g->length, g->packed);
+      else
+         memcpy(g->resolved->data, src, g->length * size);
+      memcpy(g->last_value->data, g->resolved->data, rt_value_size(g));
 
       offset += g->length;
    }
@@ -431,6 +676,8 @@ void _assert_fail(const uint8_t *msg, int32_t msg_len, int8_t severity,
 
    assert(severity < 4);
 
+   rt_lock();
+
    const char *levels[] = {
       "Note", "Warning", "Error", "Failure"
    };
@@ -468,11 +715,15 @@ void _assert_fail(const uint8_t *msg, int32_t msg_len, int8_t severity,
 
    if (copy != NULL)
       free(copy);
+
+   rt_unlock();
 }
 
 void _bounds_fail(int32_t where, const char *module, int32_t value,
                   int32_t min, int32_t max, int32_t kind)
 {
+   rt_lock();
+
    tree_t t = rt_recall_tree(module, where);
    const loc_t *loc = tree_loc(t);
 
@@ -518,12 +769,14 @@ void _bounds_fail(int32_t where, const char *module, int32_t value,
 
 void _div_zero(int32_t where, const char *module)
 {
+   rt_lock();
    tree_t t = rt_recall_tree(module, where);
    fatal_at(tree_loc(t), "division by zero");
 }
 
 void _null_deref(int32_t where, const char *module)
 {
+   rt_lock();
    tree_t t = rt_recall_tree(module, where);
    fatal_at(tree_loc(t), "null access dereference");
 }
@@ -569,13 +822,13 @@ void _vec_load(const int32_t *nids, void *where, int32_t size, int32_t low,
       const int skip = nids[offset] - g->first;
       const int to_copy = MIN(high - offset + 1, g->length - skip);
 
+      const value_t *v = (last ? g->last_value : g->resolved);
+
       void *p = (uint8_t *)where + ((offset - low) * size);
-      if (unlikely(last))
-         memcpy(p, (uint8_t *)g->last_value->data + (skip * size),
-                to_copy * size);
+      if (g->packed)
+         unpack_values(p, (uint8_t *)v->data, skip, to_copy, g->packed);
       else
-         memcpy(p, (uint8_t *)g->resolved->data + (skip * size),
-                to_copy * size);
+         memcpy(p, (uint8_t *)v->data + (skip * size), to_copy * size);
 
       offset += g->length - skip;
    }
@@ -583,6 +836,8 @@ void _vec_load(const int32_t *nids, void *where, int32_t size, int32_t low,
 
 void _image(int64_t val, int32_t where, const char *module, struct uarray *u)
 {
+   rt_lock();
+
    tree_t t = rt_recall_tree(module, where);
 
    type_t type = tree_type(t);
@@ -624,6 +879,8 @@ void _image(int64_t val, int32_t where, const char *module, struct uarray *u)
       fatal_at(tree_loc(t), "cannot use 'IMAGE with this type");
    }
 
+   rt_unlock();
+
    u->ptr = buf;
    u->dims[0].left  = 0;
    u->dims[0].right = len - 1;
@@ -853,6 +1110,48 @@ static void _tracef(const char *fmt, ...)
    va_end(ap);
 }
 
+static void deltaq_insert(struct event *e)
+{
+   if (eventq_wheel != NULL) {
+      // Zero delay events bypass the timing wheel and wait on a FIFO
+      // for the next delta cycle
+      if (e->when == now)
+         rt_push_queue(&(delta_queue[e->kind]), e);
+      else
+         wheel_insert(eventq_wheel, heap_key(e->when, e->kind), e);
+   }
+   else
+      heap_insert(eventq_heap, heap_key(e->when, e->kind), e);
+}
+
+static size_t deltaq_size(void)
+{
+   if (eventq_wheel != NULL) {
+      size_t size = wheel_size(eventq_wheel);
+      for (int i = 0; i < ARRAY_LEN(delta_queue); i++)
+         size += delta_queue[i].wr - delta_queue[i].rd;
+      return size;
+   }
+   else
+      return heap_size(eventq_heap);
+}
+
+static uint64_t deltaq_next_when(void)
+{
+   if (eventq_wheel != NULL) {
+      for (int i = 0; i < ARRAY_LEN(delta_queue); i++) {
+         if (delta_queue[i].wr > delta_queue[i].rd)
+            return now;
+      }
+
+      return wheel_min_key(eventq_wheel) >> 1;
+   }
+   else {
+      event_t *peek = heap_min(eventq_heap);
+      return peek->when;
+   }
+}
+
 static void deltaq_insert_proc(uint64_t delta, struct rt_proc *wake)
 {
    struct event *e = rt_alloc(event_stack);
@@ -861,20 +1160,20 @@ static void deltaq_insert_proc(uint64_t delta, struct rt_proc *wake)
    e->kind      = E_PROCESS;
    e->proc      = wake;
 
-   heap_insert(eventq_heap, heap_key(e->when, e->kind), e);
+   deltaq_insert(e);
 }
 
 static void deltaq_insert_driver(uint64_t delta, netgroup_t *group,
-                                 rt_proc_t *driver)
+                                 int driver)
 {
    struct event *e = rt_alloc(event_stack);
    e->iteration = (delta == 0 ? iteration + 1 : 0);
    e->when      = now + delta;
    e->kind      = E_DRIVER;
    e->group     = group;
-   e->proc      = driver;
+   e->driver    = driver;
 
-   heap_insert(eventq_heap, heap_key(e->when, e->kind), e);
+   deltaq_insert(e);
 }
 
 #if TRACE_DELTAQ > 0
@@ -891,30 +1190,33 @@ static void deltaq_walk(uint64_t key, void *user, void *context)
 
 static void deltaq_dump(void)
 {
-   heap_walk(eventq_heap, deltaq_walk, NULL);
+   if (eventq_wheel != NULL) {
+      for (int i = 0; i < ARRAY_LEN(delta_queue); i++) {
+         for (size_t j = delta_queue[i].rd; j < delta_queue[i].wr; j++)
+            deltaq_walk(0, delta_queue[i].queue[j], NULL);
+      }
+
+      wheel_walk(eventq_wheel, deltaq_walk, NULL);
+   }
+   else
+      heap_walk(eventq_heap, deltaq_walk, NULL);
 }
 #endif
 
 static value_t *rt_alloc_value(netgroup_t *g)
 {
-   if (g->free_values == NULL) {
-      value_t *v = xmalloc(sizeof(struct value) + (g->size * g->length));
-      v->next = NULL;
-      return v;
-   }
-   else {
-      value_t *v = g->free_values;
-      g->free_values = v->next;
-      v->next = NULL;
-      return v;
-   }
+   if (unlikely(g->value_slab == NULL))
+      g->value_slab = rt_slab_get(sizeof(struct value) + rt_value_size(g));
+
+   value_t *v = rt_slab_alloc(g->value_slab);
+   v->next = NULL;
+   return v;
 }
 
 static void rt_free_value(netgroup_t *g, value_t *v)
 {
    assert(v->next == NULL);
-   v->next = g->free_values;
-   g->free_values = v;
+   rt_slab_free(g->value_slab, v);
 }
 
 static void *rt_tmp_alloc(size_t sz)
@@ -941,7 +1243,7 @@ static void *rt_tmp_alloc(size_t sz)
       return ptr;
    }
    else {
-      c = rt_alloc(tmp_chunk_stack);
+      c = rt_magazine_alloc(&(active_worker->tmp_chunk_mag));
       c->hdr.alloced  = sz;
       c->hdr.external = NULL;
       c->hdr.next     = active_proc->tmp_chunks;
@@ -950,8 +1252,82 @@ static void *rt_tmp_alloc(size_t sz)
 
       if (likely(sz <= TMP_BUF_SZ))
          return c->buf;
-      else
+      else {
+         ++(active_worker->tmp_spills);
          return (c->hdr.external = xmalloc(sz));
+      }
+   }
+}
+
+static void rt_worker_init(struct rt_worker *w)
+{
+   rt_magazine_init(&(w->tmp_chunk_mag), tmp_chunk_stack);
+   w->stage_chunks = NULL;
+   w->tmp_spills   = 0;
+}
+
+static void rt_lock(void)
+{
+   // Runtime functions that touch the tree or other global state must
+   // not be called concurrently by processes running in parallel
+   if (unlikely(staging))
+      pthread_mutex_lock(&serial_lock);
+}
+
+static void rt_unlock(void)
+{
+   if (unlikely(staging))
+      pthread_mutex_unlock(&serial_lock);
+}
+
+static staged_t *rt_stage(stage_kind_t kind, size_t nids_sz,
+                          size_t values_sz)
+{
+   // Record a scheduling operation from a process running on a worker
+   // thread to be replayed in process order at the end of the batch
+
+   const size_t align  = sizeof(uint64_t) - 1;
+   const size_t nids_r = (nids_sz + align) & ~align;
+   const size_t sz = ((sizeof(staged_t) + align) & ~align) + nids_r + values_sz;
+
+   struct stage_chunk *c = active_worker->stage_chunks;
+   if ((c == NULL) || (c->size - c->alloced < sz)) {
+      const size_t chunksz = MAX(STAGE_CHUNK_SZ, sz);
+      c = xmalloc(sizeof(struct stage_chunk) + chunksz);
+      c->next    = active_worker->stage_chunks;
+      c->alloced = 0;
+      c->size    = chunksz;
+
+      active_worker->stage_chunks = c;
+   }
+
+   staged_t *st = (staged_t *)(c->buf + c->alloced);
+   c->alloced += (sz + align) & ~align;
+
+   char *data = (char *)st + ((sizeof(staged_t) + align) & ~align);
+
+   st->next   = NULL;
+   st->kind   = kind;
+   st->nids   = (int32_t *)data;
+   st->values = data + nids_r;
+
+   *(active_proc->staged_tail) = st;
+   active_proc->staged_tail = &(st->next);
+
+   return st;
+}
+
+static void rt_stage_reset(struct rt_worker *w)
+{
+   // Keep the most recent chunk for the next batch
+   struct stage_chunk *c = w->stage_chunks;
+   if (c != NULL) {
+      while (c->next != NULL) {
+         struct stage_chunk *next = c->next->next;
+         free(c->next);
+         c->next = next;
+      }
+      c->alloced = 0;
    }
 }
 
@@ -980,6 +1356,8 @@ static void rt_sched_event(sens_kind_t kind, sens_list_t **list,
    }
 
    if (it == NULL) {
+      ++n_sens_alloc;
+
       sens_list_t *node = rt_alloc(sens_list_stack);
       node->kind       = kind;
       node->proc       = proc;
@@ -993,19 +1371,50 @@ static void rt_sched_event(sens_kind_t kind, sens_list_t **list,
    }
    else {
       // Reuse the stale entry
+      ++n_sens_reuse;
+
       it->wakeup_gen = wakeup_gen;
       it->first      = first;
       it->last       = last;
    }
 }
 
+static void rt_sched_pending(netid_t first, netid_t last, rt_proc_t *proc)
+{
+   // The global pending index is bucketed by net ID so an event only
+   // has to test the entries whose range shares a bucket with the
+   // group. A range spanning several buckets has an entry in each of
+   // them: the wakeup generation check discards the duplicates and
+   // they are removed the next time their bucket is scanned.
+
+   const unsigned lo = first >> PENDING_SHIFT;
+   const unsigned hi = last >> PENDING_SHIFT;
+   assert(hi < n_pending);
+
+   for (unsigned b = lo; b <= hi; b++)
+      rt_sched_event(S_PROCESS, &(pending[b]), first, last, proc, NULL);
+}
+
+static void rt_free_pending(void)
+{
+   for (unsigned b = 0; b < n_pending; b++) {
+      while (pending[b] != NULL) {
+         sens_list_t *next = pending[b]->next;
+         rt_free(sens_list_stack, pending[b]);
+         pending[b] = next;
+      }
+   }
+}
+
 #if TRACE_PENDING
 static void rt_dump_pending(void)
 {
-   for (struct sens_list *it = pending; it != NULL; it = it->next) {
-      printf("%d..%d\t%s%s\n", it->first, it->last,
-             istr(tree_ident(it->proc->source)),
-             (it->wakeup_gen == it->proc->wakeup_gen) ? "" : "(stale)");
+   for (unsigned b = 0; b < n_pending; b++) {
+      for (struct sens_list *it = pending[b]; it != NULL; it = it->next) {
+         printf("%d..%d\t%s%s\n", it->first, it->last,
+                istr(tree_ident(it->proc->source)),
+                (it->wakeup_gen == it->proc->wakeup_gen) ? "" : "(stale)");
+      }
    }
 }
 #endif  // TRACE_PENDING
@@ -1018,14 +1427,19 @@ static void rt_reset_group(groupid_t gid, netid_t first, unsigned length)
    g->resolved    = NULL;
    g->last_value  = NULL;
    g->size        = 0;
+   g->packed      = 0;
    g->flags       = 0;
-   g->n_drivers   = 0;
-   g->drivers     = NULL;
+   g->n_drivers     = 0;
+   g->drivers_alloc = 0;
+   g->drivers       = NULL;
+   g->driver_map    = NULL;
    g->resolution  = NULL;
    g->last_event  = INT64_MAX;
    g->sig_decl    = NULL;
-   g->free_values = NULL;
+   g->value_slab  = NULL;
    g->pending     = NULL;
+
+   n_nets = MAX(n_nets, first + length);
 }
 
 static void rt_setup(tree_t top)
@@ -1037,7 +1451,20 @@ static void rt_setup(tree_t top)
 
    if (eventq_heap != NULL)
       heap_free(eventq_heap);
-   eventq_heap = heap_new(512);
+   if (eventq_wheel != NULL)
+      wheel_free(eventq_wheel);
+
+   if (opt_get_int("rt-wheel")) {
+      eventq_heap  = NULL;
+      eventq_wheel = wheel_new();
+   }
+   else {
+      eventq_heap  = heap_new(512);
+      eventq_wheel = NULL;
+   }
+
+   for (int i = 0; i < ARRAY_LEN(delta_queue); i++)
+      delta_queue[i].wr = delta_queue[i].rd = 0;
 
    if (netdb == NULL) {
       netdb = netdb_open(top);
@@ -1051,6 +1478,15 @@ static void rt_setup(tree_t top)
 
    netdb_walk(netdb, rt_reset_group);
 
+   if (pending == NULL) {
+      n_pending = (n_nets >> PENDING_SHIFT) + 1;
+      pending = xmalloc(sizeof(sens_list_t *) * n_pending);
+      for (unsigned b = 0; b < n_pending; b++)
+         pending[b] = NULL;
+   }
+   else
+      rt_free_pending();
+
    const int nstmts = tree_stmts(top);
    for (int i = 0; i < nstmts; i++) {
       tree_t p = tree_stmt(top, i);
@@ -1058,8 +1494,18 @@ static void rt_setup(tree_t top)
 
       procs[i].source     = p;
       procs[i].proc_fn    = jit_fun_ptr(istr(tree_ident(p)), true);
-      procs[i].wakeup_gen = 0;
-      procs[i].tmp_chunks = NULL;
+      procs[i].wakeup_gen  = 0;
+      procs[i].tmp_chunks  = NULL;
+      procs[i].staged      = NULL;
+      procs[i].staged_tail = &(procs[i].staged);
+      procs[i].batched     = false;
+      procs[i].serial      = false;
+      procs[i].activations  = 0;
+      procs[i].run_ticks    = 0;
+      procs[i].update_ticks = 0;
+
+      for (int j = 0; j < DRIVER_CACHE; j++)
+         procs[i].drivers[j].group = NULL;
 
       TRACE("process %s at %p", istr(tree_ident(p)), procs[i].proc_fn);
    }
@@ -1071,7 +1517,15 @@ static void rt_run(struct rt_proc *proc, bool reset)
          istr(tree_ident(proc->source)));
 
    active_proc = proc;
-   (*proc->proc_fn)(reset ? 1 : 0);
+
+   if (unlikely(profiling)) {
+      const uint64_t start = rt_ticks();
+      (*proc->proc_fn)(reset ? 1 : 0);
+      proc->run_ticks += rt_ticks() - start;
+      ++(proc->activations);
+   }
+   else
+      (*proc->proc_fn)(reset ? 1 : 0);
 
    // Free any temporary memory allocated by the process
    while (proc->tmp_chunks) {
@@ -1079,7 +1533,7 @@ static void rt_run(struct rt_proc *proc, bool reset)
       proc->tmp_chunks = n->hdr.next;
       if (n->hdr.external != NULL)
          free(n->hdr.external);
-      rt_free(tmp_chunk_stack, n);
+      rt_magazine_free(&(active_worker->tmp_chunk_mag), n);
    }
 }
 
@@ -1093,10 +1547,8 @@ static void rt_call_module_reset(ident_t name)
       (*reset_fn)();
 }
 
-static void rt_initial(tree_t top)
+static void rt_reset_modules(tree_t top)
 {
-   // Initialisation is described in LRM 93 section 12.6.4
-
    const int ncontext = tree_contexts(top);
    for (int i = 0; i < ncontext; i++) {
       tree_t c = tree_context(top, i);
@@ -1108,6 +1560,13 @@ static void rt_initial(tree_t top)
    }
 
    rt_call_module_reset(tree_ident(top));
+}
+
+static void rt_initial(tree_t top)
+{
+   // Initialisation is described in LRM 93 section 12.6.4
+
+   rt_reset_modules(top);
 
    for (size_t i = 0; i < n_procs; i++)
       rt_run(&procs[i], true /* reset */);
@@ -1159,35 +1618,81 @@ static void rt_wakeup(sens_list_t *sl)
       rt_free(sens_list_stack, sl);
 }
 
-static void rt_alloc_driver(netgroup_t *group, uint64_t after,
-                            uint64_t reject, value_t *values)
+static int rt_find_driver(netgroup_t *group, rt_proc_t *proc)
+{
+   // Groups with many drivers such as tristate buses keep a hash table
+   // from process to driver index to avoid a linear search on every
+   // transaction
+
+   if (group->driver_map != NULL)
+      return (intptr_t)hash_get(group->driver_map, proc) - 1;
+
+   for (int driver = 0; driver < group->n_drivers; driver++) {
+      if (likely(group->drivers[driver].proc == proc))
+         return driver;
+   }
+
+   return -1;
+}
+
+static int rt_new_driver(netgroup_t *group, rt_proc_t *proc)
+{
+   if (unlikely(group->n_drivers == group->drivers_alloc)) {
+      group->drivers_alloc = MAX(group->drivers_alloc * 2, 1);
+      group->drivers = xrealloc(group->drivers,
+                                group->drivers_alloc * sizeof(struct driver));
+   }
+
+   const int driver = (group->n_drivers)++;
+
+   driver_t *d = &(group->drivers[driver]);
+   d->proc      = proc;
+   d->waveforms = NULL;
+
+   if (group->driver_map != NULL)
+      hash_put(group->driver_map, proc, (void *)(intptr_t)(driver + 1));
+   else if (group->n_drivers > DRIVER_SCAN) {
+      group->driver_map = hash_new(group->n_drivers * 2, true);
+      for (int i = 0; i < group->n_drivers; i++)
+         hash_put(group->driver_map, group->drivers[i].proc,
+                  (void *)(intptr_t)(i + 1));
+   }
+
+   TRACE("allocate driver %s %d %s", fmt_group(group), driver,
+         istr(tree_ident(proc->source)));
+
+   return driver;
+}
+
+static int rt_alloc_driver(netgroup_t *group, uint64_t after,
+                           uint64_t reject, value_t *values)
 {
    if (unlikely(reject > after))
       fatal("signal %s pulse reject limit %s is greater than "
             "delay %s", fmt_group(group), fmt_time(reject), fmt_time(after));
 
-   // Try to find this process in the list of existing drivers
-   int driver;
-   for (driver = 0; driver < group->n_drivers; driver++) {
-      if (likely(group->drivers[driver].proc == active_proc))
-         break;
-   }
+   // Driver indexes never change once allocated so each process
+   // remembers the index it last used for a group to avoid searching
+   // the drivers on every transaction
+   struct driver_cache *dc =
+      &(active_proc->drivers[(group - groups) % DRIVER_CACHE]);
 
-   // Allocate memory for drivers on demand
-   if (unlikely(driver == group->n_drivers)) {
-      const size_t driver_sz = sizeof(struct driver);
-      group->drivers = xrealloc(group->drivers, (driver + 1) * driver_sz);
-      memset(&group->drivers[group->n_drivers], '\0',
-             (driver + 1 - group->n_drivers) * driver_sz);
-      group->n_drivers = driver + 1;
+   int driver;
+   if (likely(dc->group == group))
+      driver = dc->driver;
+   else {
+      if ((driver = rt_find_driver(group, active_proc)) < 0)
+         driver = rt_new_driver(group, active_proc);
 
-      TRACE("allocate driver %s %d %s", fmt_group(group), driver,
-            istr(tree_ident(active_proc->source)));
+      dc->group  = group;
+      dc->driver = driver;
    }
 
    driver_t *d = &(group->drivers[driver]);
 
-   const size_t valuesz = group->size * group->length;
+   const size_t valuesz = rt_value_size(group);
+
+   ++n_transactions;
 
    if (unlikely(d->waveforms == NULL)) {
       // Assigning the initial value of a driver
@@ -1198,7 +1703,6 @@ static void rt_alloc_driver(netgroup_t *group, uint64_t after,
       memcpy(dummy->values->data, values, valuesz);
 
       d->waveforms = dummy;
-      d->proc      = active_proc;
    }
 
    waveform_t *w = rt_alloc(waveform_stack);
@@ -1214,6 +1718,8 @@ static void rt_alloc_driver(netgroup_t *group, uint64_t after,
       // delete the current transaction
       if ((it->when >= w->when - reject)
           && (memcmp(it->values->data, w->values->data, valuesz) != 0)) {
+         ++n_rejected;
+
          waveform_t *next = it->next;
          last->next = next;
          rt_free_value(group, it->values);
@@ -1237,34 +1743,37 @@ static void rt_alloc_driver(netgroup_t *group, uint64_t after,
       rt_free(waveform_stack, it);
       it = it->next;
    }
+
+   return driver;
 }
 
-static void rt_update_group(netgroup_t *group, int driver, void *values)
+static void rt_resolve_values(netgroup_t *group, const void **inputs,
+                              void *resolved)
 {
-   const size_t valuesz = group->size * group->length;
-
-   TRACE("update group %s values=%s driver=%d",
-         fmt_group(group), fmt_values(values, valuesz), driver);
-
-   void *resolved = values;
-   if (unlikely(group->n_drivers > 1)) {
-      // If there is more than one driver call the resolution function
+   // Compute the resolved value of every element in the group from the
+   // unpacked value of each driver
 
-      if (unlikely(group->resolution == NULL))
-         fatal_at(tree_loc(group->sig_decl), "group %s has multiple drivers "
-                  "but no resolution function", fmt_group(group));
+   if (group->resolution == (resolution_fn_t)_std_logic_resolved) {
+      // Fold each driver's whole value array into the result through
+      // the std_logic table rather than calling a function per element
+      assert(group->size == 1);
 
-      resolved = alloca(valuesz);
+      uint8_t *restrict r = resolved;
+      memset(r, STD_LOGIC_Z, group->length);
 
+      for (int i = 0; i < group->n_drivers; i++) {
+         const uint8_t *restrict v = inputs[i];
+         for (int j = 0; j < group->length; j++)
+            r[j] = std_logic_table[r[j]][v[j]];
+      }
+   }
+   else {
       for (int j = 0; j < group->length; j++) {
          uint64_t vals[group->n_drivers];
 
 #define CALL_RESOLUTION_FN(type) do {                                   \
-            for (int i = 0; i < group->n_drivers; i++) {                \
-               const value_t *v = group->drivers[i].waveforms->values;  \
-               vals[i] = ((const type *)v->data)[j];                    \
-            }                                                           \
-            vals[driver] = ((const type *)values)[j];                   \
+            for (int i = 0; i < group->n_drivers; i++)                  \
+               vals[i] = ((const type *)inputs[i])[j];                  \
             type *r = (type *)resolved;                                 \
             r[j] = (*group->resolution)(vals, group->n_drivers);        \
          } while (0)
@@ -1272,6 +1781,55 @@ static void rt_update_group(netgroup_t *group, int driver, void *values)
          FOR_ALL_SIZES(group->size, CALL_RESOLUTION_FN);
       }
    }
+}
+
+static void rt_resolve_group(netgroup_t *group, int driver,
+                             const void *values, void *resolved)
+{
+   if (unlikely(group->resolution == NULL))
+      fatal_at(tree_loc(group->sig_decl), "group %s has multiple drivers "
+               "but no resolution function", fmt_group(group));
+
+   const void *inputs[group->n_drivers];
+
+   if (group->packed) {
+      // Resolution functions operate on one element per byte so unpack
+      // each driver first and pack the result afterwards
+      uint8_t *rows = alloca((group->n_drivers + 1) * group->length);
+      for (int i = 0; i < group->n_drivers; i++) {
+         const void *src =
+            (i == driver) ? values : group->drivers[i].waveforms->values->data;
+         uint8_t *row = rows + (i * group->length);
+         unpack_values(row, src, 0, group->length, group->packed);
+         inputs[i] = row;
+      }
+
+      uint8_t *tmp = rows + (group->n_drivers * group->length);
+      rt_resolve_values(group, inputs, tmp);
+      pack_values(resolved, tmp, group->length, group->packed);
+   }
+   else {
+      for (int i = 0; i < group->n_drivers; i++)
+         inputs[i] =
+            (i == driver) ? values : group->drivers[i].waveforms->values->data;
+
+      rt_resolve_values(group, inputs, resolved);
+   }
+}
+
+static void rt_update_group(netgroup_t *group, int driver, void *values)
+{
+   const size_t valuesz = rt_value_size(group);
+
+   TRACE("update group %s values=%s driver=%d",
+         fmt_group(group), fmt_values(values, valuesz), driver);
+
+   void *resolved = values;
+   if (unlikely(group->n_drivers > 1)) {
+      // If there is more than one driver call the resolution function
+      resolved = alloca(valuesz);
+      rt_resolve_group(group, driver, values, resolved);
+   }
 
    int32_t new_flags = NET_F_ACTIVE;
    if (memcmp(group->resolved->data, resolved, valuesz) != 0)
@@ -1303,6 +1861,8 @@ static void rt_update_group(netgroup_t *group, int driver, void *values)
    if (new_flags & NET_F_EVENT) {
       sens_list_t *it, *last = NULL, *next = NULL;
 
+      ++n_events;
+
       // First wakeup everything on the group specific pending list
       for (it = group->pending; it != NULL; it = next) {
          next = it->next;
@@ -1310,45 +1870,54 @@ static void rt_update_group(netgroup_t *group, int driver, void *values)
          group->pending = next;
       }
 
-      // Now check the global pending list
-      for (it = pending; it != NULL; it = next) {
-         next = it->next;
-
-         const netid_t x = group->first;
-         const netid_t y = group->first + group->length - 1;
-         const netid_t a = it->first;
-         const netid_t b = it->last;
-
-         const bool hit = (x <= b) && (a <= y);
-
-         if (hit) {
-            rt_wakeup(it);
-            if (last == NULL)
-               pending = next;
+      // Now check the buckets of the global pending index
+      const netid_t x = group->first;
+      const netid_t y = group->first + group->length - 1;
+
+      const unsigned hi = y >> PENDING_SHIFT;
+      for (unsigned bucket = x >> PENDING_SHIFT; bucket <= hi; bucket++) {
+         last = NULL;
+         for (it = pending[bucket]; it != NULL; it = next) {
+            next = it->next;
+            ++n_pending_visits;
+
+            const netid_t a = it->first;
+            const netid_t b = it->last;
+
+            // Copies left in other buckets by a range which has already
+            // woken its process are freed by rt_wakeup
+            const bool stale = (it->wakeup_gen != it->proc->wakeup_gen);
+            const bool hit = stale || ((x <= b) && (a <= y));
+
+            if (hit) {
+               rt_wakeup(it);
+               if (last == NULL)
+                  pending[bucket] = next;
+               else
+                  last->next = next;
+            }
             else
-               last->next = next;
+               last = it;
          }
-         else
-            last = it;
       }
    }
 }
 
-static void rt_update_driver(netgroup_t *group, rt_proc_t *proc)
+static void rt_update_driver(netgroup_t *group, int driver)
 {
-   // Find the driver owned by proc
-   int driver;
-   for (driver = 0; driver < group->n_drivers; driver++) {
-      if (likely(group->drivers[driver].proc == proc))
-         break;
-   }
-   assert(driver != group->n_drivers);
+   assert(driver < group->n_drivers);
 
    waveform_t *w_now  = group->drivers[driver].waveforms;
    waveform_t *w_next = w_now->next;
 
    if (w_next != NULL && w_next->when == now) {
-      rt_update_group(group, driver, w_next->values->data);
+      if (unlikely(profiling)) {
+         const uint64_t start = rt_ticks();
+         rt_update_group(group, driver, w_next->values->data);
+         group->drivers[driver].proc->update_ticks += rt_ticks() - start;
+      }
+      else
+         rt_update_group(group, driver, w_next->values->data);
       group->drivers[driver].waveforms = w_next;
       rt_free_value(group, w_now->values);
       rt_free(waveform_stack, w_now);
@@ -1357,38 +1926,124 @@ static void rt_update_driver(netgroup_t *group, rt_proc_t *proc)
       assert(w_now != NULL);
 }
 
-static void rt_push_run_queue(struct event *e)
+static void rt_push_queue(struct run_queue *rq, struct event *e)
 {
-   if (unlikely(run_queue.wr == run_queue.alloc)) {
-      if (run_queue.alloc == 0) {
-         run_queue.alloc = 128;
-         run_queue.queue = xmalloc(sizeof(struct event *) * run_queue.alloc);
+   if (unlikely(rq->wr == rq->alloc)) {
+      if (rq->alloc == 0) {
+         rq->alloc = 128;
+         rq->queue = xmalloc(sizeof(struct event *) * rq->alloc);
       }
       else {
-         run_queue.alloc *= 2;
-         run_queue.queue = realloc(run_queue.queue,
-                                   sizeof(struct event *) * run_queue.alloc);
+         rq->alloc *= 2;
+         rq->queue = realloc(rq->queue, sizeof(struct event *) * rq->alloc);
       }
    }
 
-   run_queue.queue[(run_queue.wr)++] = e;
+   rq->queue[(rq->wr)++] = e;
 }
 
-static struct event *rt_pop_run_queue(void)
+static struct event *rt_pop_queue(struct run_queue *rq)
 {
-   if (run_queue.wr == run_queue.rd) {
-      run_queue.wr = 0;
-      run_queue.rd = 0;
+   if (rq->wr == rq->rd) {
+      rq->wr = 0;
+      rq->rd = 0;
       return NULL;
    }
    else
-      return run_queue.queue[(run_queue.rd)++];
+      return rq->queue[(rq->rd)++];
+}
+
+static void rt_batch_worker(void *item, int thread, void *context)
+{
+   active_worker = &(workers[thread]);
+   rt_run(item, false /* reset */);
+}
+
+static void rt_batch_flush(void)
+{
+   if (batch.n_entries == 0)
+      return;
+
+   staging = true;
+   pool_run(pool, batch.procs, batch.n_procs, rt_batch_worker, NULL);
+
+   // Processes with side effects outside the kernel such as printing
+   // reports, file access or shared variables run one at a time in the
+   // order they would have run serially
+   active_worker = &(workers[0]);
+   for (size_t i = 0; i < batch.n_serial; i++)
+      rt_run(batch.serial[i], false);
+
+   staging = false;
+
+   // Apply the side effects of each process in the order they would
+   // have happened if the processes had run serially
+   for (size_t i = 0; i < batch.n_entries; i++) {
+      struct batch_entry *b = &(batch.entries[i]);
+      if (b->proc != NULL) {
+         active_proc = b->proc;
+         for (staged_t *it = b->proc->staged; it != NULL; it = it->next) {
+            switch (it->kind) {
+            case STAGE_PROCESS:
+               _sched_process(it->after);
+               break;
+            case STAGE_WAVEFORM:
+               _sched_waveform(it->nids, it->values, it->n, it->size,
+                               it->after, it->reject, it->flag);
+               break;
+            case STAGE_EVENT:
+               _sched_event(it->nids, it->n, it->flag);
+               break;
+            }
+         }
+
+         b->proc->staged      = NULL;
+         b->proc->staged_tail = &(b->proc->staged);
+         b->proc->batched     = false;
+      }
+      else {
+         (*b->callback->fn)(now, b->callback->signal, b->callback->context);
+         rt_watch_signal(b->callback);
+      }
+   }
+
+   for (int i = 0; i < n_workers; i++)
+      rt_stage_reset(&(workers[i]));
+
+   batch.n_entries = 0;
+   batch.n_procs   = 0;
+   batch.n_serial  = 0;
 }
 
-static void rt_cycle(void)
+static void rt_batch_push(rt_proc_t *proc, watch_t *callback)
 {
-   // Simulation cycle is described in LRM 93 section 12.6.4
+   // A process cannot run twice in the same batch
+   if ((proc != NULL) && proc->batched)
+      rt_batch_flush();
+
+   if (unlikely(batch.n_entries == batch.alloc)) {
+      batch.alloc   = MAX(batch.alloc * 2, 128);
+      batch.entries = xrealloc(batch.entries,
+                               batch.alloc * sizeof(struct batch_entry));
+      batch.procs   = xrealloc(batch.procs, batch.alloc * sizeof(void *));
+      batch.serial  = xrealloc(batch.serial, batch.alloc * sizeof(void *));
+   }
+
+   struct batch_entry *b = &(batch.entries[(batch.n_entries)++]);
+   b->proc     = proc;
+   b->callback = callback;
+
+   if (proc != NULL) {
+      proc->batched = true;
+      if (proc->serial)
+         batch.serial[(batch.n_serial)++] = proc;
+      else
+         batch.procs[(batch.n_procs)++] = proc;
+   }
+}
 
+static void rt_dequeue_heap(void)
+{
    event_t *peek = heap_min(eventq_heap);
 
    if (peek->when > now) {
@@ -1399,19 +2054,8 @@ static void rt_cycle(void)
    else
       iteration = peek->iteration;
 
-   TRACE("begin cycle");
-
-#if TRACE_DELTAQ > 0
-   if (trace_on)
-      deltaq_dump();
-#endif
-#if TRACE_PENDING > 0
-   if (trace_on)
-      rt_dump_pending();
-#endif
-
-   for (;;) {
-      rt_push_run_queue(heap_extract_min(eventq_heap));
+   for (;;) {
+      rt_push_queue(&run_queue, heap_extract_min(eventq_heap));
 
       if (heap_size(eventq_heap) == 0)
          break;
@@ -1420,15 +2064,281 @@ static void rt_cycle(void)
       if (peek->when > now || peek->iteration != iteration)
          break;
    }
+}
+
+static void rt_dequeue_wheel(void)
+{
+   struct run_queue *drivers = &(delta_queue[E_DRIVER]);
+   struct run_queue *procs   = &(delta_queue[E_PROCESS]);
+
+   if ((drivers->wr > drivers->rd) || (procs->wr > procs->rd)) {
+      // The run queue is empty between cycles so swap it with the
+      // driver delta queue rather than copying
+      struct run_queue tmp = run_queue;
+      run_queue = *drivers;
+      *drivers = tmp;
+
+      event_t *e;
+      while ((e = rt_pop_queue(procs)))
+         rt_push_queue(&run_queue, e);
+
+      ++iteration;
+   }
+   else {
+      event_t *peek = wheel_min(eventq_wheel);
+      assert(peek->when > now);
+      assert(peek->iteration == 0);
+
+      now = peek->when;
+      iteration = 0;
+
+      do {
+         rt_push_queue(&run_queue, wheel_extract_min(eventq_wheel));
+      } while ((wheel_size(eventq_wheel) > 0)
+               && ((wheel_min_key(eventq_wheel) >> 1) == now));
+   }
+}
+
+struct serial_ctx {
+   hash_t  *locals;
+   hash_t  *bodies;
+   tree_t  *calls;
+   size_t   n_calls;
+   bool     serial;
+   bool     tentative;
+};
+
+#define SERIAL_YES     ((void *)1)
+#define SERIAL_NO      ((void *)2)
+#define SERIAL_PENDING ((void *)3)
+
+static void rt_serial_local(tree_t t, void *context)
+{
+   hash_put((hash_t *)context, t, t);
+}
+
+static void rt_serial_check(tree_t t, void *context)
+{
+   struct serial_ctx *ctx = context;
+
+   switch (tree_kind(t)) {
+   case T_ASSERT:
+      ctx->serial = true;
+      break;
+
+   case T_REF:
+      {
+         // Variables declared outside the process or subprogram are
+         // shared or package variables
+         tree_t decl = tree_ref(t);
+         switch (tree_kind(decl)) {
+         case T_FILE_DECL:
+            ctx->serial = true;
+            break;
+         case T_VAR_DECL:
+            if (hash_get(ctx->locals, decl) == NULL)
+               ctx->serial = true;
+            break;
+         default:
+            break;
+         }
+      }
+      break;
+
+   case T_FCALL:
+   case T_PCALL:
+      {
+         tree_t decl = tree_ref(t);
+         switch (tree_kind(decl)) {
+         case T_FUNC_BODY:
+         case T_PROC_BODY:
+            // Nested subprograms are checked along with this tree
+            if (hash_get(ctx->locals, decl) != NULL)
+               break;
+
+            ctx->calls = xrealloc(ctx->calls,
+                                  (ctx->n_calls + 1) * sizeof(tree_t));
+            ctx->calls[(ctx->n_calls)++] = decl;
+            break;
+         default:
+            // Nothing is known about a subprogram without a body
+            // unless it is built in
+            if (tree_attr_str(decl, ident_new("builtin")) == NULL)
+               ctx->serial = true;
+            break;
+         }
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+static bool rt_serial_tree(tree_t t, hash_t *bodies, bool *tentative)
+{
+   void *memo = hash_get(bodies, t);
+   if (memo == SERIAL_PENDING) {
+      // Recursive call: the answer depends on the body being checked
+      *tentative = true;
+      return false;
+   }
+   else if (memo != NULL)
+      return (memo == SERIAL_YES);
+
+   hash_put(bodies, t, SERIAL_PENDING);
+
+   struct serial_ctx ctx = {
+      .locals    = hash_new(64, true),
+      .bodies    = bodies,
+      .calls     = NULL,
+      .n_calls   = 0,
+      .serial    = false,
+      .tentative = false
+   };
+
+   tree_visit_only(t, rt_serial_local, ctx.locals, T_VAR_DECL);
+   tree_visit_only(t, rt_serial_local, ctx.locals, T_FUNC_BODY);
+   tree_visit_only(t, rt_serial_local, ctx.locals, T_PROC_BODY);
+   tree_visit(t, rt_serial_check, &ctx);
+
+   for (size_t i = 0; (i < ctx.n_calls) && !ctx.serial; i++)
+      ctx.serial = rt_serial_tree(ctx.calls[i], bodies, &ctx.tentative);
+
+   hash_free(ctx.locals);
+   free(ctx.calls);
+
+   // A result that relied on a body still being checked is only known
+   // once the outermost call completes
+   if (ctx.tentative && !ctx.serial)
+      hash_put(bodies, t, NULL);
+   else
+      hash_put(bodies, t, ctx.serial ? SERIAL_YES : SERIAL_NO);
+
+   *tentative = *tentative || (ctx.tentative && !ctx.serial);
+   return ctx.serial;
+}
+
+static void rt_find_serial_procs(void)
+{
+   // Processes which print, access files, or use shared or package
+   // variables cannot run concurrently without changing the results
+   hash_t *bodies = hash_new(256, true);
+
+   for (size_t i = 0; i < n_procs; i++) {
+      bool tentative = false;
+      procs[i].serial = rt_serial_tree(procs[i].source, bodies, &tentative);
+   }
+
+   hash_free(bodies);
+}
+
+static void rt_start_threads(void)
+{
+   const int nthreads = opt_get_int("rt-threads");
+   if (nthreads <= 1)
+      return;
+   else if (trace_on) {
+      warnf("tracing is not supported with multiple threads");
+      return;
+   }
+   else if (jit_var_ptr("cover_stmts", false) != NULL) {
+      warnf("coverage is not supported with multiple threads");
+      return;
+   }
+
+   workers = xrealloc(workers, nthreads * sizeof(struct rt_worker));
+   for (int i = n_workers; i < nthreads; i++)
+      rt_worker_init(&(workers[i]));
+   n_workers = nthreads;
+
+   active_worker = &(workers[0]);
+
+   rt_find_serial_procs();
+
+   pool = pool_new(nthreads);
+}
+
+static void rt_stop_threads(void)
+{
+   if (pool != NULL) {
+      pool_free(pool);
+      pool = NULL;
+   }
+}
+
+static void rt_wave_update(void)
+{
+   // Turn waveform dumping on or off at the edges of the time window:
+   // nothing changed between the edge and the current time so the
+   // toggle is recorded at the edge itself
+   const bool want = (now >= wave_start) && (now < wave_stop);
+   if (want != wave_on) {
+      const uint64_t when = MIN(now, wave_next);
+      vcd_dump(when, want);
+      lxt_dump(when, want);
+      fst_dump(when, want);
+      wave_on = want;
+   }
+
+   if (now < wave_start)
+      wave_next = wave_start;
+   else if (now < wave_stop)
+      wave_next = wave_stop;
+   else
+      wave_next = UINT64_MAX;
+}
+
+static void rt_wave_restart(void)
+{
+   vcd_restart();
+   lxt_restart();
+   fst_restart();
+
+   rt_wave_update();
+}
+
+static void rt_cycle(void)
+{
+   // Simulation cycle is described in LRM 93 section 12.6.4
+
+   if (eventq_wheel != NULL)
+      rt_dequeue_wheel();
+   else
+      rt_dequeue_heap();
+
+   if (unlikely(now >= wave_next))
+      rt_wave_update();
+
+   ++n_cycles;
+   if (iteration > 0) {
+      ++n_deltas;
+      max_deltas = MAX(max_deltas, iteration);
+   }
+
+   TRACE("begin cycle");
+
+#if TRACE_DELTAQ > 0
+   if (trace_on)
+      deltaq_dump();
+#endif
+#if TRACE_PENDING > 0
+   if (trace_on)
+      rt_dump_pending();
+#endif
 
    event_t *event;
-   while ((event = rt_pop_run_queue())) {
+   while ((event = rt_pop_queue(&run_queue))) {
       switch (event->kind) {
       case E_PROCESS:
-         rt_run(event->proc, false /* reset */);
+         if (pool != NULL)
+            rt_batch_push(event->proc, NULL);
+         else
+            rt_run(event->proc, false /* reset */);
          break;
       case E_DRIVER:
-         rt_update_driver(event->group, event->proc);
+         rt_batch_flush();
+         rt_update_driver(event->group, event->driver);
          break;
       }
 
@@ -1436,20 +2346,28 @@ static void rt_cycle(void)
    }
 
    if (unlikely(now == 0 && iteration == 0)) {
-      vcd_restart();
-      lxt_restart();
+      rt_batch_flush();
+      rt_wave_restart();
    }
 
    // Run all processes that resumed because of signal events
    while (resume != NULL) {
       switch (resume->kind) {
       case S_PROCESS:
-         rt_run(resume->proc, false /* reset */);
+         if (pool != NULL)
+            rt_batch_push(resume->proc, NULL);
+         else
+            rt_run(resume->proc, false /* reset */);
          break;
 
       case S_CALLBACK:
-         (*resume->callback->fn)(now, resume->callback->signal);
-         rt_watch_signal(resume->callback);
+         if (pool != NULL)
+            rt_batch_push(NULL, resume->callback);
+         else {
+            (*resume->callback->fn)(now, resume->callback->signal,
+                                    resume->callback->context);
+            rt_watch_signal(resume->callback);
+         }
          break;
       }
 
@@ -1458,11 +2376,17 @@ static void rt_cycle(void)
       resume = next;
    }
 
+   rt_batch_flush();
+
    for (unsigned i = 0; i < n_active_groups; i++) {
       netgroup_t *g = active_groups[i];
       g->flags &= ~(NET_F_ACTIVE | NET_F_EVENT);
    }
    n_active_groups = 0;
+
+   const size_t qsize = deltaq_size();
+   if (qsize > peak_deltaq)
+      peak_deltaq = qsize;
 }
 
 static void rt_load_unit(const char *name)
@@ -1531,14 +2455,20 @@ static void rt_one_time_init(void)
    jit_bind_fn("_last_event", _last_event);
    jit_bind_fn("_div_zero", _div_zero);
    jit_bind_fn("_null_deref", _null_deref);
+   jit_bind_fn("_std_logic_resolved", _std_logic_resolved);
 
    trace_on = opt_get_int("rt_trace_en");
 
    event_stack     = rt_alloc_stack_new(sizeof(struct event));
    waveform_stack  = rt_alloc_stack_new(sizeof(struct waveform));
    sens_list_stack = rt_alloc_stack_new(sizeof(struct sens_list));
-   tmp_chunk_stack = rt_alloc_stack_new(sizeof(struct tmp_chunk));
    watch_stack     = rt_alloc_stack_new(sizeof(struct watch));
+   tmp_chunk_stack = rt_alloc_stack_new(sizeof(struct tmp_chunk));
+
+   n_workers = 1;
+   workers = xmalloc(sizeof(struct rt_worker));
+   rt_worker_init(&(workers[0]));
+   active_worker = &(workers[0]);
 
    n_active_alloc = 128;
    active_groups = xmalloc(n_active_alloc * sizeof(struct net *));
@@ -1551,8 +2481,10 @@ static void rt_cleanup_group(groupid_t gid, netid_t first, unsigned length)
    assert(g->first == first);
    assert(g->length == length);
 
-   free(g->resolved);
-   free(g->last_value);
+   if (g->resolved != NULL)
+      rt_free_value(g, g->resolved);
+   if (g->last_value != NULL)
+      rt_free_value(g, g->last_value);
 
    for (int j = 0; j < g->n_drivers; j++) {
       while (g->drivers[j].waveforms != NULL) {
@@ -1564,11 +2496,8 @@ static void rt_cleanup_group(groupid_t gid, netid_t first, unsigned length)
    }
    free(g->drivers);
 
-   while (g->free_values != NULL) {
-      value_t *next = g->free_values->next;
-      free(g->free_values);
-      g->free_values = next;
-   }
+   if (g->driver_map != NULL)
+      hash_free(g->driver_map);
 
    while (g->pending != NULL) {
       sens_list_t *next = g->pending->next;
@@ -1581,11 +2510,26 @@ static void rt_cleanup(tree_t top)
 {
    assert(resume == NULL);
 
-   while (heap_size(eventq_heap) > 0)
-      rt_free(event_stack, heap_extract_min(eventq_heap));
+   if (eventq_wheel != NULL) {
+      for (int i = 0; i < ARRAY_LEN(delta_queue); i++) {
+         event_t *e;
+         while ((e = rt_pop_queue(&(delta_queue[i]))))
+            rt_free(event_stack, e);
+      }
+
+      while (wheel_size(eventq_wheel) > 0)
+         rt_free(event_stack, wheel_extract_min(eventq_wheel));
 
-   heap_free(eventq_heap);
-   eventq_heap = NULL;
+      wheel_free(eventq_wheel);
+      eventq_wheel = NULL;
+   }
+   else {
+      while (heap_size(eventq_heap) > 0)
+         rt_free(event_stack, heap_extract_min(eventq_heap));
+
+      heap_free(eventq_heap);
+      eventq_heap = NULL;
+   }
 
    netdb_walk(netdb, rt_cleanup_group);
    netdb_close(netdb);
@@ -1596,22 +2540,382 @@ static void rt_cleanup(tree_t top)
       watches = next;
    }
 
-   while (pending != NULL) {
-      sens_list_t *next = pending->next;
-      rt_free(sens_list_stack, pending);
-      pending = next;
-   }
+   rt_free_pending();
+   free(pending);
+   pending = NULL;
+   n_pending = 0;
+
+   for (int i = 0; i < n_workers; i++)
+      rt_magazine_flush(&(workers[i].tmp_chunk_mag), 0);
+
+   rt_alloc_stats(event_stack, &(stack_stats[0]));
+   rt_alloc_stats(waveform_stack, &(stack_stats[1]));
+   rt_alloc_stats(sens_list_stack, &(stack_stats[2]));
+   rt_alloc_stats(watch_stack, &(stack_stats[3]));
+   rt_alloc_stats(tmp_chunk_stack, &(stack_stats[4]));
 
    rt_alloc_stack_destroy(event_stack);
    rt_alloc_stack_destroy(waveform_stack);
    rt_alloc_stack_destroy(sens_list_stack);
    rt_alloc_stack_destroy(watch_stack);
+   rt_alloc_stack_destroy(tmp_chunk_stack);
+
+   rt_slab_destroy_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Checkpoint and restore
+
+struct ckpt_event {
+   event_t *event;
+   size_t   seq;
+};
+
+struct ckpt_events {
+   struct ckpt_event *events;
+   size_t             count;
+   size_t             alloc;
+};
+
+struct proc_state_hdr {
+   int32_t  state;
+   void    *context;
+};
+
+static void rt_ckpt_collect(uint64_t key, void *user, void *context)
+{
+   struct ckpt_events *ce = context;
+
+   if (ce->count == ce->alloc) {
+      ce->alloc = MAX(ce->alloc * 2, 256);
+      ce->events = xrealloc(ce->events,
+                            ce->alloc * sizeof(struct ckpt_event));
+   }
+
+   ce->events[ce->count].event = user;
+   ce->events[ce->count].seq   = ce->count;
+   ce->count++;
+}
+
+static int rt_ckpt_event_cmp(const void *a, const void *b)
+{
+   // Order by queue key then by position in the walk which keeps
+   // events with equal keys in the order they were inserted
+   const struct ckpt_event *ca = a;
+   const struct ckpt_event *cb = b;
+
+   const uint64_t ka = heap_key(ca->event->when, ca->event->kind);
+   const uint64_t kb = heap_key(cb->event->when, cb->event->kind);
+
+   if (ka != kb)
+      return (ka > kb) - (ka < kb);
+   else
+      return (ca->seq > cb->seq) - (ca->seq < cb->seq);
+}
+
+static void rt_ckpt_write_sens(sens_list_t *list, fbuf_t *f)
+{
+   // Waveform dumper callbacks are registered again on restore so only
+   // process entries are saved
+   unsigned count = 0;
+   for (sens_list_t *it = list; it != NULL; it = it->next) {
+      if (it->kind == S_PROCESS)
+         count++;
+   }
+
+   write_u32(count, f);
+   for (sens_list_t *it = list; it != NULL; it = it->next) {
+      if (it->kind != S_PROCESS)
+         continue;
+
+      write_u32(it->proc - procs, f);
+      write_u32(it->wakeup_gen, f);
+      write_u32(it->first, f);
+      write_u32(it->last, f);
+   }
+}
+
+static sens_list_t *rt_ckpt_read_sens(fbuf_t *f)
+{
+   sens_list_t *list = NULL, **tail = &list;
+
+   const unsigned count = read_u32(f);
+   for (unsigned i = 0; i < count; i++) {
+      sens_list_t *node = rt_alloc(sens_list_stack);
+      node->kind       = S_PROCESS;
+      node->proc       = &(procs[read_u32(f)]);
+      node->wakeup_gen = read_u32(f);
+      node->first      = read_u32(f);
+      node->last       = read_u32(f);
+      node->callback   = NULL;
+      node->next       = NULL;
+
+      *tail = node;
+      tail = &(node->next);
+   }
+
+   return list;
+}
+
+static void *rt_ckpt_proc_state(rt_proc_t *proc, size_t *size)
+{
+   const char *name = istr(tree_ident(proc->source));
+   char buf[256];
+
+   snprintf(buf, sizeof(buf), "%s__state_flat", name);
+   const int8_t *flat = jit_var_ptr(buf, true);
+   if (!*flat)
+      fatal("process %s has variables which cannot be saved in a "
+            "checkpoint", name);
+
+   snprintf(buf, sizeof(buf), "%s__state_size", name);
+   *size = *(const int32_t *)jit_var_ptr(buf, true);
+
+   snprintf(buf, sizeof(buf), "%s__state", name);
+   return jit_var_ptr(buf, true);
+}
+
+static void rt_checkpoint_save(tree_t top, const char *file)
+{
+   // Must be called between cycles when nothing is resuming and no
+   // net is active
+
+   assert(resume == NULL);
+   assert(n_active_groups == 0);
+
+   fbuf_t *f = fbuf_open(file, FBUF_OUT);
+   if (f == NULL)
+      fatal_errno("failed to create checkpoint %s", file);
+
+   const char *top_name = istr(tree_ident(top));
+   const size_t top_len = strlen(top_name);
+
+   write_u32(CHECKPOINT_MAGIC, f);
+   write_u32(top_len, f);
+   write_raw(top_name, top_len, f);
+
+   write_u64(now, f);
+   write_u32(iteration, f);
+
+   write_u32(n_procs, f);
+   for (size_t i = 0; i < n_procs; i++) {
+      size_t size;
+      const void *state = rt_ckpt_proc_state(&(procs[i]), &size);
+
+      // The procedure context is only set when the process is suspended
+      // inside a procedure and points at heap memory
+      const struct proc_state_hdr *hdr = state;
+      if (hdr->context != NULL)
+         fatal("cannot checkpoint while process %s is suspended in a "
+               "procedure", istr(tree_ident(procs[i].source)));
+
+      write_u32(procs[i].wakeup_gen, f);
+      write_u32(size, f);
+      write_raw(state, size, f);
+   }
+
+   const unsigned ngroups = netdb_size(netdb);
+   write_u32(ngroups, f);
+   for (groupid_t gid = 0; gid < ngroups; gid++) {
+      netgroup_t *g = &(groups[gid]);
+      const size_t valuesz = rt_value_size(g);
+
+      write_u32(g->first, f);
+      write_u32(g->length, f);
+      write_u16(g->size, f);
+      write_u8(g->packed, f);
+      write_u64(g->last_event, f);
+
+      if (g->resolved != NULL) {
+         write_raw(g->resolved->data, valuesz, f);
+         write_raw(g->last_value->data, valuesz, f);
+      }
+
+      write_u16(g->n_drivers, f);
+      for (int i = 0; i < g->n_drivers; i++) {
+         const driver_t *d = &(g->drivers[i]);
+
+         unsigned nwaves = 0;
+         for (waveform_t *w = d->waveforms; w != NULL; w = w->next)
+            nwaves++;
+
+         write_u32(d->proc - procs, f);
+         write_u32(nwaves, f);
+         for (waveform_t *w = d->waveforms; w != NULL; w = w->next) {
+            write_u64(w->when, f);
+            write_raw(w->values->data, valuesz, f);
+         }
+      }
+
+      rt_ckpt_write_sens(g->pending, f);
+   }
+
+   write_u32(n_pending, f);
+   for (unsigned b = 0; b < n_pending; b++)
+      rt_ckpt_write_sens(pending[b], f);
+
+   struct ckpt_events ce = { NULL, 0, 0 };
+   for (int i = 0; i < ARRAY_LEN(delta_queue); i++) {
+      for (size_t j = delta_queue[i].rd; j < delta_queue[i].wr; j++)
+         rt_ckpt_collect(0, delta_queue[i].queue[j], &ce);
+   }
+
+   const size_t ndelta = ce.count;
+   if (eventq_wheel != NULL)
+      wheel_walk(eventq_wheel, rt_ckpt_collect, &ce);
+   else
+      heap_walk(eventq_heap, rt_ckpt_collect, &ce);
+
+   qsort(ce.events + ndelta, ce.count - ndelta, sizeof(struct ckpt_event),
+         rt_ckpt_event_cmp);
+
+   write_u32(ce.count, f);
+   for (size_t i = 0; i < ce.count; i++) {
+      const event_t *e = ce.events[i].event;
+      write_u64(e->when, f);
+      write_u32(e->iteration, f);
+      write_u8(e->kind, f);
+      if (e->kind == E_DRIVER) {
+         write_u32(e->group - groups, f);
+         write_u32(e->driver, f);
+      }
+      else
+         write_u32(e->proc - procs, f);
+   }
+
+   free(ce.events);
+   fbuf_close(f);
+
+   notef("wrote checkpoint at %s to %s", fmt_time(now), file);
+}
+
+static void rt_checkpoint_restore(tree_t top, const char *file)
+{
+   // Instead of resetting each process restore the kernel state saved
+   // by rt_checkpoint_save: the module reset functions still run to
+   // initialise constants and allocate the signal values
+
+   fbuf_t *f = fbuf_open(file, FBUF_IN);
+   if (f == NULL)
+      fatal_errno("failed to open checkpoint %s", file);
+
+   if (read_u32(f) != CHECKPOINT_MAGIC)
+      fatal("%s is not a checkpoint file", file);
+
+   const size_t top_len = read_u32(f);
+   char top_name[top_len + 1];
+   read_raw(top_name, top_len, f);
+   top_name[top_len] = '\0';
+
+   if (strcmp(top_name, istr(tree_ident(top))) != 0)
+      fatal("checkpoint %s was created for %s", file, top_name);
+
+   rt_reset_modules(top);
+
+   now       = read_u64(f);
+   iteration = read_u32(f);
+
+   if (read_u32(f) != n_procs)
+      fatal("checkpoint %s does not match the elaborated design", file);
+
+   for (size_t i = 0; i < n_procs; i++) {
+      size_t size;
+      void *state = rt_ckpt_proc_state(&(procs[i]), &size);
+
+      procs[i].wakeup_gen = read_u32(f);
+      if (read_u32(f) != size)
+         fatal("checkpoint %s does not match the elaborated design", file);
+      read_raw(state, size, f);
+   }
+
+   const unsigned ngroups = read_u32(f);
+   if (ngroups != netdb_size(netdb))
+      fatal("checkpoint %s does not match the elaborated design", file);
+
+   for (groupid_t gid = 0; gid < ngroups; gid++) {
+      netgroup_t *g = &(groups[gid]);
+
+      const netid_t first  = read_u32(f);
+      const unsigned length = read_u32(f);
+      const unsigned size   = read_u16(f);
+      const unsigned packed = read_u8(f);
+
+      if ((first != g->first) || (length != g->length) || (size != g->size))
+         fatal("checkpoint %s does not match the elaborated design", file);
+      else if (packed != g->packed)
+         fatal("checkpoint %s was created with different --packed "
+               "setting", file);
+
+      const size_t valuesz = rt_value_size(g);
+
+      g->last_event = read_u64(f);
+
+      if (g->resolved != NULL) {
+         read_raw(g->resolved->data, valuesz, f);
+         read_raw(g->last_value->data, valuesz, f);
+      }
+
+      const int ndrivers = read_u16(f);
+      for (int i = 0; i < ndrivers; i++) {
+         const int driver = rt_new_driver(g, &(procs[read_u32(f)]));
+         driver_t *d = &(g->drivers[driver]);
+
+         waveform_t **tail = &(d->waveforms);
+         const unsigned nwaves = read_u32(f);
+         for (unsigned j = 0; j < nwaves; j++) {
+            waveform_t *w = rt_alloc(waveform_stack);
+            w->when   = read_u64(f);
+            w->values = rt_alloc_value(g);
+            w->next   = NULL;
+            read_raw(w->values->data, valuesz, f);
+
+            *tail = w;
+            tail = &(w->next);
+         }
+      }
+
+      g->pending = rt_ckpt_read_sens(f);
+   }
+
+   if (read_u32(f) != n_pending)
+      fatal("checkpoint %s does not match the elaborated design", file);
+
+   for (unsigned b = 0; b < n_pending; b++)
+      pending[b] = rt_ckpt_read_sens(f);
+
+   const unsigned nevents = read_u32(f);
+   for (unsigned i = 0; i < nevents; i++) {
+      event_t *e = rt_alloc(event_stack);
+      e->when      = read_u64(f);
+      e->iteration = read_u32(f);
+      e->kind      = read_u8(f);
+
+      if (e->kind == E_DRIVER) {
+         e->group  = &(groups[read_u32(f)]);
+         e->driver = read_u32(f);
+         e->proc   = NULL;
+      }
+      else {
+         e->proc   = &(procs[read_u32(f)]);
+         e->group  = NULL;
+         e->driver = -1;
+      }
+
+      deltaq_insert(e);
+   }
+
+   fbuf_close(f);
+
+   // The waveform dumpers normally start at the first delta cycle
+   if (iteration >= 0)
+      rt_wave_restart();
+
+   notef("restored checkpoint at %s from %s", fmt_time(now), file);
 }
 
 static bool rt_stop_now(uint64_t stop_time)
 {
-   event_t *peek = heap_min(eventq_heap);
-   return peek->when > stop_time;
+   return deltaq_next_when() > stop_time;
 }
 
 static void rt_stats_ready(void)
@@ -1637,10 +2941,165 @@ static void rt_stats_print(void)
    unsigned final_u = rt_tv2ms(&final_rusage.ru_utime);
    unsigned final_s = rt_tv2ms(&final_rusage.ru_stime);
 
+   const unsigned run_ms = final_u + final_s - ready_u - ready_s;
+
    notef("setup:%ums run:%ums maxrss:%ldkB",
-         ready_u + ready_s,
-         final_u + final_s - ready_u - ready_s,
-         final_rusage.ru_maxrss);
+         ready_u + ready_s, run_ms, final_rusage.ru_maxrss);
+   notef("events:%"PRIu64" (%.0f per second) pending visits:%"PRIu64
+         " (%.1f per event)", n_events,
+         (run_ms > 0) ? n_events * 1000.0 / run_ms : 0.0,
+         n_pending_visits,
+         (n_events > 0) ? (double)n_pending_visits / n_events : 0.0);
+   notef("cycles:%"PRIu64" deltas:%"PRIu64" max deltas per step:%d "
+         "peak queue:%zu", n_cycles, n_deltas, max_deltas, peak_deltaq);
+
+   uint64_t tmp_spills = 0;
+   for (int i = 0; i < n_workers; i++)
+      tmp_spills += workers[i].tmp_spills;
+
+   notef("transactions:%"PRIu64" rejected:%"PRIu64" sensitivity nodes "
+         "allocated:%"PRIu64" reused:%"PRIu64" tmp spills:%"PRIu64,
+         n_transactions, n_rejected, n_sens_alloc, n_sens_reuse,
+         tmp_spills);
+
+   const char *stack_names[ARRAY_LEN(stack_stats)] = {
+      "event", "waveform", "sens list", "watch", "tmp chunk"
+   };
+   for (int i = 0; i < ARRAY_LEN(stack_stats); i++) {
+      const rt_alloc_stats_t *st = &(stack_stats[i]);
+      notef("%s: %zu byte items, %zu high water, %zu refills, %zukB",
+            stack_names[i], st->item_sz, st->high_water, st->refills,
+            st->bytes / 1024);
+   }
+
+   rt_slab_stats_t slab;
+   rt_slab_stats(&slab);
+   notef("values: %zu size classes, %zu chunks, %zukB reserved, "
+         "%zukB peak", slab.classes, slab.chunks,
+         slab.reserved_bytes / 1024, slab.peak_bytes / 1024);
+}
+
+static uint64_t rt_clock_ns(void)
+{
+   struct timespec ts;
+   if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+      fatal_errno("clock_gettime");
+   return (ts.tv_sec * UINT64_C(1000000000)) + ts.tv_nsec;
+}
+
+static void rt_progress(void)
+{
+   // Report simulated time against wall clock time at most once every
+   // progress_interval nanoseconds
+
+   const uint64_t ns = rt_clock_ns();
+   if (ns < progress_next)
+      return;
+
+   const double elapsed = (ns - progress_start) / 1e9;
+   notef("progress: %s simulated in %.1fs, %"PRIu64" deltas, "
+         "%.0f events per second", fmt_time(now), elapsed, n_deltas,
+         (elapsed > 0.0) ? n_events / elapsed : 0.0);
+
+   progress_next = ns + progress_interval;
+}
+
+static void rt_profile_start(void)
+{
+   profile_start_ticks = rt_ticks();
+   profile_start_ns    = rt_clock_ns();
+}
+
+static int rt_profile_cmp(const void *a, const void *b)
+{
+   const rt_proc_t *pa = *(const rt_proc_t **)a;
+   const rt_proc_t *pb = *(const rt_proc_t **)b;
+
+   const uint64_t ta = pa->run_ticks + pa->update_ticks;
+   const uint64_t tb = pb->run_ticks + pb->update_ticks;
+
+   return (ta < tb) - (ta > tb);
+}
+
+static void rt_profile_report(void)
+{
+   // Calibrate the tick counter against the wall clock over the run
+   const uint64_t ticks = rt_ticks() - profile_start_ticks;
+   const uint64_t ns    = rt_clock_ns() - profile_start_ns;
+   const double ns_per_tick = (ticks > 0) ? (double)ns / ticks : 1.0;
+
+   rt_proc_t **sorted = xmalloc(n_procs * sizeof(rt_proc_t *));
+   uint64_t run_total = 0, update_total = 0;
+   for (size_t i = 0; i < n_procs; i++) {
+      sorted[i] = &(procs[i]);
+      run_total    += procs[i].run_ticks;
+      update_total += procs[i].update_ticks;
+   }
+
+   qsort(sorted, n_procs, sizeof(rt_proc_t *), rt_profile_cmp);
+
+   const uint64_t total = run_total + update_total;
+
+   notef("profile: %.1fms in processes, %.1fms in signal updates, "
+         "%.1fms elapsed", run_total * ns_per_tick / 1e6,
+         update_total * ns_per_tick / 1e6, ns / 1e6);
+
+   printf("%12s %10s %10s %6s  %s\n",
+          "Activations", "Run ms", "Update ms", "%", "Process");
+
+   const size_t nshow = MIN(n_procs, PROFILE_TOP);
+   for (size_t i = 0; i < nshow; i++) {
+      const rt_proc_t *p = sorted[i];
+      const uint64_t t = p->run_ticks + p->update_ticks;
+      if (t == 0)
+         break;
+
+      printf("%12"PRIu64" %10.2f %10.2f %6.1f  %s\n", p->activations,
+             p->run_ticks * ns_per_tick / 1e6,
+             p->update_ticks * ns_per_tick / 1e6,
+             100.0 * t / total, istr(tree_ident(p->source)));
+   }
+
+   if (profile_file != NULL) {
+      FILE *f = fopen(profile_file, "w");
+      if (f == NULL)
+         fatal_errno("%s", profile_file);
+
+      fprintf(f, "process\tactivations\trun_ns\tupdate_ns\n");
+      for (size_t i = 0; i < n_procs; i++) {
+         const rt_proc_t *p = sorted[i];
+         fprintf(f, "%s\t%"PRIu64"\t%.0f\t%.0f\n",
+                 istr(tree_ident(p->source)), p->activations,
+                 p->run_ticks * ns_per_tick, p->update_ticks * ns_per_tick);
+      }
+
+      fclose(f);
+   }
+
+   free(sorted);
+}
+
+void rt_checkpoint_init(uint64_t when, const char *file)
+{
+   checkpoint_at   = when;
+   checkpoint_file = file;
+}
+
+void rt_restore_init(const char *file)
+{
+   restore_file = file;
+}
+
+void rt_wave_window(uint64_t start, uint64_t stop)
+{
+   wave_start = start;
+   wave_stop  = stop;
+}
+
+void rt_profile_init(const char *file)
+{
+   profiling    = true;
+   profile_file = file;
 }
 
 static void rt_emit_coverage(tree_t e)
@@ -1659,9 +3118,37 @@ void rt_batch_exec(tree_t e, uint64_t stop_time, tree_rd_ctx_t ctx)
    rt_one_time_init();
    rt_setup(e);
    rt_stats_ready();
-   rt_initial(e);
-   while (heap_size(eventq_heap) > 0 && !rt_stop_now(stop_time))
+   if (profiling)
+      rt_profile_start();
+   if (restore_file != NULL)
+      rt_checkpoint_restore(e, restore_file);
+   else
+      rt_initial(e);
+   rt_start_threads();
+
+   progress_interval = opt_get_int("rt-progress") * UINT64_C(1000000000);
+   if (progress_interval > 0) {
+      progress_start = rt_clock_ns();
+      progress_next  = progress_start + progress_interval;
+   }
+
+   while (deltaq_size() > 0 && !rt_stop_now(stop_time)) {
+      if (unlikely(checkpoint_file != NULL) && rt_stop_now(checkpoint_at)) {
+         rt_checkpoint_save(e, checkpoint_file);
+         checkpoint_file = NULL;
+      }
+
       rt_cycle();
+
+      if (unlikely(progress_interval > 0) && (n_cycles % PROGRESS_TICK == 0))
+         rt_progress();
+   }
+   rt_stop_threads();
+
+   if (checkpoint_file != NULL)
+      warnf("simulation stopped before checkpoint time %s",
+            fmt_time(checkpoint_at));
+
    rt_cleanup(e);
    rt_emit_coverage(e);
 
@@ -1669,6 +3156,9 @@ void rt_batch_exec(tree_t e, uint64_t stop_time, tree_rd_ctx_t ctx)
 
    if (opt_get_int("rt-stats"))
       rt_stats_print();
+
+   if (profiling)
+      rt_profile_report();
 }
 
 static void rt_slave_fatal(void)
@@ -1681,14 +3171,14 @@ static void rt_slave_run(slave_run_msg_t *msg)
 {
    if (aborted)
       errorf("simulation has aborted and must be restarted");
-   else if (heap_size(eventq_heap) == 0)
+   else if (deltaq_size() == 0)
       warnf("no future simulation events");
    else {
       set_fatal_fn(rt_slave_fatal);
 
       if (setjmp(fatal_jmp) == 0) {
          const uint64_t end = now + msg->time;
-         while (heap_size(eventq_heap) > 0 && !rt_stop_now(end))
+         while (deltaq_size() > 0 && !rt_stop_now(end))
             rt_cycle();
       }
 
@@ -1723,7 +3213,7 @@ static void rt_slave_now(void)
    slave_post_msg(REPLY_NOW, &reply, sizeof(reply));
 }
 
-static void rt_slave_watch_cb(uint64_t now, tree_t decl)
+static void rt_slave_watch_cb(uint64_t now, tree_t decl, void *context)
 {
    uint64_t value[1];
    rt_signal_value(decl, value, 1, false);
@@ -1746,7 +3236,7 @@ static void rt_slave_watch(slave_watch_msg_t *msg)
    tree_t t = tree_read_recall(tree_rd_ctx, msg->index);
    assert(tree_kind(t) == T_SIGNAL_DECL);
 
-   rt_set_event_cb(t, rt_slave_watch_cb);
+   rt_set_event_cb(t, rt_slave_watch_cb, NULL);
 }
 
 static void rt_slave_unwatch(slave_unwatch_msg_t *msg)
@@ -1754,7 +3244,7 @@ static void rt_slave_unwatch(slave_unwatch_msg_t *msg)
    tree_t t = tree_read_recall(tree_rd_ctx, msg->index);
    assert(tree_kind(t) == T_SIGNAL_DECL);
 
-   rt_set_event_cb(t, NULL);
+   rt_set_event_cb(t, NULL, NULL);
 }
 
 void rt_slave_exec(tree_t e, tree_rd_ctx_t ctx)
@@ -1772,11 +3262,21 @@ void rt_slave_exec(tree_t e, tree_rd_ctx_t ctx)
 
       switch (msg) {
       case SLAVE_QUIT:
+         if (profiling)
+            rt_profile_report();
          jit_shutdown();
          return;
 
+      case SLAVE_RETIRE:
+         // Replaced by a copy resumed from a snapshot: the wave output
+         // must not be finalised here as that copy continues writing it
+         fflush(stdout);
+         _exit(EXIT_SUCCESS);
+
       case SLAVE_RESTART:
          rt_setup(e);
+         if (profiling)
+            rt_profile_start();
          rt_initial(e);
          aborted = false;
          break;
@@ -1801,6 +3301,12 @@ void rt_slave_exec(tree_t e, tree_rd_ctx_t ctx)
          rt_slave_unwatch((slave_unwatch_msg_t *)buf);
          break;
 
+      case SLAVE_SNAPSHOT:
+         // Returns in both the current slave and later in each copy
+         // resumed from the snapshot
+         slave_snapshot();
+         break;
+
       default:
          assert(false);
       }
@@ -1810,7 +3316,7 @@ void rt_slave_exec(tree_t e, tree_rd_ctx_t ctx)
    jit_shutdown();
 }
 
-void rt_set_event_cb(tree_t s, sig_event_fn_t fn)
+void rt_set_event_cb(tree_t s, sig_event_fn_t fn, void *context)
 {
    assert(tree_kind(s) == T_SIGNAL_DECL);
 
@@ -1828,6 +3334,7 @@ void rt_set_event_cb(tree_t s, sig_event_fn_t fn)
       assert(w != NULL);
       w->signal     = s;
       w->fn         = fn;
+      w->context    = context;
       w->wakeup_gen = 0;
       w->next       = watches;
 
@@ -1841,14 +3348,33 @@ size_t rt_signal_value(tree_t decl, uint64_t *buf, size_t max, bool last)
 {
    assert(tree_kind(decl) == T_SIGNAL_DECL);
    const int nnets = tree_nets(decl);
+
+   // Packed groups are unpacked into a buffer shared by all groups and
+   // grown to the largest seen
+   uint8_t *scratch = NULL;
+   size_t scratch_sz = 0;
+
    int offset = 0;
    while ((offset < nnets) && (offset < max)) {
       netid_t nid = tree_net(decl, offset);
       netgroup_t *g = &(groups[netdb_lookup(netdb, nid)]);
 
+      const value_t *v = (last ? g->last_value : g->resolved);
+
+      const void *data = v->data;
+      if (g->packed) {
+         if (g->length > scratch_sz) {
+            scratch_sz = g->length;
+            scratch = xrealloc(scratch, scratch_sz);
+         }
+
+         unpack_values(scratch, (const uint8_t *)v->data, 0,
+                       g->length, g->packed);
+         data = scratch;
+      }
+
 #define SIGNAL_VALUE_EXPAND_U64(type) do {                              \
-         const value_t *v = (last ? g->last_value : g->resolved);       \
-         const type *sp = (type *)v->data;                              \
+         const type *sp = (const type *)data;                           \
          for (int i = 0; (i < g->length) && (offset + i < max); i++)    \
             buf[offset + i] = sp[i];                                    \
       } while (0)
@@ -1858,6 +3384,7 @@ size_t rt_signal_value(tree_t decl, uint64_t *buf, size_t max, bool last)
       offset += g->length;
    }
 
+   free(scratch);
    return MIN(nnets, max);
 }
 
@@ -54,6 +54,17 @@ typedef struct {
 #define CMD(name, cd, help) \
    { #name, shell_cmd_##name, cd, help }
 
+typedef struct snapshot snapshot_t;
+
+struct snapshot {
+   char       *name;
+   int         fd;
+   snapshot_t *next;
+};
+
+static snapshot_t *snapshots = NULL;
+static int         initial_fd = -1;
+
 __attribute__((format(printf, 2, 3)))
 static int tcl_error(Tcl_Interp *interp, const char *fmt, ...)
 {
@@ -89,13 +100,116 @@ static bool show_help(int objc, Tcl_Obj *const objv[], const char *help)
    return false;
 }
 
+static int shell_take_snapshot(void)
+{
+   slave_post_msg(SLAVE_SNAPSHOT, NULL, 0);
+   return slave_get_snapshot();
+}
+
+static void shell_resume_snapshot(int fd)
+{
+   // Stop the current slave and continue from a fresh copy of the
+   // snapshot which is almost instant compared to a full restart
+   slave_post_msg(SLAVE_RETIRE, NULL, 0);
+   close(slave_switch(fd));
+
+   // The copy has its own connection so the parked process is never
+   // sent messages meant for the active slave
+   slave_post_msg(SLAVE_RESUME, NULL, 0);
+   slave_switch(slave_get_snapshot());
+}
+
 static int shell_cmd_restart(ClientData cd, Tcl_Interp *interp,
                              int objc, Tcl_Obj *const objv[])
 {
-   slave_post_msg(SLAVE_RESTART, NULL, 0);
+   if (initial_fd != -1)
+      shell_resume_snapshot(initial_fd);
+   else
+      slave_post_msg(SLAVE_RESTART, NULL, 0);
    return TCL_OK;
 }
 
+static int shell_cmd_snapshot(ClientData cd, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *const objv[])
+{
+   const char *help =
+      "snapshot - Save the current simulation state\n"
+      "\n"
+      "Usage: snapshot NAME\n"
+      "\n"
+      "Keeps a copy of the simulation at the current time which can be\n"
+      "returned to later with restore. An existing snapshot with the same\n"
+      "name is replaced.\n"
+      "\n"
+      "Examples:\n"
+      "  snapshot reset_done\n";
+
+   if (show_help(objc, objv, help))
+      return TCL_OK;
+
+   if (objc != 2)
+      return tcl_error(interp, "usage: snapshot NAME");
+
+   const char *name = Tcl_GetString(objv[1]);
+
+   snapshot_t *s;
+   for (s = snapshots; s != NULL; s = s->next) {
+      if (strcmp(s->name, name) == 0)
+         break;
+   }
+
+   if (s == NULL) {
+      s = xmalloc(sizeof(snapshot_t));
+      s->name = strdup(name);
+      s->next = snapshots;
+
+      snapshots = s;
+   }
+   else {
+      // Discard the old snapshot process: any slave resumed from it has
+      // its own connection and carries on
+      const int fd = slave_switch(s->fd);
+      slave_post_msg(SLAVE_QUIT, NULL, 0);
+      slave_switch(fd);
+      close(s->fd);
+   }
+
+   s->fd = shell_take_snapshot();
+   return TCL_OK;
+}
+
+static int shell_cmd_restore(ClientData cd, Tcl_Interp *interp,
+                             int objc, Tcl_Obj *const objv[])
+{
+   const char *help =
+      "restore - Return to a saved simulation state\n"
+      "\n"
+      "Usage: restore NAME\n"
+      "\n"
+      "Abandons the current simulation and continues from the state saved\n"
+      "by an earlier snapshot command. The snapshot can be restored again.\n"
+      "\n"
+      "Examples:\n"
+      "  restore reset_done\n";
+
+   if (show_help(objc, objv, help))
+      return TCL_OK;
+
+   if (objc != 2)
+      return tcl_error(interp, "usage: restore NAME");
+
+   const char *name = Tcl_GetString(objv[1]);
+
+   for (snapshot_t *s = snapshots; s != NULL; s = s->next) {
+      if (strcmp(s->name, name) == 0) {
+         shell_resume_snapshot(s->fd);
+         return TCL_OK;
+      }
+   }
+
+   return tcl_error(interp, "no snapshot named %s", name);
+}
+
 static int shell_cmd_run(ClientData cd, Tcl_Interp *interp,
                          int objc, Tcl_Obj *const objv[])
 {
@@ -547,8 +661,20 @@ static void shell_exit_handler(ClientData cd)
    if (!*have_quit)
       slave_post_msg(SLAVE_QUIT, NULL, 0);
 
+   // Let the active slave finish writing its output before the parked
+   // snapshot processes are stopped
    slave_wait();
 
+   for (snapshot_t *s = snapshots; s != NULL; s = s->next) {
+      slave_switch(s->fd);
+      slave_post_msg(SLAVE_QUIT, NULL, 0);
+   }
+
+   if (initial_fd != -1) {
+      slave_switch(initial_fd);
+      slave_post_msg(SLAVE_QUIT, NULL, 0);
+   }
+
    printf("\nBye.\n");
 }
 
@@ -583,6 +709,8 @@ void shell_run(tree_t e, struct tree_rd_ctx *ctx)
       CMD(quit,      &have_quit, "Exit simulation"),
       CMD(run,       ctx,        "Start or resume simulation"),
       CMD(restart,   NULL,       "Restart simulation"),
+      CMD(snapshot,  NULL,       "Save simulation state"),
+      CMD(restore,   NULL,       "Return to saved simulation state"),
       CMD(show,      decl_hash,  "Display simulation objects"),
       CMD(help,      shell_cmds, "Display this message"),
       CMD(copyright, NULL,       "Display copyright information"),
@@ -604,6 +732,9 @@ void shell_run(tree_t e, struct tree_rd_ctx *ctx)
 
    slave_post_msg(SLAVE_RESTART, NULL, 0);
 
+   // Park a copy of the slave after initialisation for restart
+   initial_fd = shell_take_snapshot();
+
    char *line;
    while (!have_quit && (line = shell_get_line())) {
       switch (Tcl_Eval(interp, line)) {
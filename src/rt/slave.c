@@ -19,7 +19,10 @@
 #include "util.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <poll.h>
 #include <sys/socket.h>
@@ -55,6 +58,9 @@ void slave_get_msg(slave_msg_t *msg, void *buf, size_t *len)
    case SLAVE_QUIT:
    case SLAVE_RESTART:
    case SLAVE_NOW:
+   case SLAVE_SNAPSHOT:
+   case SLAVE_RESUME:
+   case SLAVE_RETIRE:
    case EVENT_STOP:
       break;
    case SLAVE_RUN:
@@ -143,9 +149,152 @@ int slave_wait(void)
 {
    assert(am_master);
 
+   // A slave resumed from a snapshot is not a child of the master so
+   // wait for it to exit by reading its connection until it is closed
+   char buf[256];
+   ssize_t nr;
+   while ((nr = read(slave_fd, buf, sizeof(buf))) != 0) {
+      if ((nr < 0) && (errno != EINTR))
+         break;
+   }
+
    int status;
    if (waitpid(slave_pid, &status, 0) < 0)
       fatal("waitpid");
 
    return WEXITSTATUS(status);
 }
+
+// A snapshot is a copy of the slave made with fork which waits on its
+// own connection to the master. Resuming a snapshot forks it again so
+// the same snapshot can be resumed any number of times: each copy gets
+// a new connection to the master and becomes the active slave.
+
+static pid_t slave_fork_conn(void)
+{
+   // Fork a copy of this process with its own connection to the master
+   // and pass the other end of the connection back over the current one
+
+   int socks[2];
+   if (socketpair(PF_LOCAL, SOCK_STREAM, 0, socks) < 0)
+      fatal_errno("socketpair");
+
+   // Avoid writing buffered output twice
+   fflush(NULL);
+
+   pid_t pid = fork();
+   if (pid < 0)
+      fatal_errno("fork");
+   else if (pid == 0) {
+      close(socks[0]);
+      close(slave_fd);
+      slave_fd = socks[1];
+      return pid;
+   }
+
+   close(socks[1]);
+
+   slave_msg_t msg = REPLY_SNAPSHOT;
+   struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+
+   char control[CMSG_SPACE(sizeof(int))];
+   memset(control, '\0', sizeof(control));
+
+   struct msghdr hdr = {
+      .msg_iov        = &iov,
+      .msg_iovlen     = 1,
+      .msg_control    = control,
+      .msg_controllen = sizeof(control)
+   };
+
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type  = SCM_RIGHTS;
+   cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cmsg), &(socks[0]), sizeof(int));
+
+   if (sendmsg(slave_fd, &hdr, 0) < 0)
+      fatal_errno("sendmsg");
+
+   close(socks[0]);
+   return pid;
+}
+
+static void slave_park(void)
+{
+   for (;;) {
+      slave_msg_t msg;
+      ssize_t nr = read(slave_fd, &msg, sizeof(slave_msg_t));
+      if (nr < 0)
+         fatal_errno("read");
+      else if (nr == 0)
+         _exit(EXIT_SUCCESS);   // Master has gone away
+
+      switch (msg) {
+      case SLAVE_QUIT:
+         _exit(EXIT_SUCCESS);
+
+      case SLAVE_RESUME:
+         // Collect any earlier copies which have since exited
+         while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+
+         if (slave_fork_conn() == 0)
+            return;   // Continue as the active slave
+         break;
+
+      default:
+         fatal("unexpected message %u to snapshot", msg);
+      }
+   }
+}
+
+void slave_snapshot(void)
+{
+   assert(!am_master);
+
+   if (slave_fork_conn() == 0)
+      slave_park();
+}
+
+int slave_get_snapshot(void)
+{
+   assert(am_master);
+
+   slave_msg_t msg;
+   struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+
+   char control[CMSG_SPACE(sizeof(int))];
+
+   struct msghdr hdr = {
+      .msg_iov        = &iov,
+      .msg_iovlen     = 1,
+      .msg_control    = control,
+      .msg_controllen = sizeof(control)
+   };
+
+   ssize_t nr = recvmsg(slave_fd, &hdr, 0);
+   if (nr < 0)
+      fatal_errno("recvmsg");
+   else if (nr == 0)
+      fatal("slave connection terminated\n");
+   else if (msg != REPLY_SNAPSHOT)
+      fatal("unexpected reply %u to snapshot", msg);
+
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+   if ((cmsg == NULL) || (cmsg->cmsg_type != SCM_RIGHTS))
+      fatal("missing descriptor in snapshot reply");
+
+   int fd;
+   memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+   return fd;
+}
+
+int slave_switch(int fd)
+{
+   assert(am_master);
+
+   const int old = slave_fd;
+   slave_fd = fd;
+   return old;
+}
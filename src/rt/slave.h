@@ -33,10 +33,14 @@ typedef enum {
    SLAVE_NOW,
    SLAVE_WATCH,
    SLAVE_UNWATCH,
+   SLAVE_SNAPSHOT,
+   SLAVE_RESUME,
+   SLAVE_RETIRE,
 
    // Replies to master messages
    REPLY_READ_SIGNAL,
    REPLY_NOW,
+   REPLY_SNAPSHOT,
 
    // Events from slave
    EVENT_STOP,
@@ -85,5 +89,8 @@ bool slave_msg_ready(void);
 bool slave_fork(void);
 void slave_kill(int sig);
 int slave_wait(void);
+void slave_snapshot(void);
+int slave_get_snapshot(void);
+int slave_switch(int fd);
 
 #endif
@@ -19,31 +19,158 @@
 #include "rt.h"
 #include "tree.h"
 #include "common.h"
+#include "ring.h"
 
 #include <time.h>
 #include <inttypes.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #define MAX_VAR_WIDTH  256
-#define MAX_TEXT_WIDTH 512
 #define MAX_SCOPE_SZ   64
+#define MAX_KEY_SZ     8
+#define MAX_LINE       (MAX_VAR_WIDTH + MAX_KEY_SZ + 4)
+#define INT_WIDTH      32
+#define CHUNK_SZ       (64 * 1024)
+#define MAX_CHUNKS     16
+#define RING_SIZE      (4 * 1024 * 1024)
+
+typedef enum {
+   VCD_SCALAR, VCD_VECTOR, VCD_INTEGER
+} vcd_kind_t;
+
+typedef enum {
+   VCD_DUMPOFF, VCD_DUMPON, VCD_DUMPEND
+} vcd_ctrl_t;
+
+typedef struct {
+   tree_t      decl;
+   const char *map;
+   vcd_kind_t  kind;
+   bool        downto;
+   uint8_t     keylen;
+   char        key[MAX_KEY_SZ];
+} vcd_sig_t;
+
+// Signal events are copied into a ring buffer so the formatting and
+// output can happen on a background thread
+typedef struct {
+   uint64_t   when;
+   vcd_sig_t *sig;
+   uint32_t   nvals;
+   uint32_t   pad;
+   uint64_t   vals[];
+} vcd_event_t;
+
+static int           vcd_fd = -1;
+static vcd_sig_t    *sigs = NULL;
+static int           n_sigs = 0;
+static char         *scopes[MAX_SCOPE_SZ];
+static int           n_scopes = 0;
+static tree_t        vcd_top = NULL;
+static ring_t        ring = NULL;
+static uint64_t      last_time = UINT64_MAX;
+static bool          dumping = true;
+static struct iovec  chunks[MAX_CHUNKS];
+static int           n_chunks = 0;
+static char         *wptr = NULL;
+static char         *wend = NULL;
+
+static const char nibbles[16][4] = {
+   "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+   "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111"
+};
+
+static const char bit_map[]       = "01";
+static const char std_logic_map[] = "xx01zx01x";
+
+static void vcd_write_chunks(int count)
+{
+   struct iovec *iov = chunks;
+   while (count > 0) {
+      ssize_t n = writev(vcd_fd, iov, count);
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         fatal_errno("VCD write failed");
+      }
+
+      // Skip over everything written and retry any partial chunk
+      while ((count > 0) && ((size_t)n >= iov->iov_len)) {
+         n -= iov->iov_len;
+         ++iov;
+         --count;
+      }
+
+      if (count > 0) {
+         iov->iov_base = (char *)iov->iov_base + n;
+         iov->iov_len -= n;
+      }
+   }
+}
+
+static void vcd_flush(void)
+{
+   // Output is collected in fixed size chunks that are written with a
+   // single system call once they are all full or the file is closed
+
+   chunks[n_chunks].iov_len = wptr - (char *)chunks[n_chunks].iov_base;
+
+   struct iovec saved[MAX_CHUNKS];
+   memcpy(saved, chunks, sizeof(chunks));
+   vcd_write_chunks(n_chunks + 1);
+   memcpy(chunks, saved, sizeof(chunks));
+
+   n_chunks = 0;
+   wptr = chunks[0].iov_base;
+   wend = wptr + CHUNK_SZ;
+}
+
+static void vcd_next_chunk(void)
+{
+   chunks[n_chunks].iov_len = wptr - (char *)chunks[n_chunks].iov_base;
+
+   if (n_chunks + 1 == MAX_CHUNKS)
+      vcd_flush();
+   else {
+      if (chunks[++n_chunks].iov_base == NULL)
+         chunks[n_chunks].iov_base = xmalloc(CHUNK_SZ);
 
-static FILE    *vcd_file = NULL;
-static ident_t i_vcd_key = NULL;
-static ident_t i_fmt_fn  = NULL;
-static ident_t i_fmt_arg = NULL;
-static char    *scopes[MAX_SCOPE_SZ];
-static int     n_scopes = 0;
-static tree_t  vcd_top = NULL;
+      wptr = chunks[n_chunks].iov_base;
+      wend = wptr + CHUNK_SZ;
+   }
+}
 
-typedef int (*vcd_fmt_fn_t)(char *buf, size_t max, uint64_t val, void *arg);
+static inline char *vcd_reserve(size_t len)
+{
+   assert(len <= CHUNK_SZ);
+   if (unlikely(wptr + len > wend))
+      vcd_next_chunk();
+   return wptr;
+}
 
-static const char *vcd_key_fmt(int key)
+static void vcd_printf(const char *fmt, ...)
 {
-   static char buf[64];
+   char buf[1024];
+
+   va_list ap;
+   va_start(ap, fmt);
+   const int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+   va_end(ap);
 
+   const size_t n = MIN(len, sizeof(buf) - 1);
+   memcpy(vcd_reserve(n), buf, n);
+   wptr += n;
+}
+
+static int vcd_key_fmt(int key, char *buf)
+{
    char *p = buf;
    do {
       *p++ = 33 + (key % (126 - 33));
@@ -51,113 +178,244 @@ static const char *vcd_key_fmt(int key)
    } while (key > 0);
    *p = '\0';
 
-   return buf;
+   return p - buf;
 }
 
-static int vcd_fmt_int(char *buf, size_t max, uint64_t val, void *arg)
+static void emit_time(uint64_t now)
 {
-   return snprintf(buf, max, "h%"PRIx64, val);
+   char digits[20];
+   int n = 0;
+   do {
+      digits[n++] = '0' + (now % 10);
+      now /= 10;
+   } while (now > 0);
+
+   char *p = vcd_reserve(n + 2);
+   *p++ = '#';
+   while (n > 0)
+      *p++ = digits[--n];
+   *p++ = '\n';
+   wptr = p;
 }
 
-static int vcd_fmt_enum(char *buf, size_t max, uint64_t val, void *arg)
+static void emit_value(const vcd_sig_t *sig, const uint64_t *vals, int w)
 {
-   return snprintf(buf, max, "%c", ((const char*)arg)[val]);
+   char *p = vcd_reserve(MAX_LINE);
+
+   switch (sig->kind) {
+   case VCD_SCALAR:
+      *p++ = sig->map[vals[0]];
+      break;
+
+   case VCD_VECTOR:
+      *p++ = 'b';
+      if (sig->downto) {
+         for (int i = w - 1; i >= 0; i--)
+            *p++ = sig->map[vals[i]];
+      }
+      else {
+         for (int i = 0; i < w; i++)
+            *p++ = sig->map[vals[i]];
+      }
+      *p++ = ' ';
+      break;
+
+   case VCD_INTEGER:
+      *p++ = 'b';
+      for (int i = INT_WIDTH - 4; i >= 0; i -= 4, p += 4)
+         memcpy(p, nibbles[(vals[0] >> i) & 0xf], 4);
+      *p++ = ' ';
+      break;
+   }
+
+   memcpy(p, sig->key, sig->keylen);
+   p += sig->keylen;
+   *p++ = '\n';
+
+   wptr = p;
 }
 
-static bool vcd_set_fmt_fn(tree_t decl)
+static void vcd_emit(uint64_t now, const vcd_sig_t *sig,
+                     const uint64_t *vals, int w)
 {
-   type_t type = tree_type(decl);
-
-   if (type_is_array(type))
-      type = type_elem(type);
+   if (now != last_time) {
+      emit_time(now);
+      last_time = now;
+   }
 
-   while (type_kind(type) == T_SUBTYPE)
-      type = type_base(type);
+   emit_value(sig, vals, w);
+}
 
-   vcd_fmt_fn_t fn = NULL;
-   void *arg = NULL;
+static void vcd_do_control(uint64_t now, vcd_ctrl_t what)
+{
+   if (now != last_time) {
+      emit_time(now);
+      last_time = now;
+   }
 
-   switch (type_kind(type)) {
-   case T_INTEGER:
-      fn = vcd_fmt_int;
+   switch (what) {
+   case VCD_DUMPON:
+      // The current values follow as separate records
+      vcd_printf("$dumpon\n");
       break;
 
-   case T_ENUM:
-      {
-         ident_t i = type_ident(type);
-         if (icmp(i, "STD.STANDARD.BIT"))
-            arg = "01xz";
-         else if (icmp(i, "IEEE.STD_LOGIC_1164.STD_ULOGIC"))
-            arg = "xx01zx01x";
-
-         if (arg != NULL)
-            fn = vcd_fmt_enum;
-      }
+   case VCD_DUMPEND:
+      vcd_printf("$end\n");
       break;
 
-   default:
+   case VCD_DUMPOFF:
+      vcd_printf("$dumpoff\n");
+      for (int i = 0; i < n_sigs; i++) {
+         const vcd_sig_t *sig = &(sigs[i]);
+         char *p = vcd_reserve(MAX_LINE);
+         if (sig->kind == VCD_SCALAR)
+            *p++ = 'x';
+         else {
+            memcpy(p, "bx ", 3);
+            p += 3;
+         }
+         memcpy(p, sig->key, sig->keylen);
+         p += sig->keylen;
+         *p++ = '\n';
+         wptr = p;
+      }
+      vcd_printf("$end\n");
       break;
    }
+}
+
+static void vcd_consume(const void *rec, size_t len, void *context)
+{
+   // A record without signal data changes the dump state
+   const vcd_event_t *e = rec;
+   if (e->sig != NULL)
+      vcd_emit(e->when, e->sig, e->vals, e->nvals);
+   else
+      vcd_do_control(e->when, e->nvals);
+}
 
-   if (fn == NULL) {
-      warnf("cannot format type %s in VCD", istr(type_ident(type)));
-      return false;
+static void vcd_event_cb(uint64_t now, tree_t decl, void *context)
+{
+   vcd_sig_t *sig = context;
+
+   if (!dumping)
+      return;
+   else if (ring != NULL) {
+      const size_t max =
+         sizeof(vcd_event_t) + MAX_VAR_WIDTH * sizeof(uint64_t);
+      vcd_event_t *e = ring_reserve(ring, max);
+      e->when  = now;
+      e->sig   = sig;
+      e->nvals = rt_signal_value(decl, e->vals, MAX_VAR_WIDTH, false);
+      ring_commit(ring, sizeof(vcd_event_t) + e->nvals * sizeof(uint64_t));
    }
    else {
-      tree_add_attr_ptr(decl, i_fmt_fn, fn);
-      tree_add_attr_ptr(decl, i_fmt_arg, arg);
-      return true;
+      uint64_t vals[MAX_VAR_WIDTH];
+      const int w = rt_signal_value(decl, vals, MAX_VAR_WIDTH, false);
+      vcd_emit(now, sig, vals, w);
    }
 }
 
-static const char *vcd_value_fmt(tree_t decl)
+static void vcd_close(void)
 {
-   static char buf[MAX_TEXT_WIDTH];
-
-   vcd_fmt_fn_t fn = tree_attr_ptr(decl, i_fmt_fn);
-   void *arg = tree_attr_ptr(decl, i_fmt_arg);
+   if (ring != NULL) {
+      ring_free(ring);
+      ring = NULL;
+   }
 
-   uint64_t vals[MAX_VAR_WIDTH];
-   int w = rt_signal_value(decl, vals, MAX_VAR_WIDTH, false);
-   type_t type = tree_type(decl);
-   if (type_is_array(type)) {
-      char *p = buf;
-      const char *end = buf + MAX_TEXT_WIDTH;
-      p += snprintf(p, end - p, "b");
+   if (vcd_fd != -1) {
+      vcd_flush();
+      close(vcd_fd);
+      vcd_fd = -1;
+   }
+}
 
-      if (type_dim(type, 0).kind == RANGE_DOWNTO) {
-         for (int i = w - 1; i >= 0; i--)
-            p += (*fn)(p, end - p, vals[i], arg);
-      }
-      else {
-         for (int i = 0; i < w; i++)
-            p += (*fn)(p, end - p, vals[i], arg);
-      }
+static void vcd_control(uint64_t now, vcd_ctrl_t what)
+{
+   if (ring != NULL) {
+      vcd_event_t *e = ring_reserve(ring, sizeof(vcd_event_t));
+      e->when  = now;
+      e->sig   = NULL;
+      e->nvals = what;
+      ring_commit(ring, sizeof(vcd_event_t));
    }
    else
-      (*fn)(buf, MAX_TEXT_WIDTH, vals[0], arg);
-
-   return buf;
+      vcd_do_control(now, what);
 }
 
-static void emit_value(tree_t decl)
+void vcd_dump(uint64_t now, bool on)
 {
-   int key = tree_attr_int(decl, i_vcd_key, -1);
-   fprintf(vcd_file, "%s%s%s\n", vcd_value_fmt(decl),
-           (type_kind(tree_type(decl)) == T_CARRAY ? " " : ""),
-           vcd_key_fmt(key));
+   if ((vcd_fd == -1) || (on == dumping))
+      return;
+
+   vcd_control(now, on ? VCD_DUMPON : VCD_DUMPOFF);
+
+   dumping = on;
+
+   // Write the current value of every signal when dumping resumes
+   if (on) {
+      for (int i = 0; i < n_sigs; i++)
+         vcd_event_cb(now, sigs[i].decl, &(sigs[i]));
+      vcd_control(now, VCD_DUMPEND);
+   }
 }
 
-static void vcd_event_cb(uint64_t now, tree_t decl)
+static bool vcd_init_sig(tree_t decl, vcd_sig_t *sig, int *width)
 {
-   static uint64_t last_time = UINT64_MAX;
+   type_t type = tree_type(decl);
 
-   if (now != last_time) {
-      fprintf(vcd_file, "#%"PRIu64"\n", now);
-      last_time = now;
+   const bool array = type_is_array(type);
+   if (array) {
+      int64_t low, high;
+      range_bounds(type_dim(type, 0), &low, &high);
+
+      if ((type_dims(type) > 1) || (high < low)
+          || (high - low + 1 > MAX_VAR_WIDTH)) {
+         warnf("cannot format signal %s in VCD", istr(tree_ident(decl)));
+         return false;
+      }
+
+      sig->kind   = VCD_VECTOR;
+      sig->downto = (type_dim(type, 0).kind == RANGE_DOWNTO);
+      *width      = high - low + 1;
+
+      type = type_elem(type);
+   }
+
+   type = type_base_recur(type);
+
+   switch (type_kind(type)) {
+   case T_INTEGER:
+      if (array)
+         break;
+
+      sig->kind = VCD_INTEGER;
+      *width    = INT_WIDTH;
+      return true;
+
+   case T_ENUM:
+      {
+         ident_t i = type_ident(type);
+         if (icmp(i, "STD.STANDARD.BIT"))
+            sig->map = bit_map;
+         else if (icmp(i, "IEEE.STD_LOGIC_1164.STD_ULOGIC"))
+            sig->map = std_logic_map;
+         else
+            break;
+
+         if (!array) {
+            sig->kind = VCD_SCALAR;
+            *width    = 1;
+         }
+      }
+      return true;
+
+   default:
+      break;
    }
 
-   emit_value(decl);
+   warnf("cannot format type %s in VCD", istr(type_ident(type)));
+   return false;
 }
 
 static void vcd_enter_scope(tree_t decl)
@@ -171,10 +429,10 @@ static void vcd_enter_scope(tree_t decl)
       if ((n >= n_scopes)
           || ((n < n_scopes) && (strcmp(p, scopes[n]) != 0))) {
          while (n < n_scopes) {
-            fprintf(vcd_file, "$upscope $end\n");
+            vcd_printf("$upscope $end\n");
             free(scopes[--n_scopes]);
          }
-         fprintf(vcd_file, "$scope module %s $end\n", p);
+         vcd_printf("$scope module %s $end\n", p);
          scopes[n_scopes++] = strdup(p);
       }
    } while (++n, (p = strtok(NULL, ":")) && (p < last));
@@ -184,92 +442,101 @@ static void vcd_enter_scope(tree_t decl)
 
 static void vcd_emit_header(void)
 {
-   rewind(vcd_file);
+   vcd_flush();
+
+   if ((lseek(vcd_fd, 0, SEEK_SET) < 0) || (ftruncate(vcd_fd, 0) < 0))
+      fatal_errno("failed to rewind VCD output");
 
    char tmbuf[64];
    time_t t = time(NULL);
    struct tm *tm = localtime(&t);
    strftime(tmbuf, sizeof(tmbuf), "%a, %d %b %Y %T %z", tm);
-   fprintf(vcd_file, "$date\n  %s\n$end\n", tmbuf);
+   vcd_printf("$date\n  %s\n$end\n", tmbuf);
 
-   fprintf(vcd_file, "$version\n  "PACKAGE_STRING"\n$end\n");
-   fprintf(vcd_file, "$timescale\n  1 fs\n$end\n");
+   vcd_printf("$version\n  "PACKAGE_STRING"\n$end\n");
+   vcd_printf("$timescale\n  1 fs\n$end\n");
 }
 
 void vcd_restart(void)
 {
-   if (vcd_file == NULL)
+   if (vcd_fd == -1)
       return;
 
+   // The writer thread must be idle before rewriting the header
+   if (ring != NULL)
+      ring_flush(ring);
+
    vcd_emit_header();
 
-   n_scopes = 0;
-   int next_key = 0;
    const int ndecls = tree_decls(vcd_top);
+
+   // Signal descriptors are stored contiguously and passed directly to
+   // the event callbacks, which are all registered again below so those
+   // from any previous run can be released
+   free(sigs);
+   sigs = xmalloc(ndecls * sizeof(vcd_sig_t));
+   n_sigs = 0;
+
+   n_scopes = 0;
    for (int i = 0; i < ndecls; i++) {
       tree_t d = tree_decl(vcd_top, i);
-      if (tree_kind(d) != T_SIGNAL_DECL)
+      if ((tree_kind(d) != T_SIGNAL_DECL) || !wave_should_dump(d))
          continue;
 
-      if (!vcd_set_fmt_fn(d))
+      vcd_sig_t *sig = &(sigs[n_sigs]);
+      memset(sig, '\0', sizeof(vcd_sig_t));
+      sig->decl = d;
+
+      int w = 1;
+      if (!vcd_init_sig(d, sig, &w))
          continue;
 
-      rt_set_event_cb(d, vcd_event_cb);
+      sig->keylen = vcd_key_fmt(n_sigs, sig->key);
 
-      tree_add_attr_int(d, i_vcd_key, next_key);
-
-      type_t type = tree_type(d);
-      int w = 1;
-      if (type_kind(type) == T_CARRAY) {
-         int64_t low, high;
-         range_bounds(type_dim(type, 0), &low, &high);
-         w = high - low + 1;
-      }
+      rt_set_event_cb(d, vcd_event_cb, sig);
 
       vcd_enter_scope(d);
 
       const char *name = strrchr(istr(tree_ident(d)), ':') + 1;
-      fprintf(vcd_file, "$var reg %d %s %s $end\n",
-              w, vcd_key_fmt(next_key), name);
+      vcd_printf("$var %s %d %s %s $end\n",
+                 (sig->kind == VCD_INTEGER) ? "integer" : "reg",
+                 w, sig->key, name);
 
-      ++next_key;
+      ++n_sigs;
    }
 
    while (n_scopes--)
-      fprintf(vcd_file, "$upscope $end\n");
-
-   fprintf(vcd_file, "$enddefinitions $end\n");
+      vcd_printf("$upscope $end\n");
 
-   fprintf(vcd_file, "$dumpvars\n");
+   vcd_printf("$enddefinitions $end\n");
 
-   for (unsigned i = 0; i < tree_decls(vcd_top); i++) {
-      tree_t d = tree_decl(vcd_top, i);
-      if (tree_kind(d) != T_SIGNAL_DECL)
-         continue;
+   vcd_printf("$dumpvars\n");
 
-      if (tree_attr_int(d, i_vcd_key, -1) == -1)
-         continue;
-
-      emit_value(d);
+   for (int i = 0; i < n_sigs; i++) {
+      uint64_t vals[MAX_VAR_WIDTH];
+      const int w = rt_signal_value(sigs[i].decl, vals, MAX_VAR_WIDTH, false);
+      emit_value(&(sigs[i]), vals, w);
    }
 
-   fprintf(vcd_file, "$end\n");
+   vcd_printf("$end\n");
+
+   last_time = UINT64_MAX;
 }
 
 void vcd_init(const char *filename, tree_t top)
 {
-   i_vcd_key = ident_new("vcd_key");
-   i_fmt_fn  = ident_new("fmt_fn");
-   i_fmt_arg = ident_new("fmt_arg");
-
    vcd_top = top;
 
-   warnf("Use of the VCD file format is discouraged as it cannot fully "
-         "represent many VHDL types and the performance is poor for large "
-         "designs. If you are using GtkWave the --wave option will generate "
-         "an LXT file that overcomes these limitations.");
-
-   vcd_file = fopen(filename, "w");
-   if (vcd_file == NULL)
+   vcd_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (vcd_fd == -1)
       fatal_errno("failed to open VCD output %s", filename);
+
+   chunks[0].iov_base = xmalloc(CHUNK_SZ);
+   wptr = chunks[0].iov_base;
+   wend = wptr + CHUNK_SZ;
+
+   if (opt_get_int("rt-wave-async"))
+      ring = ring_new(RING_SIZE, vcd_consume, NULL);
+
+   atexit(vcd_close);
 }
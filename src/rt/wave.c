@@ -0,0 +1,118 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "rt.h"
+#include "tree.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Selection of the signals written to waveform files. Globs are
+// matched against the full instance path of each signal such as
+// :top:uut:data and dotted paths are accepted as well.
+
+typedef struct glob_list glob_list_t;
+
+struct glob_list {
+   glob_list_t *next;
+   char        *glob;
+   int          len;
+};
+
+static glob_list_t *includes = NULL;
+static glob_list_t *excludes = NULL;
+
+static void wave_add_glob(glob_list_t **list, const char *glob)
+{
+   const bool anchor = (glob[0] != ':') && (glob[0] != '*');
+
+   char *norm = xmalloc(strlen(glob) + 2);
+   char *p = norm;
+   if (anchor)
+      *p++ = ':';
+   for (const char *s = glob; *s != '\0'; s++)
+      *p++ = (*s == '.') ? ':' : tolower((int)*s);
+   *p = '\0';
+
+   glob_list_t *g = xmalloc(sizeof(glob_list_t));
+   g->next = *list;
+   g->glob = norm;
+   g->len  = p - norm;
+
+   *list = g;
+}
+
+static bool wave_match(glob_list_t *list, ident_t name)
+{
+   for (glob_list_t *it = list; it != NULL; it = it->next) {
+      if (ident_glob(name, it->glob, it->len))
+         return true;
+   }
+
+   return false;
+}
+
+void wave_include_glob(const char *glob)
+{
+   wave_add_glob(&includes, glob);
+}
+
+void wave_exclude_glob(const char *glob)
+{
+   wave_add_glob(&excludes, glob);
+}
+
+static void wave_free_globs(glob_list_t **list)
+{
+   while (*list != NULL) {
+      glob_list_t *next = (*list)->next;
+      free((*list)->glob);
+      free(*list);
+      *list = next;
+   }
+}
+
+void wave_clear_globs(void)
+{
+   wave_free_globs(&includes);
+   wave_free_globs(&excludes);
+}
+
+bool wave_should_dump(tree_t decl)
+{
+   ident_t name = tree_ident(decl);
+
+   const int max_depth = opt_get_int("wave-depth");
+   if (max_depth > 0) {
+      // The depth of a signal declared in the top level is one
+      int depth = -1;
+      for (const char *p = istr(name); *p != '\0'; p++) {
+         if (*p == ':')
+            depth++;
+      }
+
+      if (depth > max_depth)
+         return false;
+   }
+
+   if ((includes != NULL) && !wave_match(includes, name))
+      return false;
+
+   return !wave_match(excludes, name);
+}
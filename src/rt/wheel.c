@@ -0,0 +1,282 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "wheel.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hierarchical timing wheel used as a priority queue of 64-bit keys.
+// Each level splits the key into WHEEL_BITS wide digits: a key is
+// stored on the level of the most significant digit where it differs
+// from the base key so level zero holds exactly one key per slot and
+// higher levels are only cascaded down when everything below them has
+// been consumed. Insertion is constant time and extraction is amortised
+// constant time as each key moves down at most WHEEL_LEVELS times.
+
+#define WHEEL_BITS   8
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS (64 / WHEEL_BITS)
+#define WHEEL_WORDS  (WHEEL_SLOTS / 64)
+#define CHUNK_NODES  256
+
+struct node {
+   struct node *next;
+   uint64_t     key;
+   void        *user;
+};
+
+struct slot {
+   struct node *head;
+   struct node *tail;
+};
+
+struct level {
+   uint64_t    bitmap[WHEEL_WORDS];
+   struct slot slots[WHEEL_SLOTS];
+};
+
+struct chunk {
+   struct chunk *next;
+   struct node   nodes[CHUNK_NODES];
+};
+
+struct wheel {
+   uint64_t      base;
+   size_t        size;
+   unsigned      occupied;
+   struct node  *free_nodes;
+   struct chunk *chunks;
+   struct level  levels[WHEEL_LEVELS];
+};
+
+static inline unsigned wheel_level(wheel_t w, uint64_t key)
+{
+   const uint64_t diff = key ^ w->base;
+   if (diff == 0)
+      return 0;
+   else
+      return (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+}
+
+static inline unsigned wheel_slot(uint64_t key, unsigned level)
+{
+   return (key >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+}
+
+static struct node *wheel_alloc_node(wheel_t w)
+{
+   if (unlikely(w->free_nodes == NULL)) {
+      struct chunk *c = xmalloc(sizeof(struct chunk));
+      c->next = w->chunks;
+      w->chunks = c;
+
+      for (int i = 0; i < CHUNK_NODES; i++) {
+         c->nodes[i].next = w->free_nodes;
+         w->free_nodes = &(c->nodes[i]);
+      }
+   }
+
+   struct node *n = w->free_nodes;
+   w->free_nodes = n->next;
+   return n;
+}
+
+static void wheel_link(wheel_t w, struct node *n)
+{
+   const unsigned level = wheel_level(w, n->key);
+   const unsigned slot  = wheel_slot(n->key, level);
+
+   struct level *l = &(w->levels[level]);
+   struct slot  *s = &(l->slots[slot]);
+
+   n->next = NULL;
+   if (s->head == NULL) {
+      s->head = s->tail = n;
+      l->bitmap[slot / 64] |= (1ull << (slot % 64));
+      w->occupied |= (1 << level);
+   }
+   else {
+      s->tail->next = n;
+      s->tail = n;
+   }
+}
+
+static void wheel_clear_slot(wheel_t w, unsigned level, unsigned slot)
+{
+   struct level *l = &(w->levels[level]);
+
+   l->slots[slot].head = l->slots[slot].tail = NULL;
+   l->bitmap[slot / 64] &= ~(1ull << (slot % 64));
+
+   for (int i = 0; i < WHEEL_WORDS; i++) {
+      if (l->bitmap[i] != 0)
+         return;
+   }
+
+   w->occupied &= ~(1 << level);
+}
+
+static unsigned wheel_first_slot(wheel_t w, unsigned level)
+{
+   const struct level *l = &(w->levels[level]);
+   for (int i = 0; i < WHEEL_WORDS; i++) {
+      if (l->bitmap[i] != 0)
+         return (i * 64) + __builtin_ctzll(l->bitmap[i]);
+   }
+
+   assert(false);
+   return 0;
+}
+
+static void wheel_settle(wheel_t w)
+{
+   // Cascade the lowest occupied slot down until there is at least
+   // one key on level zero
+
+   if (unlikely(w->size == 0))
+      fatal("wheel underflow");
+
+   while ((w->occupied & 1) == 0) {
+      const unsigned level = __builtin_ctz(w->occupied);
+      const unsigned slot  = wheel_first_slot(w, level);
+
+      struct node *it = w->levels[level].slots[slot].head;
+      wheel_clear_slot(w, level, slot);
+
+      const unsigned shift = (level + 1) * WHEEL_BITS;
+      const uint64_t high  = (shift >= 64) ? 0 : (w->base >> shift) << shift;
+      w->base = high | ((uint64_t)slot << (level * WHEEL_BITS));
+
+      while (it != NULL) {
+         struct node *next = it->next;
+         wheel_link(w, it);
+         it = next;
+      }
+   }
+}
+
+static void wheel_rebase(wheel_t w, uint64_t key)
+{
+   // Slow path for keys earlier than the current base: rebuild the
+   // whole wheel around the new key preserving the order of equal keys
+
+   struct node *list = NULL, **tail = &list;
+
+   for (int i = 0; i < WHEEL_LEVELS; i++) {
+      for (int j = 0; j < WHEEL_SLOTS; j++) {
+         struct slot *s = &(w->levels[i].slots[j]);
+         if (s->head != NULL) {
+            *tail = s->head;
+            tail = &(s->tail->next);
+         }
+      }
+   }
+
+   memset(w->levels, '\0', sizeof(w->levels));
+   w->occupied = 0;
+   w->base     = key;
+
+   while (list != NULL) {
+      struct node *next = list->next;
+      wheel_link(w, list);
+      list = next;
+   }
+}
+
+wheel_t wheel_new(void)
+{
+   struct wheel *w = xmalloc(sizeof(struct wheel));
+   memset(w, '\0', sizeof(struct wheel));
+   return w;
+}
+
+void wheel_free(wheel_t w)
+{
+   while (w->chunks != NULL) {
+      struct chunk *next = w->chunks->next;
+      free(w->chunks);
+      w->chunks = next;
+   }
+
+   free(w);
+}
+
+void *wheel_extract_min(wheel_t w)
+{
+   wheel_settle(w);
+
+   const unsigned slot = wheel_first_slot(w, 0);
+   struct slot *s = &(w->levels[0].slots[slot]);
+
+   struct node *n = s->head;
+   if ((s->head = n->next) == NULL)
+      wheel_clear_slot(w, 0, slot);
+
+   void *user = n->user;
+   n->next = w->free_nodes;
+   w->free_nodes = n;
+
+   --(w->size);
+   return user;
+}
+
+void *wheel_min(wheel_t w)
+{
+   wheel_settle(w);
+   return w->levels[0].slots[wheel_first_slot(w, 0)].head->user;
+}
+
+uint64_t wheel_min_key(wheel_t w)
+{
+   wheel_settle(w);
+   return w->levels[0].slots[wheel_first_slot(w, 0)].head->key;
+}
+
+void wheel_insert(wheel_t w, uint64_t key, void *user)
+{
+   if (unlikely(key < w->base))
+      wheel_rebase(w, key);
+
+   struct node *n = wheel_alloc_node(w);
+   n->key  = key;
+   n->user = user;
+
+   wheel_link(w, n);
+   ++(w->size);
+}
+
+size_t wheel_size(wheel_t w)
+{
+   return w->size;
+}
+
+void wheel_walk(wheel_t w, wheel_walk_fn_t fn, void *context)
+{
+   for (int i = 0; i < WHEEL_LEVELS; i++) {
+      if ((w->occupied & (1 << i)) == 0)
+         continue;
+
+      for (int j = 0; j < WHEEL_SLOTS; j++) {
+         for (struct node *it = w->levels[i].slots[j].head;
+              it != NULL; it = it->next)
+            (*fn)(it->key, it->user, context);
+      }
+   }
+}
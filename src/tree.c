@@ -19,6 +19,7 @@
 #include "util.h"
 #include "array.h"
 #include "object.h"
+#include "hash.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -54,6 +55,19 @@ typedef struct {
    attr_t   *table;
 } attr_tab_t;
 
+typedef struct {
+   bool valid;
+   union {
+      int  ival;
+      void *pval;
+   };
+} side_ent_t;
+
+struct side_tab {
+   unsigned    alloc;
+   side_ent_t *entries;
+};
+
 enum {
    I_IDENT     = (1 << 0),
    I_VALUE     = (1 << 1),
@@ -348,6 +362,7 @@ static const tree_kind_t change_allowed[][2] = {
 
 struct tree {
    tree_kind_t kind;
+   uint32_t    slot;
    loc_t       loc;
    attr_tab_t  attrs;
    uint32_t    generation;
@@ -360,19 +375,39 @@ struct tree_wr_ctx {
    type_wr_ctx_t   type_ctx;
    ident_wr_ctx_t  ident_ctx;
    unsigned        generation;
+   unsigned        seg_generation;
    unsigned        n_trees;
    const char     *file_names[MAX_FILES];
 };
 
 struct tree_rd_ctx {
-   fbuf_t         *file;
-   type_rd_ctx_t   type_ctx;
-   ident_rd_ctx_t  ident_ctx;
+   fbuf_t             *file;
+   type_rd_ctx_t       type_ctx;
+   ident_rd_ctx_t      ident_ctx;
+   unsigned            n_trees;
+   tree_t             *store;
+   unsigned            store_sz;
+   char               *db_fname;
+   const char         *file_names[MAX_FILES];
+   bool                segment;
+   bool                ended;
+   unsigned            n_lazy;
+   struct lazy        *lazy;
+   struct tree_rd_ctx *lazy_next;
+};
+
+// The declarations and statements of a subprogram body are serialised
+// as a separate segment which is copied out of the file but not parsed
+// until one of them is first accessed
+struct lazy {
+   tree_t          tree;
+   tree_rd_ctx_t   ctx;
+   uint8_t        *data;
+   size_t          len;
+   unsigned        tree_base;
    unsigned        n_trees;
-   tree_t         *store;
-   unsigned        store_sz;
-   char           *db_fname;
-   const char     *file_names[MAX_FILES];
+   unsigned        type_base;
+   struct lazy    *next;
 };
 
 static const tree_kind_t stmt_kinds[] = {
@@ -408,6 +443,11 @@ static tree_t *all_trees = NULL;
 static size_t max_trees = 128;   // Grows at runtime
 static size_t n_trees_alloc = 0;
 
+static uint32_t next_slot = 0;
+
+static hash_t        *lazy_map = NULL;
+static tree_rd_ctx_t  lazy_ctxs = NULL;
+
 static uint32_t format_digest;
 static int      item_lookup[T_LAST_TREE_KIND][32];
 static size_t   object_size[T_LAST_TREE_KIND];
@@ -421,7 +461,7 @@ static void tree_one_time_init(void)
    if (likely(done))
       return;
 
-   format_digest = type_format_digest();
+   format_digest = type_format_digest() + FORMAT_VERSION;
 
    for (int i = 0; i < T_LAST_TREE_KIND; i++) {
       const int nitems = __builtin_popcount(has_map[i]);
@@ -497,6 +537,83 @@ static void item_without_type(imask_t mask)
    fatal_trace("tree item %s does not have a type", item_text_map[item]);
 }
 
+static bool tree_is_lazy_kind(tree_kind_t kind)
+{
+   return (kind == T_FUNC_BODY) || (kind == T_PROC_BODY);
+}
+
+static void read_a(tree_array_t *a, tree_rd_ctx_t ctx);
+static void tree_read_free(tree_rd_ctx_t ctx);
+
+static void tree_lazy_load(tree_t t)
+{
+   if (!tree_is_lazy_kind(t->kind))
+      return;
+
+   struct lazy *l = hash_get(lazy_map, t);
+   if (l == NULL)
+      return;
+
+   hash_put(lazy_map, t, NULL);
+
+   tree_rd_ctx_t ctx = l->ctx;
+   assert(!ctx->segment);
+
+   // Read the segment using the indexes reserved for it when the
+   // rest of the unit was loaded
+   fbuf_t *outer = ctx->file;
+   fbuf_t *f = fbuf_open_mem(l->data, l->len, ctx->db_fname);
+
+   const unsigned old_trees = ctx->n_trees;
+   const unsigned old_types = type_read_seek(ctx->type_ctx, l->type_base);
+
+   ctx->file    = f;
+   ctx->segment = true;
+   ctx->n_trees = l->tree_base;
+   ident_read_redirect(ctx->ident_ctx, f, true);
+
+   read_a(&(lookup_item(t, I_DECLS)->tree_array), ctx);
+   read_a(&(lookup_item(t, I_STMTS)->tree_array), ctx);
+
+   if (ctx->n_trees != l->tree_base + l->n_trees)
+      fatal("%s: corrupt body of subprogram %s", ctx->db_fname,
+            istr(lookup_item(t, I_IDENT)->ident));
+
+   ident_read_redirect(ctx->ident_ctx, outer, false);
+   type_read_seek(ctx->type_ctx, old_types);
+   ctx->n_trees = old_trees;
+   ctx->segment = false;
+   ctx->file    = outer;
+
+   fbuf_close(f);
+
+   struct lazy **it;
+   for (it = &(ctx->lazy); *it != l; it = &((*it)->next))
+      ;
+   *it = l->next;
+
+   free(l->data);
+   free(l);
+
+   if (--(ctx->n_lazy) == 0) {
+      tree_rd_ctx_t *c;
+      for (c = &lazy_ctxs; *c != ctx; c = &((*c)->lazy_next))
+         ;
+      *c = ctx->lazy_next;
+
+      if (ctx->ended)
+         tree_read_free(ctx);
+   }
+}
+
+static item_t *lookup_lazy_item(tree_t t, imask_t mask)
+{
+   if (unlikely(lazy_map != NULL))
+      tree_lazy_load(t);
+
+   return lookup_item(t, mask);
+}
+
 static bool tree_kind_in(tree_t t, const tree_kind_t *list, size_t len)
 {
    for (size_t i = 0; i < len; i++) {
@@ -539,6 +656,7 @@ tree_t tree_new(tree_kind_t kind)
    memset(t, '\0', object_size[kind]);
    t->kind  = kind;
    t->index = UINT32_MAX;
+   t->slot  = UINT32_MAX;
 
    if (all_trees == NULL)
       all_trees = xmalloc(sizeof(tree_t) * max_trees);
@@ -556,6 +674,21 @@ void tree_gc(void)
    // Generation will be updated by tree_visit
    const unsigned base_gen = next_generation;
 
+   // Unread segments may refer to any tree loaded before them
+   for (tree_rd_ctx_t it = lazy_ctxs; it != NULL; it = it->lazy_next) {
+      object_visit_ctx_t ctx = {
+         .count      = 0,
+         .fn         = NULL,
+         .context    = NULL,
+         .kind       = T_LAST_TREE_KIND,
+         .generation = next_generation++,
+         .deep       = true
+      };
+
+      for (unsigned i = 0; i < it->n_trees; i++)
+         tree_visit_aux(it->store[i], &ctx);
+   }
+
    // Mark
    for (unsigned i = 0; i < n_trees_alloc; i++) {
       assert(all_trees[i] != NULL);
@@ -865,34 +998,34 @@ void tree_set_value(tree_t t, tree_t v)
 
 unsigned tree_decls(tree_t t)
 {
-   return lookup_item(t, I_DECLS)->tree_array.count;
+   return lookup_lazy_item(t, I_DECLS)->tree_array.count;
 }
 
 tree_t tree_decl(tree_t t, unsigned n)
 {
-   return tree_array_nth(&(lookup_item(t, I_DECLS)->tree_array), n);
+   return tree_array_nth(&(lookup_lazy_item(t, I_DECLS)->tree_array), n);
 }
 
 void tree_add_decl(tree_t t, tree_t d)
 {
    tree_assert_decl(d);
-   tree_array_add(&(lookup_item(t, I_DECLS)->tree_array), d);
+   tree_array_add(&(lookup_lazy_item(t, I_DECLS)->tree_array), d);
 }
 
 unsigned tree_stmts(tree_t t)
 {
-   return lookup_item(t, I_STMTS)->tree_array.count;
+   return lookup_lazy_item(t, I_STMTS)->tree_array.count;
 }
 
 tree_t tree_stmt(tree_t t, unsigned n)
 {
-   return tree_array_nth(&(lookup_item(t, I_STMTS)->tree_array), n);
+   return tree_array_nth(&(lookup_lazy_item(t, I_STMTS)->tree_array), n);
 }
 
 void tree_add_stmt(tree_t t, tree_t s)
 {
    tree_assert_stmt(s);
-   tree_array_add(&(lookup_item(t, I_STMTS)->tree_array), s);
+   tree_array_add(&(lookup_lazy_item(t, I_STMTS)->tree_array), s);
 }
 
 unsigned tree_waveforms(tree_t t)
@@ -1185,6 +1318,10 @@ void tree_visit_aux(tree_t t, object_visit_ctx_t *ctx)
 
    t->generation = ctx->generation;
 
+   // The garbage collector does not need unread segments to be loaded
+   if (unlikely(lazy_map != NULL) && !ctx->deep)
+      tree_lazy_load(t);
+
    const imask_t deep_mask = I_TYPE | I_REF;
 
    const imask_t has = has_map[t->kind];
@@ -1282,7 +1419,7 @@ unsigned tree_visit_only(tree_t t, tree_visit_fn_t fn,
 static void write_loc(loc_t *l, tree_wr_ctx_t ctx)
 {
    if (l->file == NULL) {
-      write_u16(0xfffe, ctx->file);  // Invalid location marker
+      write_uint(0, ctx->file);  // Invalid location marker
       return;
    }
 
@@ -1298,65 +1435,183 @@ static void write_loc(loc_t *l, tree_wr_ctx_t ctx)
    if (ctx->file_names[findex] == NULL) {
       const size_t len = strlen(l->file) + 1;
 
-      ctx->file_names[findex] = l->file;
+      // Names first used inside a segment are repeated in full
+      if (ctx->seg_generation == 0)
+         ctx->file_names[findex] = l->file;
 
-      write_u16(findex | 0x8000, ctx->file);
-      write_u16(len, ctx->file);
+      write_uint((findex << 1) + 2, ctx->file);
+      write_uint(len, ctx->file);
       write_raw(l->file, len, ctx->file);
    }
    else
-      write_u16(findex, ctx->file);
+      write_uint((findex << 1) + 1, ctx->file);
 
-   write_u16(l->first_line, ctx->file);
-   write_u16(l->first_column, ctx->file);
-   write_u16(l->last_line, ctx->file);
-   write_u16(l->last_column, ctx->file);
+   // Most locations are on a single line
+   write_uint(l->first_line, ctx->file);
+   write_uint(l->first_column, ctx->file);
+   write_int(l->last_line - l->first_line, ctx->file);
+   write_uint(l->last_column, ctx->file);
 }
 
 static loc_t read_loc(tree_rd_ctx_t ctx)
 {
    const char *fname;
-   uint16_t fmarker = read_u16(ctx->file);
-   if (fmarker == 0xfffe)
+   const uint64_t fmarker = read_uint(ctx->file);
+   if (fmarker == 0)
       return LOC_INVALID;
-   else if (fmarker & 0x8000) {
-      uint8_t index = fmarker & 0x7fff;
+   else if ((fmarker & 1) == 0) {
+      const unsigned index = (fmarker - 2) >> 1;
       assert(index < MAX_FILES);
-      uint16_t len = read_u16(ctx->file);
+      const size_t len = read_uint(ctx->file);
       char *buf = xmalloc(len);
       read_raw(buf, len, ctx->file);
 
-      ctx->file_names[index] = buf;
+      if (!ctx->segment)
+         ctx->file_names[index] = buf;
       fname = buf;
    }
    else {
-      assert(fmarker < MAX_FILES);
-      fname = ctx->file_names[fmarker];
+      const unsigned index = fmarker >> 1;
+      assert(index < MAX_FILES);
+      fname = ctx->file_names[index];
       assert(fname != NULL);
    }
 
    loc_t l = { .file = fname, .linebuf = NULL };
-   l.first_line   = read_u16(ctx->file);
-   l.first_column = read_u16(ctx->file);
-   l.last_line    = read_u16(ctx->file);
-   l.last_column  = read_u16(ctx->file);
+   l.first_line   = read_uint(ctx->file);
+   l.first_column = read_uint(ctx->file);
+   l.last_line    = l.first_line + read_int(ctx->file);
+   l.last_column  = read_uint(ctx->file);
    return l;
 }
 
 static void write_a(tree_array_t *a, tree_wr_ctx_t ctx)
 {
-   write_u32(a->count, ctx->file);
+   write_uint(a->count, ctx->file);
    for (unsigned i = 0; i < a->count; i++)
       tree_write(a->items[i], ctx);
 }
 
 static void read_a(tree_array_t *a, tree_rd_ctx_t ctx)
 {
-   tree_array_resize(a, read_u32(ctx->file), NULL);
+   tree_array_resize(a, read_uint(ctx->file), NULL);
    for (unsigned i = 0; i < a->count; i++)
       a->items[i] = tree_read(ctx);
 }
 
+static void write_lazy(tree_t t, tree_wr_ctx_t ctx)
+{
+   // Trees, types, and identifiers first seen inside the segment
+   // cannot be referenced from outside it so are forgotten at the end
+   // but tree and type indexes are not reused
+
+   fbuf_t *outer = ctx->file;
+   fbuf_t *f = fbuf_open_buffer();
+
+   ctx->file           = f;
+   ctx->seg_generation = next_generation++;
+   ident_write_redirect(ctx->ident_ctx, f, true);
+
+   const unsigned tree_base = ctx->n_trees;
+   const unsigned type_base =
+      type_write_segment(ctx->type_ctx, ctx->seg_generation);
+
+   write_a(&(lookup_item(t, I_DECLS)->tree_array), ctx);
+   write_a(&(lookup_item(t, I_STMTS)->tree_array), ctx);
+
+   const unsigned n_types = type_write_segment(ctx->type_ctx, 0) - type_base;
+
+   ident_write_redirect(ctx->ident_ctx, outer, false);
+   ctx->seg_generation = 0;
+   ctx->file           = outer;
+
+   size_t len;
+   void *data = fbuf_close_buffer(f, &len);
+
+   write_uint(ctx->n_trees - tree_base, outer);
+   write_uint(n_types, outer);
+   write_uint(len, outer);
+   write_raw(data, len, outer);
+
+   free(data);
+}
+
+static void read_lazy(tree_t t, tree_rd_ctx_t ctx)
+{
+   struct lazy *l = xmalloc(sizeof(struct lazy));
+   l->tree      = t;
+   l->ctx       = ctx;
+   l->n_trees   = read_uint(ctx->file);
+   l->type_base = type_read_skip(ctx->type_ctx, read_uint(ctx->file));
+   l->len       = read_uint(ctx->file);
+   l->data      = xmalloc(l->len);
+   l->tree_base = ctx->n_trees;
+
+   read_raw(l->data, l->len, ctx->file);
+
+   // Reserve the indexes used by trees in the segment
+   ctx->n_trees += l->n_trees;
+   if (ctx->n_trees >= ctx->store_sz) {
+      ctx->store_sz = next_power_of_2(ctx->n_trees + 1);
+      ctx->store = xrealloc(ctx->store, ctx->store_sz * sizeof(tree_t));
+   }
+
+   for (unsigned i = l->tree_base; i < ctx->n_trees; i++)
+      ctx->store[i] = NULL;
+
+   if (lazy_map == NULL)
+      lazy_map = hash_new(1024, true);
+   hash_put(lazy_map, t, l);
+
+   if (ctx->n_lazy++ == 0) {
+      ctx->lazy_next = lazy_ctxs;
+      lazy_ctxs = ctx;
+   }
+
+   l->next   = ctx->lazy;
+   ctx->lazy = l;
+}
+
+static void write_netids(const netid_array_t *a, fbuf_t *f)
+{
+   // Nets belonging to a signal are usually numbered consecutively
+   // so store runs of increasing IDs
+   write_uint(a->count, f);
+
+   netid_t expect = 0;
+   for (unsigned i = 0; i < a->count; ) {
+      const netid_t first = a->items[i];
+
+      unsigned len = 1;
+      while ((i + len < a->count) && (a->items[i + len] == first + len))
+         len++;
+
+      write_int((int64_t)first - expect, f);
+      write_uint(len, f);
+
+      expect = first + len;
+      i += len;
+   }
+}
+
+static void read_netids(netid_array_t *a, fbuf_t *f)
+{
+   netid_array_resize(a, read_uint(f), NETID_INVALID);
+
+   netid_t expect = 0;
+   for (unsigned i = 0; i < a->count; ) {
+      const netid_t first = expect + read_int(f);
+      const unsigned len = read_uint(f);
+      if ((len == 0) || (len > a->count - i))
+         fatal("corrupt net ID array");
+
+      for (unsigned j = 0; j < len; j++)
+         a->items[i++] = first + j;
+
+      expect = first + len;
+   }
+}
+
 tree_wr_ctx_t tree_write_begin(fbuf_t *f)
 {
    write_u32(format_digest, f);
@@ -1366,6 +1621,8 @@ tree_wr_ctx_t tree_write_begin(fbuf_t *f)
    ctx->generation = next_generation++;
    ctx->n_trees    = 0;
    ctx->ident_ctx  = ident_write_begin(f);
+
+   ctx->seg_generation = 0;
    ctx->type_ctx   = type_write_begin(ctx, ctx->ident_ctx);
    memset(ctx->file_names, '\0', sizeof(ctx->file_names));
 
@@ -1391,28 +1648,41 @@ void tree_write(tree_t t, tree_wr_ctx_t ctx)
 #endif  // EXTRA_READ_CHECKS
 
    if (t == NULL) {
-      write_u16(0xffff, ctx->file);  // Null marker
+      write_uint(MARKER_NULL, ctx->file);
       return;
    }
 
-   if (t->generation == ctx->generation) {
+   const bool visited = (t->generation == ctx->generation)
+      || ((ctx->seg_generation != 0) && (t->generation == ctx->seg_generation));
+
+   if (visited) {
       // Already visited this tree
-      write_u16(0xfffe, ctx->file);   // Back reference marker
-      write_u32(t->index, ctx->file);
+      write_uint(MARKER_BACKREF, ctx->file);
+      write_uint(t->index, ctx->file);
       return;
    }
 
-   t->generation = ctx->generation;
+   if (unlikely(lazy_map != NULL))
+      tree_lazy_load(t);
+
+   t->generation =
+      (ctx->seg_generation != 0) ? ctx->seg_generation : ctx->generation;
    t->index      = (ctx->n_trees)++;
 
-   write_u16(t->kind, ctx->file);
+   write_uint(t->kind + MARKER_KIND, ctx->file);
    write_loc(&t->loc, ctx);
 
+   // Subprogram bodies are not nested inside segments
+   const bool lazy =
+      tree_is_lazy_kind(t->kind) && (ctx->seg_generation == 0);
+
    const uint32_t has = has_map[t->kind];
    const int nitems = __builtin_popcount(has);
    uint32_t mask = 1;
    for (int n = 0; n < nitems; mask <<= 1) {
-      if (has & mask) {
+      if (lazy && (mask & (I_DECLS | I_STMTS)))
+         n++;
+      else if (has & mask) {
          if (ITEM_IDENT & mask)
             ident_write(t->items[n].ident, ctx->ident_ctx);
          else if (ITEM_TREE & mask)
@@ -1422,7 +1692,7 @@ void tree_write(tree_t t, tree_wr_ctx_t ctx)
          else if (ITEM_TYPE & mask)
             type_write(t->items[n].type, ctx->type_ctx);
          else if (ITEM_INT64 & mask)
-            write_u64(t->items[n].ival, ctx->file);
+            write_int(t->items[n].ival, ctx->file);
          else if (ITEM_RANGE & mask) {
             if (t->items[n].range != NULL) {
                write_u8(t->items[n].range->kind, ctx->file);
@@ -1432,12 +1702,8 @@ void tree_write(tree_t t, tree_wr_ctx_t ctx)
             else
                write_u8(0xff, ctx->file);
          }
-         else if (ITEM_NETID_ARRAY & mask) {
-            const netid_array_t *a = &(t->items[n].netid_array);
-            write_u32(a->count, ctx->file);
-            for (unsigned i = 0; i < a->count; i++)
-               write_u32(a->items[i], ctx->file);
-         }
+         else if (ITEM_NETID_ARRAY & mask)
+            write_netids(&(t->items[n].netid_array), ctx->file);
          else if (ITEM_DOUBLE & mask) {
             union { double d; uint64_t i; } u;
             u.d = t->items[n].dval;
@@ -1449,9 +1715,12 @@ void tree_write(tree_t t, tree_wr_ctx_t ctx)
       }
    }
 
-   write_u16(t->attrs.num, ctx->file);
+   if (lazy)
+      write_lazy(t, ctx);
+
+   write_uint(t->attrs.num, ctx->file);
    for (unsigned i = 0; i < t->attrs.num; i++) {
-      write_u16(t->attrs.table[i].kind, ctx->file);
+      write_uint(t->attrs.table[i].kind, ctx->file);
       ident_write(t->attrs.table[i].name, ctx->ident_ctx);
 
       switch (t->attrs.table[i].kind) {
@@ -1460,7 +1729,7 @@ void tree_write(tree_t t, tree_wr_ctx_t ctx)
          break;
 
       case A_INT:
-         write_u32(t->attrs.table[i].ival, ctx->file);
+         write_int(t->attrs.table[i].ival, ctx->file);
          break;
 
       case A_TREE:
@@ -1485,19 +1754,18 @@ tree_t tree_read(tree_rd_ctx_t ctx)
       fatal("bad tree start marker %x", start);
 #endif  // EXTRA_READ_CHECKS
 
-   uint16_t marker = read_u16(ctx->file);
-   if (marker == 0xffff)
-      return NULL;    // Null marker
-   else if (marker == 0xfffe) {
-      // Back reference marker
-      unsigned index = read_u32(ctx->file);
+   const uint64_t marker = read_uint(ctx->file);
+   if (marker == MARKER_NULL)
+      return NULL;
+   else if (marker == MARKER_BACKREF) {
+      unsigned index = read_uint(ctx->file);
       assert(index < ctx->n_trees);
       return ctx->store[index];
    }
 
-   assert(marker < T_LAST_TREE_KIND);
+   assert(marker - MARKER_KIND < T_LAST_TREE_KIND);
 
-   tree_t t = tree_new((tree_kind_t)marker);
+   tree_t t = tree_new((tree_kind_t)(marker - MARKER_KIND));
    t->loc = read_loc(ctx);
 
    // Stash pointer for later back references
@@ -1510,11 +1778,15 @@ tree_t tree_read(tree_rd_ctx_t ctx)
    }
    ctx->store[t->index] = t;
 
+   const bool lazy = tree_is_lazy_kind(t->kind) && !ctx->segment;
+
    const uint32_t has = has_map[t->kind];
    const int nitems = __builtin_popcount(has);
    uint32_t mask = 1;
    for (int n = 0; n < nitems; mask <<= 1) {
-      if (has & mask) {
+      if (lazy && (mask & (I_DECLS | I_STMTS)))
+         n++;
+      else if (has & mask) {
          if (ITEM_IDENT & mask)
             t->items[n].ident = ident_read(ctx->ident_ctx);
          else if (ITEM_TREE & mask)
@@ -1524,7 +1796,7 @@ tree_t tree_read(tree_rd_ctx_t ctx)
          else if (ITEM_TYPE & mask)
             t->items[n].type = type_read(ctx->type_ctx);
          else if (ITEM_INT64 & mask)
-            t->items[n].ival = read_u64(ctx->file);
+            t->items[n].ival = read_int(ctx->file);
          else if (ITEM_RANGE & mask) {
             const uint8_t rmarker = read_u8(ctx->file);
             if (rmarker != 0xff) {
@@ -1534,12 +1806,8 @@ tree_t tree_read(tree_rd_ctx_t ctx)
                t->items[n].range->right = tree_read(ctx);
             }
          }
-         else if (ITEM_NETID_ARRAY & mask) {
-            netid_array_t *a = &(t->items[n].netid_array);
-            netid_array_resize(a, read_u32(ctx->file), NETID_INVALID);
-            for (unsigned i = 0; i < a->count; i++)
-               a->items[i] = read_u32(ctx->file);
-         }
+         else if (ITEM_NETID_ARRAY & mask)
+            read_netids(&(t->items[n].netid_array), ctx->file);
          else if (ITEM_DOUBLE & mask) {
             union { uint64_t i; double d; } u;
             u.i = read_u64(ctx->file);
@@ -1551,14 +1819,17 @@ tree_t tree_read(tree_rd_ctx_t ctx)
       }
    }
 
-   t->attrs.num = read_u16(ctx->file);
+   if (lazy)
+      read_lazy(t, ctx);
+
+   t->attrs.num = read_uint(ctx->file);
    if (t->attrs.num > 0) {
       t->attrs.alloc = next_power_of_2(t->attrs.num);
       t->attrs.table = xmalloc(sizeof(attr_t) * t->attrs.alloc);
    }
 
    for (unsigned i = 0; i < t->attrs.num; i++) {
-      t->attrs.table[i].kind = read_u16(ctx->file);
+      t->attrs.table[i].kind = read_uint(ctx->file);
       t->attrs.table[i].name = ident_read(ctx->ident_ctx);
 
       switch (t->attrs.table[i].kind) {
@@ -1567,7 +1838,7 @@ tree_t tree_read(tree_rd_ctx_t ctx)
          break;
 
       case A_INT:
-         t->attrs.table[i].ival = read_u32(ctx->file);
+         t->attrs.table[i].ival = read_int(ctx->file);
          break;
 
       case A_TREE:
@@ -1606,21 +1877,36 @@ tree_rd_ctx_t tree_read_begin(fbuf_t *f, const char *fname)
    ctx->store     = xmalloc(ctx->store_sz * sizeof(tree_t));
    ctx->n_trees   = 0;
    ctx->db_fname  = strdup(fname);
+   ctx->segment   = false;
+   ctx->ended     = false;
+   ctx->n_lazy    = 0;
+   ctx->lazy      = NULL;
+   ctx->lazy_next = NULL;
    memset(ctx->file_names, '\0', sizeof(ctx->file_names));
 
    return ctx;
 }
 
-void tree_read_end(tree_rd_ctx_t ctx)
+static void tree_read_free(tree_rd_ctx_t ctx)
 {
    ident_read_end(ctx->ident_ctx);
    type_read_end(ctx->type_ctx);
-   fbuf_close(ctx->file);
    free(ctx->store);
    free(ctx->db_fname);
    free(ctx);
 }
 
+void tree_read_end(tree_rd_ctx_t ctx)
+{
+   fbuf_close(ctx->file);
+   ctx->file  = NULL;
+   ctx->ended = true;
+
+   // Keep the context until every segment has been read
+   if (ctx->n_lazy == 0)
+      tree_read_free(ctx);
+}
+
 fbuf_t *tree_read_file(tree_rd_ctx_t ctx)
 {
    return ctx->file;
@@ -1629,6 +1915,18 @@ fbuf_t *tree_read_file(tree_rd_ctx_t ctx)
 tree_t tree_read_recall(tree_rd_ctx_t ctx, uint32_t index)
 {
    assert(index < ctx->n_trees);
+
+   if (ctx->store[index] == NULL) {
+      // Load the segment containing this tree
+      for (struct lazy *it = ctx->lazy; it != NULL; it = it->next) {
+         if ((index >= it->tree_base)
+             && (index < it->tree_base + it->n_trees)) {
+            tree_lazy_load(it->tree);
+            break;
+         }
+      }
+   }
+
    return ctx->store[index];
 }
 
@@ -1714,6 +2012,71 @@ void tree_add_attr_tree(tree_t t, ident_t name, tree_t val)
    tree_add_attr(t, name, A_TREE)->tval = val;
 }
 
+side_tab_t *side_tab_new(void)
+{
+   side_tab_t *tab = xmalloc(sizeof(side_tab_t));
+   tab->alloc   = 0;
+   tab->entries = NULL;
+
+   return tab;
+}
+
+void side_tab_free(side_tab_t *tab)
+{
+   free(tab->entries);
+   free(tab);
+}
+
+static side_ent_t *side_tab_slot(side_tab_t *tab, tree_t t)
+{
+   assert(t != NULL);
+
+   // Slots are never reused so a tree keeps the same position in
+   // every table for the lifetime of the process
+   if (t->slot == UINT32_MAX)
+      t->slot = next_slot++;
+
+   if (t->slot >= tab->alloc) {
+      const unsigned alloc = MAX(next_power_of_2(t->slot + 1), 256);
+      tab->entries = xrealloc(tab->entries, alloc * sizeof(side_ent_t));
+      memset(tab->entries + tab->alloc, '\0',
+             (alloc - tab->alloc) * sizeof(side_ent_t));
+      tab->alloc = alloc;
+   }
+
+   return &(tab->entries[t->slot]);
+}
+
+void side_tab_put(side_tab_t *tab, tree_t t, void *value)
+{
+   side_ent_t *e = side_tab_slot(tab, t);
+   e->valid = true;
+   e->pval  = value;
+}
+
+void side_tab_put_int(side_tab_t *tab, tree_t t, int n)
+{
+   side_ent_t *e = side_tab_slot(tab, t);
+   e->valid = true;
+   e->ival  = n;
+}
+
+void *side_tab_get(side_tab_t *tab, tree_t t)
+{
+   if (t->slot >= tab->alloc)
+      return NULL;
+   else
+      return tab->entries[t->slot].valid ? tab->entries[t->slot].pval : NULL;
+}
+
+int side_tab_get_int(side_tab_t *tab, tree_t t, int def)
+{
+   if (t->slot >= tab->alloc)
+      return def;
+   else
+      return tab->entries[t->slot].valid ? tab->entries[t->slot].ival : def;
+}
+
 tree_t tree_rewrite_aux(tree_t t, object_rewrite_ctx_t *ctx)
 {
    if (t == NULL)
@@ -1724,6 +2087,9 @@ tree_t tree_rewrite_aux(tree_t t, object_rewrite_ctx_t *ctx)
       return ctx->cache[t->index];
    }
 
+   if (unlikely(lazy_map != NULL))
+      tree_lazy_load(t);
+
    const imask_t skip_mask = I_REF;
 
    const imask_t has = has_map[t->kind];
@@ -1780,6 +2146,12 @@ tree_t tree_rewrite_aux(tree_t t, object_rewrite_ctx_t *ctx)
    t->generation = ctx->generation;
    t->index      = ctx->index++;
 
+   if (t->index == ctx->cache_sz) {
+      // Loading a subprogram body may have created more trees
+      ctx->cache_sz *= 2;
+      ctx->cache = xrealloc(ctx->cache, ctx->cache_sz * sizeof(tree_t));
+   }
+
    // Rewrite this tree before we rewrite the type as there may
    // be a circular reference
    ctx->cache[t->index] = (*ctx->fn)(t, ctx->context);
@@ -1792,12 +2164,13 @@ tree_t tree_rewrite_aux(tree_t t, object_rewrite_ctx_t *ctx)
 
 tree_t tree_rewrite(tree_t t, tree_rewrite_fn_t fn, void *context)
 {
-   size_t cache_sz = sizeof(tree_t) * n_trees_alloc;
-   tree_t *cache = xmalloc(cache_sz);
-   memset(cache, '\0', cache_sz);
+   const size_t cache_sz = MAX(n_trees_alloc, 16);
+   tree_t *cache = xmalloc(cache_sz * sizeof(tree_t));
+   memset(cache, '\0', cache_sz * sizeof(tree_t));
 
    object_rewrite_ctx_t ctx = {
       .cache      = cache,
+      .cache_sz   = cache_sz,
       .index      = 0,
       .generation = next_generation++,
       .fn         = fn,
@@ -1805,7 +2178,7 @@ tree_t tree_rewrite(tree_t t, tree_rewrite_fn_t fn, void *context)
    };
 
    tree_t result = tree_rewrite_aux(t, &ctx);
-   free(cache);
+   free(ctx.cache);
    return result;
 }
 
@@ -1817,6 +2190,9 @@ bool tree_copy_mark(tree_t t, object_copy_ctx_t *ctx)
    if (t->generation == ctx->generation)
       return (t->index != UINT32_MAX);
 
+   if (unlikely(lazy_map != NULL))
+      tree_lazy_load(t);
+
    t->generation = ctx->generation;
    t->index      = UINT32_MAX;
 
@@ -272,6 +272,18 @@ void *tree_attr_ptr(tree_t t, ident_t name);
 tree_t tree_attr_tree(tree_t t, ident_t name);
 void tree_add_attr_tree(tree_t t, ident_t name, tree_t val);
 
+// Side tables hold data for a pass in a dense array indexed by a slot
+// number assigned to each tree on first use. They are not written out
+// with the tree and lookup is constant time unlike attributes.
+typedef struct side_tab side_tab_t;
+
+side_tab_t *side_tab_new(void);
+void side_tab_free(side_tab_t *tab);
+void side_tab_put(side_tab_t *tab, tree_t t, void *value);
+void *side_tab_get(side_tab_t *tab, tree_t t);
+void side_tab_put_int(side_tab_t *tab, tree_t t, int n);
+int side_tab_get_int(side_tab_t *tab, tree_t t, int def);
+
 typedef void (*tree_visit_fn_t)(tree_t t, void *context);
 unsigned tree_visit(tree_t t, tree_visit_fn_t fn, void *context);
 unsigned tree_visit_only(tree_t t, tree_visit_fn_t fn,
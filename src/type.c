@@ -140,6 +140,7 @@ struct type_wr_ctx {
    tree_wr_ctx_t  tree_ctx;
    ident_wr_ctx_t ident_ctx;
    unsigned       generation;
+   unsigned       seg_generation;
    unsigned       n_types;
 };
 
@@ -672,21 +673,26 @@ void type_write(type_t t, type_wr_ctx_t ctx)
    fbuf_t *f = tree_write_file(ctx->tree_ctx);
 
    if (t == NULL) {
-      write_u16(0xffff, f);   // Null marker
+      write_uint(MARKER_NULL, f);
       return;
    }
 
-   if (t->generation == ctx->generation) {
+   const bool visited = (t->generation == ctx->generation)
+      || ((ctx->seg_generation != 0) && (t->generation == ctx->seg_generation));
+
+   if (visited) {
       // Already visited this type
-      write_u16(0xfffe, f);   // Back reference marker
-      write_u32(t->index, f);
+      write_uint(MARKER_BACKREF, f);
+      write_uint(t->index, f);
       return;
    }
 
-   t->generation = ctx->generation;
+   // Types first written inside a segment are forgotten at its end
+   t->generation =
+      (ctx->seg_generation != 0) ? ctx->seg_generation : ctx->generation;
    t->index      = (ctx->n_types)++;
 
-   write_u16(t->kind, f);
+   write_uint(t->kind + MARKER_KIND, f);
 
    // Call type_ident here to generate an arbitrary name if needed
    ident_write(type_ident(t), ctx->ident_ctx);
@@ -698,7 +704,7 @@ void type_write(type_t t, type_wr_ctx_t ctx)
       if (has & mask) {
          if (ITEM_TYPE_ARRAY & mask) {
             type_array_t *a = &(t->items[n].type_array);
-            write_u16(a->count, f);
+            write_uint(a->count, f);
             for (unsigned i = 0; i < a->count; i++)
                type_write(a->items[i], ctx);
          }
@@ -708,13 +714,13 @@ void type_write(type_t t, type_wr_ctx_t ctx)
             tree_write(t->items[n].tree, ctx->tree_ctx);
          else if (ITEM_TREE_ARRAY & mask) {
             tree_array_t *a = &(t->items[n].tree_array);
-            write_u16(a->count, f);
+            write_uint(a->count, f);
             for (unsigned i = 0; i < a->count; i++)
                tree_write(a->items[i], ctx->tree_ctx);
          }
          else if (ITEM_RANGE_ARRAY & mask) {
             range_array_t *a = &(t->items[n].range_array);
-            write_u16(a->count, f);
+            write_uint(a->count, f);
             for (unsigned i = 0; i < a->count; i++) {
                write_u8(a->items[i].kind, f);
                tree_write(a->items[i].left, ctx->tree_ctx);
@@ -732,19 +738,18 @@ type_t type_read(type_rd_ctx_t ctx)
 {
    fbuf_t *f = tree_read_file(ctx->tree_ctx);
 
-   unsigned short marker = read_u16(f);
-   if (marker == 0xffff)
-      return NULL;   // Null marker
-   else if (marker == 0xfffe) {
-      // Back reference marker
-      unsigned index = read_u32(f);
+   const uint64_t marker = read_uint(f);
+   if (marker == MARKER_NULL)
+      return NULL;
+   else if (marker == MARKER_BACKREF) {
+      unsigned index = read_uint(f);
       assert(index < ctx->n_types);
       return ctx->store[index];
    }
 
-   assert(marker < T_LAST_TYPE_KIND);
+   assert(marker - MARKER_KIND < T_LAST_TYPE_KIND);
 
-   type_t t = type_new((type_kind_t)marker);
+   type_t t = type_new((type_kind_t)(marker - MARKER_KIND));
    t->ident = ident_read(ctx->ident_ctx);
 
    // Stash pointer for later back references
@@ -763,7 +768,7 @@ type_t type_read(type_rd_ctx_t ctx)
       if (has & mask) {
          if (ITEM_TYPE_ARRAY & mask) {
             type_array_t *a = &(t->items[n].type_array);
-            type_array_resize(a, read_u16(f), NULL);
+            type_array_resize(a, read_uint(f), NULL);
 
             for (unsigned i = 0; i < a->count; i++)
                a->items[i] = type_read(ctx);
@@ -774,7 +779,7 @@ type_t type_read(type_rd_ctx_t ctx)
             t->items[n].tree = tree_read(ctx->tree_ctx);
          else if (ITEM_TREE_ARRAY & mask) {
             tree_array_t *a = &(t->items[n].tree_array);
-            tree_array_resize(a, read_u16(f), NULL);
+            tree_array_resize(a, read_uint(f), NULL);
 
             for (unsigned i = 0; i < a->count; i++)
                a->items[i] = tree_read(ctx->tree_ctx);
@@ -782,7 +787,7 @@ type_t type_read(type_rd_ctx_t ctx)
          else if (ITEM_RANGE_ARRAY & mask) {
             range_array_t *a = &(t->items[n].range_array);
             range_t dummy = { NULL, NULL, 0 };
-            range_array_resize(a, read_u16(f), dummy);
+            range_array_resize(a, read_uint(f), dummy);
 
             for (unsigned i = 0; i < a->count; i++) {
                a->items[i].kind  = read_u8(f);
@@ -809,6 +814,8 @@ type_wr_ctx_t type_write_begin(tree_wr_ctx_t tree_ctx, ident_wr_ctx_t ident_ctx)
    ctx->generation = next_generation++;
    ctx->n_types    = 0;
 
+   ctx->seg_generation = 0;
+
    return ctx;
 }
 
@@ -817,6 +824,12 @@ void type_write_end(type_wr_ctx_t ctx)
    free(ctx);
 }
 
+unsigned type_write_segment(type_wr_ctx_t ctx, unsigned generation)
+{
+   ctx->seg_generation = generation;
+   return ctx->n_types;
+}
+
 type_rd_ctx_t type_read_begin(tree_rd_ctx_t tree_ctx, ident_rd_ctx_t ident_ctx)
 {
    type_one_time_init();
@@ -831,6 +844,30 @@ type_rd_ctx_t type_read_begin(tree_rd_ctx_t tree_ctx, ident_rd_ctx_t ident_ctx)
    return ctx;
 }
 
+unsigned type_read_skip(type_rd_ctx_t ctx, unsigned count)
+{
+   // Reserve indexes for types in a segment that has not been read
+   const unsigned first = ctx->n_types;
+   ctx->n_types += count;
+
+   if (ctx->n_types >= ctx->store_sz) {
+      ctx->store_sz = next_power_of_2(ctx->n_types + 1);
+      ctx->store = xrealloc(ctx->store, ctx->store_sz * sizeof(type_t));
+   }
+
+   for (unsigned i = first; i < ctx->n_types; i++)
+      ctx->store[i] = NULL;
+
+   return first;
+}
+
+unsigned type_read_seek(type_rd_ctx_t ctx, unsigned index)
+{
+   const unsigned old = ctx->n_types;
+   ctx->n_types = index;
+   return old;
+}
+
 void type_read_end(type_rd_ctx_t ctx)
 {
    free(ctx->store);
@@ -0,0 +1,79 @@
+#include "ident.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmark for identifier interning. Build with
+// `make -C test perf_ident' and run with an optional iteration count.
+
+#define NNAMES 100000
+
+static double now_ms(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static void report(const char *what, double start, int n)
+{
+   const double ms = now_ms() - start;
+   printf("%-12s %8.2f ms %8.1f ns/op\n", what, ms, (ms * 1e6) / n);
+}
+
+int main(int argc, char **argv)
+{
+   const int iters = (argc > 1) ? atoi(argv[1]) : 10;
+
+   // Names shaped like elaborated hierarchical paths
+   static char names[NNAMES][64];
+   for (int i = 0; i < NNAMES; i++)
+      snprintf(names[i], sizeof(names[i]), ":top:cpu_%d:alu_%d:reg_%d",
+               i % 7, (i / 7) % 113, i);
+
+   ident_t *idents = xmalloc(NNAMES * sizeof(ident_t));
+
+   double start = now_ms();
+   for (int i = 0; i < NNAMES; i++)
+      idents[i] = ident_new(names[i]);
+   report("intern", start, NNAMES);
+
+   start = now_ms();
+   for (int n = 0; n < iters; n++) {
+      for (int i = 0; i < NNAMES; i++) {
+         if (ident_new(names[i]) != idents[i])
+            fatal("lookup returned wrong identifier");
+      }
+   }
+   report("lookup", start, NNAMES * iters);
+
+   size_t total = 0;
+   start = now_ms();
+   for (int n = 0; n < iters; n++) {
+      for (int i = 0; i < NNAMES; i++)
+         total += strlen(istr(idents[i]));
+   }
+   report("istr", start, NNAMES * iters);
+
+   ident_t sig = ident_new("data");
+   start = now_ms();
+   for (int n = 0; n < iters; n++) {
+      for (int i = 0; i < NNAMES; i++)
+         ident_prefix(idents[i], sig, ':');
+   }
+   report("prefix", start, NNAMES * iters);
+
+   start = now_ms();
+   for (int n = 0; n < iters; n++) {
+      for (int i = 0; i < NNAMES; i++)
+         ident_runtil(idents[i], ':');
+   }
+   report("runtil", start, NNAMES * iters);
+
+   free(idents);
+
+   return (total > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,112 @@
+#include "lib.h"
+#include "tree.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Compare the time taken to load libraries written with each codec.
+// Build with `make -C test perf_lib' and pass the path of one or more
+// built libraries such as ../lib/std/std ../lib/synopsys/synopsys.
+
+#define MAX_UNITS 256
+
+static ident_t units[MAX_UNITS];
+static int     n_units;
+
+static const struct {
+   const char   *name;
+   fbuf_codec_t  codec;
+} codecs[] = {
+   { "none", FBUF_CODEC_NONE },
+   { "zlib", FBUF_CODEC_ZLIB },
+   { "lz",   FBUF_CODEC_LZ   }
+};
+
+static double now_ms(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static void index_fn(ident_t name, int kind, void *context)
+{
+   if (n_units == MAX_UNITS)
+      fatal("too many units in library");
+   units[n_units++] = name;
+}
+
+static void load_all(lib_t lib)
+{
+   for (int i = 0; i < n_units; i++) {
+      if (lib_get(lib, units[i]) == NULL)
+         fatal("failed to load %s", istr(units[i]));
+   }
+}
+
+static void time_load(const char *path, const char *codec)
+{
+   // Load in a child process so nothing is cached from the copy
+   // already in memory
+   pid_t pid = fork();
+   if (pid < 0)
+      fatal_errno("fork");
+   else if (pid == 0) {
+      const double start = now_ms();
+      load_all(lib_find(path, true, false));
+      printf("  %-6s %8.2f ms\n", codec, now_ms() - start);
+      exit(EXIT_SUCCESS);
+   }
+
+   int status;
+   if ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status)
+       || (WEXITSTATUS(status) != EXIT_SUCCESS))
+      fatal("failed to load %s", path);
+}
+
+int main(int argc, char **argv)
+{
+   if (argc < 2)
+      fatal("usage: %s LIBRARY...", argv[0]);
+
+   for (int i = 1; i < argc; i++) {
+      lib_t lib = lib_find(argv[i], true, false);
+      if (lib == NULL)
+         fatal("cannot find library %s", argv[i]);
+
+      n_units = 0;
+      lib_walk_index(lib, index_fn, NULL);
+      load_all(lib);
+
+      printf("%s (%d units)\n", argv[i], n_units);
+
+      for (int j = 0; j < ARRAY_LEN(codecs); j++) {
+         char name[64];
+         snprintf(name, sizeof(name), "perf_%s_%d", codecs[j].name, i);
+
+         fbuf_set_codec(codecs[j].codec);
+
+         lib_t copy = lib_new(name);
+         if (copy == NULL)
+            fatal("cannot create library %s", name);
+
+         for (int k = 0; k < n_units; k++)
+            lib_put(copy, lib_get(lib, units[k]));
+         lib_save(copy);
+         lib_free(copy);
+
+         time_load(name, codecs[j].name);
+
+         copy = lib_find(name, true, false);
+         lib_destroy(copy);
+         lib_free(copy);
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -54,19 +54,63 @@ def run_cmd(c, invert=false)
 end
 
 def analyse(t)
-  run_cmd "#{nvc} -a #{TestDir}/regress/#{t[:name]}.vhd"
+  if t[:flags].member? 'make' then
+    # Analyse with a relative path so --make must resolve the recorded
+    # source from another directory
+    src = (TestDir + "regress/#{t[:name]}.vhd").relative_path_from(Pathname.pwd)
+    run_cmd "#{nvc} -a #{src}"
+  else
+    run_cmd "#{nvc} -a #{TestDir}/regress/#{t[:name]}.vhd"
+  end
 end
 
 def elaborate(t)
   run_cmd "#{nvc} -e #{t[:name]} --disable-opt #{native}"
 end
 
-def run(t)
+def make(t)
+  mkdir_p 'make'
+  run_cmd "sh -c 'cd make && #{nvc} --work=../work --make #{t[:name]}'"
+end
+
+def stop_time(t)
   stop = ""
   t[:flags].each do |f|
     stop = "--stop-time=#{Regexp.last_match(1)}" if f =~ /stop=(.*)/
   end
-  run_cmd "#{nvc} -r #{stop} #{t[:name]}", t[:flags].member?('fail')
+  stop
+end
+
+def run(t)
+  run_cmd "#{nvc} -r #{stop_time(t)} #{t[:name]}", t[:flags].member?('fail')
+end
+
+def run_output(c)
+  start = File.size 'out'
+  run_cmd c
+  File.read('out')[start..-1].lines.to_a
+end
+
+def output_after(lines, marker)
+  lines.drop_while { |l| !l.include? marker }.drop(1)
+end
+
+def checkpoint(t)
+  # Save a checkpoint part way through and check the run restored from
+  # it prints the same as the uninterrupted run after that point
+  ckpt = nil
+  t[:flags].each do |f|
+    ckpt = Regexp.last_match(1) if f =~ /ckpt=(.*)/
+  end
+  return if ckpt.nil?
+
+  full = run_output "#{nvc} -r #{stop_time(t)} --checkpoint-at=#{ckpt} " +
+    "--checkpoint-file=ckpt #{t[:name]}"
+  restored = run_output "#{nvc} -r #{stop_time(t)} --restore=ckpt #{t[:name]}"
+
+  expect = output_after(full, 'wrote checkpoint')
+  fail if expect.empty?
+  fail unless output_after(restored, 'restored checkpoint') == expect
 end
 
 def check(t)
@@ -131,7 +175,9 @@ read_tests.each do |t|
     begin
       analyse t
       elaborate t
+      make t if t[:flags].member? 'make'
       run t
+      checkpoint t
       if check t then
         passed += 1
       else
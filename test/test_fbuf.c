@@ -0,0 +1,176 @@
+#include "fbuf.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#define NVALS 100000
+
+static const fbuf_codec_t codecs[] = {
+   FBUF_CODEC_NONE, FBUF_CODEC_ZLIB, FBUF_CODEC_LZ
+};
+
+static void write_values(const char *file)
+{
+   fbuf_t *f = fbuf_open(file, FBUF_OUT);
+   fail_if(f == NULL);
+
+   // Mix of repetitive and random data to exercise both literals
+   // and matches
+   for (int i = 0; i < NVALS; i++) {
+      write_u32(i, f);
+      write_u16(i % 7, f);
+      write_u8((i % 13 == 0) ? random() : 'x', f);
+      write_u64(0x0123456789abcdefull ^ i, f);
+   }
+
+   char raw[1000];
+   for (size_t i = 0; i < sizeof(raw); i++)
+      raw[i] = random();
+   write_raw(raw, sizeof(raw), f);
+
+   fbuf_close(f);
+
+   f = fbuf_open(file, FBUF_IN);
+   fail_if(f == NULL);
+
+   for (int i = 0; i < NVALS; i++) {
+      fail_unless(read_u32(f) == i);
+      fail_unless(read_u16(f) == i % 7);
+      const uint8_t b = read_u8(f);
+      fail_unless((i % 13 == 0) || (b == 'x'));
+      fail_unless(read_u64(f) == (0x0123456789abcdefull ^ i));
+   }
+
+   char check[sizeof(raw)];
+   read_raw(check, sizeof(check), f);
+   fail_unless(memcmp(check, raw, sizeof(raw)) == 0);
+
+   fbuf_close(f);
+
+   remove(file);
+}
+
+START_TEST(test_codecs)
+{
+   for (int i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+      fbuf_set_codec(codecs[i]);
+      write_values("test.fbuf");
+   }
+
+   fbuf_set_codec(FBUF_CODEC_ZLIB);
+}
+END_TEST
+
+START_TEST(test_random)
+{
+   // Incompressible data must be stored as it is
+   fbuf_set_codec(FBUF_CODEC_LZ);
+
+   fbuf_t *f = fbuf_open("test.fbuf", FBUF_OUT);
+   fail_if(f == NULL);
+
+   srandom(42);
+   for (int i = 0; i < NVALS; i++)
+      write_u32(random(), f);
+
+   fbuf_close(f);
+
+   f = fbuf_open("test.fbuf", FBUF_IN);
+   fail_if(f == NULL);
+
+   srandom(42);
+   for (int i = 0; i < NVALS; i++)
+      fail_unless(read_u32(f) == (uint32_t)random());
+
+   fbuf_close(f);
+
+   remove("test.fbuf");
+   fbuf_set_codec(FBUF_CODEC_ZLIB);
+}
+END_TEST
+
+START_TEST(test_legacy)
+{
+   // Files without a codec byte are a plain zlib stream
+   const char data[] = "hello, world";
+   uint8_t comp[128];
+   uLongf clen = sizeof(comp);
+   fail_unless(compress(comp, &clen, (const uint8_t *)data,
+                        sizeof(data)) == Z_OK);
+
+   FILE *h = fopen("test.fbuf", "w");
+   fail_if(h == NULL);
+   fwrite(comp, clen, 1, h);
+   fclose(h);
+
+   fbuf_t *f = fbuf_open("test.fbuf", FBUF_IN);
+   fail_if(f == NULL);
+
+   char check[sizeof(data)];
+   read_raw(check, sizeof(check), f);
+   fail_unless(strcmp(check, data) == 0);
+
+   fbuf_close(f);
+
+   remove("test.fbuf");
+}
+END_TEST
+
+START_TEST(test_buffer)
+{
+   // Raw data larger than the internal buffers
+   const size_t len = 200000;
+   uint8_t *data = malloc(len);
+   for (size_t i = 0; i < len; i++)
+      data[i] = random();
+
+   fbuf_t *f = fbuf_open_buffer();
+   write_uint(12345, f);
+   write_raw(data, len, f);
+   write_u8(42, f);
+
+   size_t blen;
+   void *buf = fbuf_close_buffer(f, &blen);
+
+   f = fbuf_open_mem(buf, blen, "buffer");
+   fail_unless(read_uint(f) == 12345);
+
+   uint8_t *check = malloc(len);
+   read_raw(check, len, f);
+   fail_unless(memcmp(check, data, len) == 0);
+   fail_unless(read_u8(f) == 42);
+
+   fbuf_close(f);
+
+   free(buf);
+   free(check);
+   free(data);
+}
+END_TEST
+
+int main(void)
+{
+   srandom((unsigned)time(NULL));
+
+   Suite *s = suite_create("fbuf");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_test(tc_core, test_codecs);
+   tcase_add_test(tc_core, test_random);
+   tcase_add_test(tc_core, test_legacy);
+   tcase_add_test(tc_core, test_buffer);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
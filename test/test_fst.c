@@ -0,0 +1,259 @@
+#include "rt/fst_write.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define FST_FILE "test.fst"
+
+typedef struct {
+   const uint8_t *data;
+   size_t         pos;
+} cursor_t;
+
+static uint8_t *file_data;
+static size_t   file_len;
+
+static void write_trace(void)
+{
+   // A one bit and an eight bit signal in a single scope which change
+   // at time zero and again at 300
+   fst_writer_t w = fst_open(FST_FILE, -15, 1);
+   fail_if(w == NULL);
+
+   fst_scope(w, "top");
+   fst_handle_t clk = fst_var(w, FST_VT_WIRE, 1, "clk");
+   fst_handle_t bus = fst_var(w, FST_VT_WIRE, 8, "bus");
+   fst_upscope(w);
+
+   fst_time(w, 0);
+   fst_value(w, clk, "1");
+   fst_value(w, bus, "10100101");
+
+   fst_time(w, 300);
+   fst_value(w, clk, "0");
+   fst_value(w, bus, "0000zzzz");
+
+   fst_close(w);
+
+   FILE *f = fopen(FST_FILE, "rb");
+   fail_if(f == NULL);
+
+   fseek(f, 0, SEEK_END);
+   file_len = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   file_data = malloc(file_len);
+   fail_unless(fread(file_data, file_len, 1, f) == 1);
+
+   fclose(f);
+   remove(FST_FILE);
+}
+
+static uint64_t get_u64(cursor_t *c)
+{
+   uint64_t value = 0;
+   for (int i = 0; i < 8; i++)
+      value = (value << 8) | c->data[c->pos++];
+   return value;
+}
+
+static uint64_t get_varint(cursor_t *c)
+{
+   uint64_t value = 0;
+   int shift = 0;
+   uint8_t byte;
+   do {
+      byte = c->data[c->pos++];
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      shift += 7;
+   } while (byte & 0x80);
+   return value;
+}
+
+static size_t find_block(int type)
+{
+   // Offset of the first block of the given type or zero
+   for (size_t pos = 0; pos < file_len; ) {
+      if (file_data[pos] == type)
+         return pos;
+
+      cursor_t c = { file_data, pos + 1 };
+      pos += 1 + get_u64(&c);
+   }
+
+   return 0;
+}
+
+START_TEST(test_blocks)
+{
+   write_trace();
+
+   // Every section length must lead exactly to the next block
+   const uint8_t expect[] = { 0, 8, 3, 4 };
+   size_t pos = 0;
+   for (int i = 0; i < sizeof(expect); i++) {
+      fail_unless(pos < file_len);
+      fail_unless(file_data[pos] == expect[i]);
+
+      cursor_t c = { file_data, pos + 1 };
+      pos += 1 + get_u64(&c);
+   }
+   fail_unless(pos == file_len);
+
+   free(file_data);
+}
+END_TEST
+
+START_TEST(test_header)
+{
+   write_trace();
+
+   cursor_t c = { file_data, 1 };
+   fail_unless(get_u64(&c) == 329);
+   fail_unless(get_u64(&c) == 0);     // Start time
+   fail_unless(get_u64(&c) == 300);   // End time
+
+   double endian;
+   memcpy(&endian, file_data + c.pos, sizeof(double));
+   fail_unless(endian == 2.7182818284590452354);
+   c.pos += sizeof(double);
+
+   get_u64(&c);   // Memory used by writer
+   fail_unless(get_u64(&c) == 1);     // Scopes
+   fail_unless(get_u64(&c) == 2);     // Variables
+   fail_unless(get_u64(&c) == 2);     // Maximum handle
+   fail_unless(get_u64(&c) == 1);     // Value change blocks
+   fail_unless((int8_t)file_data[c.pos] == -15);
+
+   free(file_data);
+}
+END_TEST
+
+START_TEST(test_vcdata)
+{
+   write_trace();
+
+   const size_t start = find_block(8);
+   fail_unless(start > 0);
+
+   cursor_t c = { file_data, start + 1 };
+   const uint64_t seclen = get_u64(&c);
+   fail_unless(get_u64(&c) == 0);     // Start time
+   fail_unless(get_u64(&c) == 300);   // End time
+   fail_unless(get_u64(&c) == 13);    // Total chain length
+
+   // Frame of initial values is too short to compress
+   fail_unless(get_varint(&c) == 9);
+   fail_unless(get_varint(&c) == 9);
+   fail_unless(get_varint(&c) == 2);
+   fail_unless(memcmp(file_data + c.pos, "xxxxxxxxx", 9) == 0);
+   c.pos += 9;
+
+   fail_unless(get_varint(&c) == 2);
+   fail_unless(file_data[c.pos++] == 'Z');
+
+   // One bit values hold the value and time delta in a single varint
+   fail_unless(get_varint(&c) == 0);   // Not compressed
+   fail_unless(get_varint(&c) == 2);
+   fail_unless(get_varint(&c) == 4);
+
+   // Binary vectors are packed eight bits per byte and other values
+   // stored as characters
+   fail_unless(get_varint(&c) == 0);
+   fail_unless(get_varint(&c) == 0);
+   fail_unless(file_data[c.pos++] == 0xa5);
+   fail_unless(get_varint(&c) == 3);
+   fail_unless(memcmp(file_data + c.pos, "0000zzzz", 8) == 0);
+   c.pos += 8;
+
+   // Chain offsets relative to the 'Z' marker
+   fail_unless(get_varint(&c) == 3);
+   fail_unless(get_varint(&c) == 7);
+   fail_unless(get_u64(&c) == 2);
+
+   // Time table of the first time and then deltas
+   fail_unless(get_varint(&c) == 0);
+   fail_unless(get_varint(&c) == 300);
+   fail_unless(get_u64(&c) == 3);
+   fail_unless(get_u64(&c) == 3);
+   fail_unless(get_u64(&c) == 2);
+
+   fail_unless(c.pos == start + 1 + seclen);
+
+   free(file_data);
+}
+END_TEST
+
+START_TEST(test_geometry)
+{
+   write_trace();
+
+   const size_t geom = find_block(3);
+   fail_unless(geom > 0);
+
+   cursor_t c = { file_data, geom + 1 };
+   fail_unless(get_u64(&c) == 26);
+   fail_unless(get_u64(&c) == 2);   // Uncompressed length
+   fail_unless(get_u64(&c) == 2);   // Signals
+   fail_unless(get_varint(&c) == 1);
+   fail_unless(get_varint(&c) == 8);
+
+   const size_t hier = find_block(4);
+   fail_unless(hier > 0);
+
+   c.pos = hier + 1;
+   const uint64_t seclen = get_u64(&c);
+   const uint64_t len = get_u64(&c);
+
+   uint8_t *buf = malloc(len);
+   z_stream z;
+   memset(&z, '\0', sizeof(z_stream));
+   fail_unless(inflateInit2(&z, 15 + 16) == Z_OK);
+
+   z.next_in   = file_data + c.pos;
+   z.avail_in  = seclen - 16;
+   z.next_out  = buf;
+   z.avail_out = len;
+
+   fail_unless(inflate(&z, Z_FINISH) == Z_STREAM_END);
+   fail_unless(z.avail_out == 0);
+   inflateEnd(&z);
+
+   const uint8_t expect[] = {
+      254, 0, 't', 'o', 'p', 0, 0,
+      16, 0, 'c', 'l', 'k', 0, 1, 0,
+      16, 0, 'b', 'u', 's', 0, 8, 0,
+      255
+   };
+   fail_unless(len == sizeof(expect));
+   fail_unless(memcmp(buf, expect, len) == 0);
+
+   free(buf);
+   free(file_data);
+}
+END_TEST
+
+int main(void)
+{
+   Suite *s = suite_create("fst");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_test(tc_core, test_blocks);
+   tcase_add_test(tc_core, test_header);
+   tcase_add_test(tc_core, test_vcdata);
+   tcase_add_test(tc_core, test_geometry);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
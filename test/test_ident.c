@@ -211,6 +211,39 @@ START_TEST(test_glob)
 }
 END_TEST;
 
+START_TEST(test_long)
+{
+   // Longer than an arena chunk
+   const size_t len = 100000;
+   char *buf = malloc(len + 1);
+   for (size_t i = 0; i < len; i++)
+      buf[i] = 'a' + (i % 26);
+   buf[len] = '\0';
+
+   ident_t i = ident_new(buf);
+   fail_unless(strcmp(istr(i), buf) == 0);
+   fail_unless(ident_new(buf) == i);
+   fail_unless(ident_char(i, 0) == buf[len - 1]);
+
+   free(buf);
+}
+END_TEST;
+
+START_TEST(test_uniq)
+{
+   ident_t a = ident_new("uniq");
+   ident_t b = ident_uniq("uniq");
+   ident_t c = ident_uniq("uniq");
+
+   fail_if(a == b);
+   fail_if(b == c);
+   fail_if(a == c);
+
+   ident_t d = ident_uniq("never_seen");
+   fail_unless(icmp(d, "never_seen"));
+}
+END_TEST;
+
 int main(void)
 {
    srandom((unsigned)time(NULL));
@@ -230,6 +263,8 @@ int main(void)
    tcase_add_test(tc_core, test_runtil);
    tcase_add_test(tc_core, test_icmp);
    tcase_add_test(tc_core, test_glob);
+   tcase_add_test(tc_core, test_long);
+   tcase_add_test(tc_core, test_uniq);
    suite_add_tcase(s, tc_core);
 
    SRunner *sr = srunner_create(s);
@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 static lib_t work;
 
@@ -168,6 +171,19 @@ START_TEST(test_lib_save)
       tree_set_message(s4, str_to_agg("message", NULL));
       tree_add_stmt(pr, s4);
 
+      tree_t sig = tree_new(T_SIGNAL_DECL);
+      tree_set_ident(sig, ident_new("sig"));
+      tree_set_type(sig, e);
+      const netid_t nets[] = { 5, 6, 7, 8, 100, 3, 4, 0, 0xfffffff0 };
+      for (int i = 0; i < ARRAY_LEN(nets); i++)
+         tree_add_net(sig, nets[i]);
+      tree_add_decl(ar, sig);
+
+      tree_t neg = tree_new(T_LITERAL);
+      tree_set_subkind(neg, L_INT);
+      tree_set_ival(neg, -123456789012ll);
+      tree_set_value(sig, neg);
+
       lib_put(work, ar);
       lib_put(work, ent);
    }
@@ -218,6 +234,14 @@ START_TEST(test_lib_save)
       fail_unless(tree_ident(ar) == ident_new("arch"));
       fail_unless(tree_ident2(ar) == ident_new("foo"));
 
+      tree_t sig = tree_decl(ar, 0);
+      fail_unless(tree_kind(sig) == T_SIGNAL_DECL);
+      const netid_t nets[] = { 5, 6, 7, 8, 100, 3, 4, 0, 0xfffffff0 };
+      fail_unless(tree_nets(sig) == ARRAY_LEN(nets));
+      for (int i = 0; i < ARRAY_LEN(nets); i++)
+         fail_unless(tree_net(sig, i) == nets[i]);
+      fail_unless(tree_ival(tree_value(sig)) == -123456789012ll);
+
       tree_t pr = tree_stmt(ar, 0);
       fail_unless(tree_kind(pr) == T_PROCESS);
       fail_unless(tree_ident(pr) == ident_new("proc"));
@@ -255,6 +279,285 @@ START_TEST(test_lib_save)
 }
 END_TEST
 
+START_TEST(test_lib_lazy)
+{
+   uint32_t ret_index;
+   {
+      type_t e = type_new(T_ENUM);
+      type_set_ident(e, ident_new("myenum"));
+
+      type_t e2 = type_new(T_ENUM);
+      type_set_ident(e2, ident_new("local"));
+
+      tree_t pb = tree_new(T_PACK_BODY);
+      tree_set_ident(pb, ident_new("pack-body"));
+
+      tree_t f = tree_new(T_FUNC_BODY);
+      tree_set_ident(f, ident_new("f"));
+      tree_add_decl(pb, f);
+
+      tree_t p = tree_new(T_PORT_DECL);
+      tree_set_ident(p, ident_new("p"));
+      tree_set_subkind(p, PORT_IN);
+      tree_set_type(p, e);
+      tree_add_port(f, p);
+
+      tree_t v = tree_new(T_VAR_DECL);
+      tree_set_ident(v, ident_new("v"));
+      tree_set_type(v, e);
+      tree_add_decl(f, v);
+
+      tree_t w = tree_new(T_VAR_DECL);
+      tree_set_ident(w, ident_new("w"));
+      tree_set_type(w, e2);
+      tree_add_decl(f, w);
+
+      tree_t nested = tree_new(T_FUNC_BODY);
+      tree_set_ident(nested, ident_new("nested"));
+      tree_add_decl(f, nested);
+
+      tree_t r = tree_new(T_REF);
+      tree_set_ident(r, ident_new("v"));
+      tree_set_ref(r, v);
+
+      tree_t ret = tree_new(T_RETURN);
+      tree_set_value(ret, r);
+      tree_add_stmt(f, ret);
+
+      tree_t rp = tree_new(T_REF);
+      tree_set_ident(rp, ident_new("p"));
+      tree_set_ref(rp, p);
+
+      tree_t ret2 = tree_new(T_RETURN);
+      tree_set_value(ret2, rp);
+      tree_add_stmt(nested, ret2);
+
+      // Uses a type first written inside the body of f
+      tree_t g = tree_new(T_FUNC_BODY);
+      tree_set_ident(g, ident_new("g"));
+      tree_add_decl(pb, g);
+
+      tree_t q = tree_new(T_PORT_DECL);
+      tree_set_ident(q, ident_new("q"));
+      tree_set_subkind(q, PORT_IN);
+      tree_set_type(q, e2);
+      tree_add_port(g, q);
+
+      lib_put(work, pb);
+      lib_save(work);
+
+      ret_index = tree_index(ret);
+   }
+
+   lib_free(work);
+
+   work = lib_find("work", false, false);
+   fail_if(work == NULL);
+
+   tree_rd_ctx_t ctx;
+   tree_t pb = lib_get_ctx(work, ident_new("pack-body"), &ctx);
+   fail_if(pb == NULL);
+   fail_unless(tree_decls(pb) == 2);
+
+   // Unread bodies must survive garbage collection
+   tree_gc();
+
+   // Recalling a tree inside the body loads it
+   tree_t ret = tree_read_recall(ctx, ret_index);
+   fail_if(ret == NULL);
+   fail_unless(tree_kind(ret) == T_RETURN);
+
+   tree_t f = tree_decl(pb, 0);
+   fail_unless(tree_kind(f) == T_FUNC_BODY);
+   fail_unless(tree_decls(f) == 3);
+   fail_unless(tree_stmts(f) == 1);
+   fail_unless(tree_stmt(f, 0) == ret);
+
+   tree_t v = tree_decl(f, 0);
+   fail_unless(tree_ref(tree_value(ret)) == v);
+   fail_unless(tree_type(v) == tree_type(tree_port(f, 0)));
+
+   tree_t nested = tree_decl(f, 2);
+   fail_unless(tree_stmts(nested) == 1);
+   fail_unless(tree_ref(tree_value(tree_stmt(nested, 0))) == tree_port(f, 0));
+
+   tree_t g = tree_decl(pb, 1);
+   fail_unless(tree_ident(g) == ident_new("g"));
+   fail_unless(tree_decls(g) == 0);
+   fail_unless(type_ident(tree_type(tree_port(g, 0))) == ident_new("local"));
+}
+END_TEST
+
+START_TEST(test_lib_pack)
+{
+   tree_t e1 = tree_new(T_ENTITY);
+   tree_set_ident(e1, ident_new("one"));
+   lib_put(work, e1);
+
+   tree_t e2 = tree_new(T_ENTITY);
+   tree_set_ident(e2, ident_new("two"));
+   lib_put(work, e2);
+
+   lib_save(work);
+   lib_pack(work);
+
+   FILE *f = lib_fopen(work, "one", "r");
+   fail_unless(f == NULL);
+
+   lib_free(work);
+
+   work = lib_find("work", false, false);
+   fail_if(work == NULL);
+
+   tree_t one = lib_get(work, ident_new("one"));
+   fail_if(one == NULL);
+   fail_unless(tree_kind(one) == T_ENTITY);
+   fail_unless(tree_ident(one) == ident_new("one"));
+
+   fail_if(lib_get(work, ident_new("two")) == NULL);
+   fail_unless(lib_get(work, ident_new("three")) == NULL);
+
+   // Saving a packed library updates the archive
+   tree_t e3 = tree_new(T_ENTITY);
+   tree_set_ident(e3, ident_new("three"));
+   lib_put(work, e3);
+   lib_save(work);
+
+   f = lib_fopen(work, "three", "r");
+   fail_unless(f == NULL);
+
+   lib_free(work);
+
+   work = lib_find("work", false, false);
+   fail_if(work == NULL);
+   fail_if(lib_get(work, ident_new("one")) == NULL);
+   fail_if(lib_get(work, ident_new("three")) == NULL);
+}
+END_TEST
+
+static void count_deps(ident_t dep, void *context)
+{
+   int *count = context;
+   fail_unless((dep == ident_new("WORK.PACK"))
+               || (dep == ident_new("IEEE.X")));
+   (*count)++;
+}
+
+START_TEST(test_lib_index)
+{
+   ident_t name = ident_new("WORK.ENT-ARCH");
+   ident_t file = ident_new("foo.vhd");
+
+   tree_t a = tree_new(T_ARCH);
+   tree_set_ident(a, name);
+   lib_put(work, a);
+
+   fail_if(lib_index_mtime(work, name) == 0);
+   fail_unless(lib_source(work, name, NULL) == NULL);
+
+   lib_set_source(work, name, file, 0x1234567890abcdefull);
+   lib_add_dep(work, name, ident_new("WORK.PACK"));
+   lib_add_dep(work, name, ident_new("IEEE.X"));
+   lib_add_dep(work, name, ident_new("WORK.PACK"));
+
+   lib_save(work);
+   lib_free(work);
+
+   work = lib_find("work", false, false);
+   fail_if(work == NULL);
+
+   uint64_t hash;
+   fail_unless(lib_source(work, name, &hash) == file);
+   fail_unless(hash == 0x1234567890abcdefull);
+   fail_if(lib_index_mtime(work, name) == 0);
+
+   int count = 0;
+   lib_walk_deps(work, name, count_deps, &count);
+   fail_unless(count == 2);
+
+   // Analysing the unit again forgets the old dependencies
+   tree_t b = tree_new(T_ARCH);
+   tree_set_ident(b, name);
+   lib_put(work, b);
+
+   count = 0;
+   lib_walk_deps(work, name, count_deps, &count);
+   fail_unless(count == 0);
+   fail_unless(lib_source(work, name, NULL) == NULL);
+}
+END_TEST
+
+static pid_t reanalyse_unit(const char *name, const char *file, int wait_fd)
+{
+   pid_t pid = fork();
+   if (pid == 0) {
+      char c;
+      if ((wait_fd != -1) && (read(wait_fd, &c, 1) != 1))
+         _exit(EXIT_FAILURE);
+
+      ident_t name_i = ident_new(name);
+      tree_t e = tree_new(T_ENTITY);
+      tree_set_ident(e, name_i);
+      lib_put(work, e);
+      lib_set_source(work, name_i, ident_new(file), 2);
+      lib_save(work);
+      _exit(EXIT_SUCCESS);
+   }
+
+   return pid;
+}
+
+START_TEST(test_lib_parallel)
+{
+   // Two processes reanalysing different existing units as with -j2
+   // must not undo each other's index updates
+
+   ident_t a = ident_new("WORK.PA");
+   ident_t b = ident_new("WORK.PB");
+
+   tree_t ea = tree_new(T_ENTITY);
+   tree_set_ident(ea, a);
+   lib_put(work, ea);
+   lib_set_source(work, a, ident_new("a.vhd"), 1);
+
+   tree_t eb = tree_new(T_ENTITY);
+   tree_set_ident(eb, b);
+   lib_put(work, eb);
+   lib_set_source(work, b, ident_new("b.vhd"), 1);
+
+   lib_save(work);
+
+   int fds[2];
+   fail_if(pipe(fds) < 0);
+
+   // The second process saves last with the index it started with
+   pid_t pid_b = reanalyse_unit("WORK.PB", "b2.vhd", fds[0]);
+   pid_t pid_a = reanalyse_unit("WORK.PA", "a2.vhd", -1);
+   fail_if((pid_a < 0) || (pid_b < 0));
+
+   int status;
+   fail_unless(waitpid(pid_a, &status, 0) == pid_a);
+   fail_unless(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+   fail_unless(write(fds[1], "x", 1) == 1);
+   fail_unless(waitpid(pid_b, &status, 0) == pid_b);
+   fail_unless(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+   close(fds[0]);
+   close(fds[1]);
+
+   lib_free(work);
+   work = lib_find("work", false, false);
+   fail_if(work == NULL);
+
+   uint64_t hash;
+   fail_unless(lib_source(work, a, &hash) == ident_new("a2.vhd"));
+   fail_unless(hash == 2);
+   fail_unless(lib_source(work, b, &hash) == ident_new("b2.vhd"));
+   fail_unless(hash == 2);
+}
+END_TEST
+
 int main(void)
 {
    register_trace_signal_handlers();
@@ -266,6 +569,10 @@ int main(void)
    tcase_add_test(tc_core, test_lib_new);
    tcase_add_test(tc_core, test_lib_fopen);
    tcase_add_test(tc_core, test_lib_save);
+   tcase_add_test(tc_core, test_lib_lazy);
+   tcase_add_test(tc_core, test_lib_pack);
+   tcase_add_test(tc_core, test_lib_index);
+   tcase_add_test(tc_core, test_lib_parallel);
    suite_add_tcase(s, tc_core);
 
    SRunner *sr = srunner_create(s);
@@ -0,0 +1,98 @@
+#include "rt/pack.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define N 1000
+
+static void check_round_trip(unsigned bits)
+{
+   static uint8_t src[N], dst[N], packed[N];
+
+   for (int i = 0; i < N; i++)
+      src[i] = random() & ((1 << bits) - 1);
+
+   for (int count = 0; count < 100; count++) {
+      memset(packed, 0xff, sizeof(packed));
+      pack_values(packed, src, count, bits);
+
+      // Unused bits in the last byte must be clear
+      const size_t nbytes = pack_size(count, bits);
+      if ((count * bits) % 8 != 0)
+         fail_unless((packed[nbytes - 1] >> ((count * bits) % 8)) == 0);
+
+      for (int skip = 0; skip < count; skip++) {
+         memset(dst, 0xff, sizeof(dst));
+         unpack_values(dst, packed, skip, count - skip, bits);
+         fail_unless(memcmp(dst, src + skip, count - skip) == 0);
+      }
+   }
+}
+
+START_TEST(test_size)
+{
+   fail_unless(pack_size(0, 1) == 0);
+   fail_unless(pack_size(1, 1) == 1);
+   fail_unless(pack_size(8, 1) == 1);
+   fail_unless(pack_size(9, 1) == 2);
+   fail_unless(pack_size(3, 4) == 2);
+   fail_unless(pack_size(64, 4) == 32);
+   fail_unless(pack_size(5, 2) == 2);
+}
+END_TEST
+
+START_TEST(test_bits)
+{
+   const uint8_t src[] = { 1, 0, 1, 1, 0, 0, 0, 1, 1, 1 };
+   uint8_t packed[2];
+   pack_values(packed, src, sizeof(src), 1);
+
+   fail_unless(packed[0] == 0x8d);
+   fail_unless(packed[1] == 0x03);
+}
+END_TEST
+
+START_TEST(test_nibbles)
+{
+   const uint8_t src[] = { 2, 3, 8 };
+   uint8_t packed[2];
+   pack_values(packed, src, sizeof(src), 4);
+
+   fail_unless(packed[0] == 0x32);
+   fail_unless(packed[1] == 0x08);
+}
+END_TEST
+
+START_TEST(test_round_trip)
+{
+   check_round_trip(1);
+   check_round_trip(2);
+   check_round_trip(4);
+}
+END_TEST
+
+int main(void)
+{
+   srandom((unsigned)time(NULL));
+
+   Suite *s = suite_create("pack");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_test(tc_core, test_size);
+   tcase_add_test(tc_core, test_bits);
+   tcase_add_test(tc_core, test_nibbles);
+   tcase_add_test(tc_core, test_round_trip);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
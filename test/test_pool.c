@@ -0,0 +1,90 @@
+#include "rt/pool.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define N_ITEMS 10000
+
+static void square_fn(void *item, int thread, void *context)
+{
+   int *p = item;
+   *p = *p * *p;
+
+   int *seen = context;
+   __sync_fetch_and_add(&(seen[thread]), 1);
+}
+
+START_TEST(test_serial)
+{
+   pool_t p = pool_new(1);
+   fail_unless(pool_threads(p) == 1);
+
+   int vals[16], seen[1] = { 0 };
+   void *items[16];
+   for (int i = 0; i < 16; i++) {
+      vals[i] = i;
+      items[i] = &(vals[i]);
+   }
+
+   pool_run(p, items, 16, square_fn, seen);
+
+   for (int i = 0; i < 16; i++)
+      fail_unless(vals[i] == i * i);
+   fail_unless(seen[0] == 16);
+
+   pool_free(p);
+}
+END_TEST
+
+START_TEST(test_parallel)
+{
+   const int nthreads = 4;
+   pool_t p = pool_new(nthreads);
+
+   static int vals[N_ITEMS];
+   static void *items[N_ITEMS];
+   int seen[nthreads];
+
+   for (int round = 0; round < 50; round++) {
+      for (int i = 0; i < N_ITEMS; i++) {
+         vals[i] = i % 1000;
+         items[i] = &(vals[i]);
+      }
+      memset(seen, '\0', sizeof(seen));
+
+      pool_run(p, items, N_ITEMS, square_fn, seen);
+
+      int total = 0;
+      for (int i = 0; i < nthreads; i++)
+         total += seen[i];
+      fail_unless(total == N_ITEMS);
+
+      for (int i = 0; i < N_ITEMS; i++)
+         fail_unless(vals[i] == (i % 1000) * (i % 1000));
+   }
+
+   pool_free(p);
+}
+END_TEST
+
+int main(void)
+{
+   Suite *s = suite_create("pool");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_test(tc_core, test_serial);
+   tcase_add_test(tc_core, test_parallel);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,102 @@
+#include "rt/ring.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+struct consumer {
+   uint32_t next;
+   uint32_t errors;
+   size_t   bytes;
+};
+
+static void consume_fn(const void *rec, size_t len, void *context)
+{
+   struct consumer *c = context;
+   const uint32_t *words = rec;
+
+   // Each record is a sequence number followed by len / 4 - 1 copies
+   // of the same number
+   if (words[0] != c->next)
+      c->errors++;
+
+   for (size_t i = 1; i < len / sizeof(uint32_t); i++) {
+      if (words[i] != words[0])
+         c->errors++;
+   }
+
+   c->next++;
+   c->bytes += len;
+}
+
+static void produce(ring_t r, uint32_t seq, size_t nwords)
+{
+   uint32_t *words = ring_reserve(r, 64 * sizeof(uint32_t));
+   for (size_t i = 0; i < nwords; i++)
+      words[i] = seq;
+   ring_commit(r, nwords * sizeof(uint32_t));
+}
+
+START_TEST(test_order)
+{
+   struct consumer c = { 0, 0, 0 };
+   ring_t r = ring_new(1024, consume_fn, &c);
+
+   size_t bytes = 0;
+   for (uint32_t i = 0; i < 100000; i++) {
+      const size_t nwords = 1 + (random() % 64);
+      produce(r, i, nwords);
+      bytes += nwords * sizeof(uint32_t);
+   }
+
+   ring_free(r);
+
+   fail_unless(c.next == 100000);
+   fail_unless(c.errors == 0);
+   fail_unless(c.bytes == bytes);
+}
+END_TEST
+
+START_TEST(test_flush)
+{
+   struct consumer c = { 0, 0, 0 };
+   ring_t r = ring_new(4096, consume_fn, &c);
+
+   for (uint32_t i = 0; i < 10; i++)
+      produce(r, i, 3);
+
+   ring_flush(r);
+   fail_unless(c.next == 10);
+
+   produce(r, 10, 1);
+   ring_flush(r);
+   fail_unless(c.next == 11);
+   fail_unless(c.errors == 0);
+
+   ring_free(r);
+}
+END_TEST
+
+int main(void)
+{
+   srandom((unsigned)time(NULL));
+
+   Suite *s = suite_create("ring");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_test(tc_core, test_order);
+   tcase_add_test(tc_core, test_flush);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
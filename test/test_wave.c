@@ -0,0 +1,131 @@
+#include "rt/rt.h"
+#include "tree.h"
+#include "util.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static tree_t make_signal(const char *path)
+{
+   tree_t s = tree_new(T_SIGNAL_DECL);
+   tree_set_ident(s, ident_new(path));
+   return s;
+}
+
+static void setup(void)
+{
+   opt_set_int("wave-depth", 0);
+}
+
+static void teardown(void)
+{
+   wave_clear_globs();
+}
+
+START_TEST(test_all)
+{
+   // Everything is dumped without any selection options
+   fail_unless(wave_should_dump(make_signal(":top:clk")));
+   fail_unless(wave_should_dump(make_signal(":top:uut:sub:data")));
+}
+END_TEST
+
+START_TEST(test_anchor)
+{
+   // Globs not starting with a separator or a wildcard are matched from
+   // the top of the hierarchy and dotted paths are accepted
+   wave_include_glob("top.uut.*");
+
+   fail_unless(wave_should_dump(make_signal(":top:uut:data")));
+   fail_if(wave_should_dump(make_signal(":top:clk")));
+   fail_if(wave_should_dump(make_signal(":other:top:uut:data")));
+
+   wave_clear_globs();
+   wave_include_glob("uut.*");
+
+   fail_if(wave_should_dump(make_signal(":top:uut:data")));
+
+   wave_clear_globs();
+   wave_include_glob("*:uut:*");
+   wave_include_glob(":top:clk");
+
+   fail_unless(wave_should_dump(make_signal(":top:uut:data")));
+   fail_unless(wave_should_dump(make_signal(":other:uut:data")));
+   fail_unless(wave_should_dump(make_signal(":top:clk")));
+   fail_if(wave_should_dump(make_signal(":top:clk2")));
+   fail_if(wave_should_dump(make_signal(":top:reset")));
+}
+END_TEST
+
+START_TEST(test_case)
+{
+   wave_include_glob("TOP.UUT.Data");
+
+   fail_unless(wave_should_dump(make_signal(":top:uut:data")));
+}
+END_TEST
+
+START_TEST(test_exclude)
+{
+   // Exclusions take precedence over inclusions
+   wave_include_glob("top.uut.*");
+   wave_exclude_glob("*:sub:*");
+   wave_exclude_glob("top.uut.tmp");
+
+   fail_unless(wave_should_dump(make_signal(":top:uut:data")));
+   fail_if(wave_should_dump(make_signal(":top:uut:sub:data")));
+   fail_if(wave_should_dump(make_signal(":top:uut:tmp")));
+   fail_if(wave_should_dump(make_signal(":top:clk")));
+
+   wave_clear_globs();
+   wave_exclude_glob("*tmp");
+
+   fail_unless(wave_should_dump(make_signal(":top:clk")));
+   fail_if(wave_should_dump(make_signal(":top:uut:tmp")));
+}
+END_TEST
+
+START_TEST(test_depth)
+{
+   // Signals in the top level are at depth one
+   opt_set_int("wave-depth", 1);
+
+   fail_unless(wave_should_dump(make_signal(":top:clk")));
+   fail_if(wave_should_dump(make_signal(":top:uut:data")));
+
+   opt_set_int("wave-depth", 2);
+
+   fail_unless(wave_should_dump(make_signal(":top:clk")));
+   fail_unless(wave_should_dump(make_signal(":top:uut:data")));
+   fail_if(wave_should_dump(make_signal(":top:uut:sub:data")));
+
+   // The depth limit applies even to explicitly included signals
+   wave_include_glob("top.uut.sub.*");
+
+   fail_if(wave_should_dump(make_signal(":top:uut:sub:data")));
+}
+END_TEST
+
+int main(void)
+{
+   Suite *s = suite_create("wave");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_checked_fixture(tc_core, setup, teardown);
+   tcase_add_test(tc_core, test_all);
+   tcase_add_test(tc_core, test_anchor);
+   tcase_add_test(tc_core, test_case);
+   tcase_add_test(tc_core, test_exclude);
+   tcase_add_test(tc_core, test_depth);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
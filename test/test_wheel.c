@@ -0,0 +1,162 @@
+#include "rt/wheel.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static wheel_t w = NULL;
+
+static void setup(void)
+{
+   w = wheel_new();
+}
+
+static void teardown(void)
+{
+   wheel_free(w);
+   w = NULL;
+}
+
+static int magnitude_compar(const void *a, const void *b)
+{
+   const uintptr_t x = *(const uintptr_t*)a;
+   const uintptr_t y = *(const uintptr_t*)b;
+   return (x > y) - (x < y);
+}
+
+static void walk_fn(uint64_t key, void *user, void *context)
+{
+   uint64_t *sum = context;
+
+   fail_if(key != (uintptr_t)user);
+
+   *sum += key;
+}
+
+START_TEST(test_basic)
+{
+   wheel_insert(w, 5, (void*)5);
+   wheel_insert(w, 2, (void*)2);
+   wheel_insert(w, 62, (void*)62);
+
+   fail_unless(wheel_size(w) == 3);
+
+   fail_unless(wheel_min(w) == (void*)2);
+   fail_unless(wheel_min_key(w) == 2);
+
+   fail_unless(wheel_extract_min(w) == (void*)2);
+   fail_unless(wheel_extract_min(w) == (void*)5);
+   fail_unless(wheel_extract_min(w) == (void*)62);
+
+   fail_unless(wheel_size(w) == 0);
+}
+END_TEST
+
+START_TEST(test_walk)
+{
+   wheel_insert(w, 5, (void*)5);
+   wheel_insert(w, 2, (void*)2);
+   wheel_insert(w, 100000, (void*)100000);
+
+   uint64_t sum = 0;
+   wheel_walk(w, walk_fn, &sum);
+
+   fail_unless(sum == 100007);
+}
+END_TEST
+
+START_TEST(test_fifo)
+{
+   // Equal keys must come out in insertion order
+   wheel_insert(w, 1000, (void*)1);
+   wheel_insert(w, 1000, (void*)2);
+   wheel_insert(w, 7, (void*)3);
+   wheel_insert(w, 1000, (void*)4);
+
+   fail_unless(wheel_extract_min(w) == (void*)3);
+   fail_unless(wheel_extract_min(w) == (void*)1);
+   fail_unless(wheel_extract_min(w) == (void*)2);
+   fail_unless(wheel_extract_min(w) == (void*)4);
+}
+END_TEST
+
+START_TEST(test_rebase)
+{
+   // Inserting a key earlier than the current minimum
+   wheel_insert(w, 0x123456, (void*)0x123456);
+   fail_unless(wheel_min(w) == (void*)0x123456);
+
+   wheel_insert(w, 0x10, (void*)0x10);
+   wheel_insert(w, 0x123400, (void*)0x123400);
+
+   fail_unless(wheel_extract_min(w) == (void*)0x10);
+   fail_unless(wheel_extract_min(w) == (void*)0x123400);
+   fail_unless(wheel_extract_min(w) == (void*)0x123456);
+}
+END_TEST
+
+START_TEST(test_rand)
+{
+   static const int N = 1024;
+   uintptr_t keys[N];
+
+   for (int i = 0; i < N; i++) {
+      keys[i] = ((uint64_t)random() << 20) ^ random();
+      wheel_insert(w, keys[i], (void*)keys[i]);
+   }
+
+   qsort(keys, N, sizeof(uintptr_t), magnitude_compar);
+
+   for (int i = 0; i < N; i++)
+      fail_unless(wheel_extract_min(w) == (void*)keys[i]);
+}
+END_TEST
+
+START_TEST(test_interleave)
+{
+   // Keys inserted relative to the last extracted key as a simulation
+   // kernel would do
+   uint64_t now = 0, last = 0;
+   for (int i = 0; i < 64; i++)
+      wheel_insert(w, random() % 5000, (void*)0);
+
+   for (int i = 0; i < 20000; i++) {
+      now = wheel_min_key(w);
+      fail_if(now < last);
+      last = now;
+
+      wheel_extract_min(w);
+      wheel_insert(w, now + 1 + (random() % 100000), (void*)0);
+   }
+
+   fail_unless(wheel_size(w) == 64);
+}
+END_TEST
+
+int main(void)
+{
+   srandom((unsigned)time(NULL));
+
+   Suite *s = suite_create("wheel");
+
+   TCase *tc_core = tcase_create("Core");
+   tcase_add_checked_fixture(tc_core, setup, teardown);
+   tcase_add_test(tc_core, test_basic);
+   tcase_add_test(tc_core, test_rand);
+   tcase_add_test(tc_core, test_walk);
+   tcase_add_test(tc_core, test_fifo);
+   tcase_add_test(tc_core, test_rebase);
+   tcase_add_test(tc_core, test_interleave);
+   suite_add_tcase(s, tc_core);
+
+   SRunner *sr = srunner_create(s);
+   srunner_run_all(sr, CK_NORMAL);
+
+   int nfail = srunner_ntests_failed(sr);
+
+   srunner_free(sr);
+
+   return nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}